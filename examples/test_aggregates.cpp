@@ -0,0 +1,197 @@
+// Checks that the nodes keep the aggregates of their subtrees through every
+// kind of update, and that aggregate_within_range() combines the right
+// values.
+
+// Make SURE all our asserts() are checked
+#undef NDEBUG
+
+#include <kdtree++/kdtree.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+struct point
+{
+  typedef int value_type;
+
+  value_type operator[](size_t n) const { return xyz[n]; }
+
+  int xyz[3];
+  int weight;
+  size_t index;
+};
+
+inline bool operator==(point const& A, point const& B)
+{
+  return A.index == B.index;
+}
+
+// the number of values, their total weight and their largest weight
+struct stats
+{
+  stats(size_t c = 0, long s = 0, int m = -1) : count(c), sum(s), max(m) { }
+
+  bool operator==(stats const& x) const
+  { return count == x.count && sum == x.sum && max == x.max; }
+
+  size_t count;
+  long sum;
+  int max;
+};
+
+struct weight_stats
+{
+  typedef stats aggregate_type;
+
+  static stats identity() { return stats(); }
+
+  static stats lift(point const& p) { return stats(1, p.weight, p.weight); }
+
+  static stats combine(stats const& a, stats const& b)
+  { return stats(a.count + b.count, a.sum + b.sum, std::max(a.max, b.max)); }
+};
+
+typedef KDTree::KDTree<3, point, KDTree::_Bracket_accessor<point>,
+                       KDTree::squared_difference<int, int>, std::less<int>,
+                       std::allocator<KDTree::_Node<point> >,
+                       KDTree::cyclic_split, weight_stats> tree_type;
+
+// the nodes are allocated from a pool of the larger node type
+typedef KDTree::KDTree<3, point, KDTree::_Bracket_accessor<point>,
+                       KDTree::squared_difference<int, int>, std::less<int>,
+                       KDTree::pool_allocator<KDTree::_Node<point> >,
+                       KDTree::cyclic_split, weight_stats> pool_tree_type;
+
+point random_point(size_t index)
+{
+  point p;
+  for (size_t k = 0; k != 3; ++k)
+    p.xyz[k] = rand() % 50;
+  p.weight = rand() % 1000;
+  p.index = index;
+  return p;
+}
+
+bool within(point const& p, point const& q, int r)
+{
+  for (size_t k = 0; k != 3; ++k)
+    if (std::abs(p.xyz[k] - q.xyz[k]) > r)
+      return false;
+  return true;
+}
+
+template <class Tree>
+void check(Tree const& tree, point const& q, int r)
+{
+  stats expected, all;
+  for (typename Tree::const_iterator i = tree.begin(); i != tree.end(); ++i)
+    {
+      all = weight_stats::combine(all, weight_stats::lift(*i));
+      if (within(*i, q, r))
+        expected = weight_stats::combine(expected, weight_stats::lift(*i));
+    }
+  assert(tree.aggregate() == all);
+  assert(all.count == tree.size());
+  assert(tree.aggregate_within_range(q, r) == expected);
+  assert(expected.count == tree.count_within_range(q, r));
+}
+
+template <class Tree>
+void check_all(Tree& tree)
+{
+  tree.check_tree();
+  for (size_t i = 0; i != 20; ++i)
+    {
+      point const q = random_point(0);
+      check(tree, q, 3);
+      check(tree, q, 20);
+    }
+  point centre;
+  centre.xyz[0] = centre.xyz[1] = centre.xyz[2] = 25;
+  check(tree, centre, 100);
+}
+
+int main()
+{
+  tree_type tree;
+  check(tree, random_point(0), 10);
+  assert(tree.aggregate() == stats());
+
+  // one by one, then rebuilt
+  size_t next = 0;
+  for (; next != 2000; ++next)
+    tree.insert(random_point(next));
+#if __cplusplus >= 201103L
+  tree.emplace(random_point(next++));
+#endif
+  check_all(tree);
+  tree.optimise();
+  check_all(tree);
+
+  // erased one by one, moving the nodes around
+  std::vector<point> values(tree.begin(), tree.end());
+  for (size_t i = 0; i < values.size(); i += 4)
+    tree.erase_exact(values[i]);
+  check_all(tree);
+
+  // in batches, and erased in bulk
+  std::vector<point> batch;
+  for (size_t i = 0; i != 500; ++i)
+    batch.push_back(random_point(next++));
+  tree.insert(batch.begin(), batch.end());
+  check_all(tree);
+  point low;
+  low.xyz[0] = low.xyz[1] = low.xyz[2] = 10;
+  tree.erase_within_range(low, 10);
+  check_all(tree);
+
+  // erased lazily, then compacted
+  tree.set_lazy_erase(0.5);
+  values.assign(tree.begin(), tree.end());
+  for (size_t i = 0; i < values.size(); i += 3)
+    tree.erase_exact(values[i]);
+  check_all(tree);
+  tree.set_lazy_erase(0);
+  check_all(tree);
+
+  // copied, and kept balanced while values arrive sorted
+  tree_type copy(tree);
+  check_all(copy);
+  tree_type sorted;
+  sorted.set_balance(0.7);
+  for (size_t i = 0; i != 2000; ++i)
+    {
+      point p = random_point(i);
+      p.xyz[0] = int(i % 50);
+      p.xyz[1] = int(i / 50);
+      p.xyz[2] = 0;
+      sorted.insert(p);
+    }
+  check_all(sorted);
+
+  pool_tree_type pooled;
+  for (size_t i = 0; i != 1000; ++i)
+    pooled.insert(random_point(i));
+  check_all(pooled);
+  pooled.clear();
+  check_all(pooled);
+
+  std::printf("aggregates test passed\n");
+  return 0;
+}
+
+/* COPYRIGHT --
+ *
+ * This file is part of libkdtree++, a C++ template KD-Tree sorting container.
+ * libkdtree++ is (c) 2004-2007 Martin F. Krafft <libkdtree@pobox.madduck.net>
+ * and Sylvain Bougerel <sylvain.bougerel.devel@gmail.com> distributed under the
+ * terms of the Artistic License 2.0. See the ./COPYING file in the source tree
+ * root for more information.
+ *
+ * THIS PACKAGE IS PROVIDED "AS IS" AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES
+ * OF MERCHANTIBILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
@@ -0,0 +1,131 @@
+// Checks that a KDTree with set_balance() stays shallow when its values
+// arrive sorted, and that the partial rebuilds keep iterators valid.
+
+// Make SURE all our asserts() are checked
+#undef NDEBUG
+
+#include <kdtree++/kdtree.hpp>
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+#include <vector>
+
+struct point
+{
+  typedef int value_type;
+
+  value_type operator[](size_t n) const { return xy[n]; }
+
+  int xy[2];
+  size_t index;
+};
+
+inline bool operator==(point const& A, point const& B)
+{
+  return A.index == B.index;
+}
+
+typedef KDTree::KDTree<2, point> tree_type;
+
+size_t brute_force_count(std::vector<point> const& points,
+                         std::vector<bool> const& erased,
+                         point const& target, int range)
+{
+  size_t count = 0;
+  for (size_t i = 0; i != points.size(); ++i)
+    if (!erased[i]
+        && std::abs(points[i].xy[0] - target.xy[0]) <= range
+        && std::abs(points[i].xy[1] - target.xy[1]) <= range)
+      ++count;
+  return count;
+}
+
+int main()
+{
+  size_t const n = 20000;
+  std::vector<point> points;
+  for (size_t i = 0; i != n; ++i)
+    {
+      point p;
+      p.xy[0] = int(i);
+      p.xy[1] = int(i % 100);
+      p.index = i;
+      points.push_back(p);
+    }
+  std::vector<bool> erased(n, false);
+
+  tree_type tree;
+  tree.set_balance(0.7);
+  assert(tree.balance() == 0.7);
+
+  // sorted values would make a list of a tree without rebuilds, and the
+  // searches below would then take quadratic time
+  std::vector<tree_type::const_iterator> iterators;
+  for (size_t i = 0; i != n; ++i)
+    iterators.push_back(tree.insert(points[i]));
+  tree.check_tree();
+  assert(tree.size() == n);
+  for (size_t i = 0; i != n; ++i)
+    {
+      assert(tree.find_exact(points[i]) == iterators[i]);
+      assert(*iterators[i] == points[i]);
+    }
+
+  // erase most of the values, which rebuilds the whole tree several times
+  for (size_t i = 0; i != n; ++i)
+    if (i % 5)
+      {
+        tree.erase(iterators[i]);
+        erased[i] = true;
+      }
+  tree.check_tree();
+  assert(tree.size() == n / 5);
+  assert(size_t(std::distance(tree.begin(), tree.end())) == n / 5);
+  for (size_t i = 0; i != n; i += 5)
+    assert(tree.find_exact(points[i]) == iterators[i]);
+
+  for (size_t q = 0; q != 200; ++q)
+    {
+      point target = points[rand() % n];
+      int const range = rand() % 500;
+      assert(tree.count_within_range(target, range)
+             == brute_force_count(points, erased, target, range));
+    }
+
+  // batches keep the balance too
+  std::vector<point> batch;
+  for (size_t i = 1; i < n; i += 5)
+    {
+      batch.push_back(points[i]);
+      erased[i] = false;
+    }
+  tree.insert(batch.begin(), batch.end());
+  tree.check_tree();
+  for (size_t i = 0; i != n; i += 5)
+    assert(tree.find_exact(points[i]) == iterators[i]);
+  for (size_t q = 0; q != 200; ++q)
+    {
+      point target = points[rand() % n];
+      int const range = rand() % 500;
+      assert(tree.count_within_range(target, range)
+             == brute_force_count(points, erased, target, range));
+    }
+
+  std::printf("balance test passed\n");
+  return 0;
+}
+
+/* COPYRIGHT --
+ *
+ * This file is part of libkdtree++, a C++ template KD-Tree sorting container.
+ * libkdtree++ is (c) 2004-2007 Martin F. Krafft <libkdtree@pobox.madduck.net>
+ * and Sylvain Bougerel <sylvain.bougerel.devel@gmail.com> distributed under the
+ * terms of the Artistic License 2.0. See the ./COPYING file in the source tree
+ * root for more information.
+ *
+ * THIS PACKAGE IS PROVIDED "AS IS" AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES
+ * OF MERCHANTIBILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
@@ -0,0 +1,117 @@
+// Checks that inserting a range of values in one go into a KDTree gives a
+// tree holding the same values as inserting them one by one.
+
+// Make SURE all our asserts() are checked
+#undef NDEBUG
+
+#include <kdtree++/kdtree.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+#include <vector>
+
+struct point
+{
+  typedef int value_type;
+
+  value_type operator[](size_t n) const { return xy[n]; }
+
+  int xy[2];
+  size_t index;
+};
+
+inline bool operator==(point const& A, point const& B)
+{
+  return A.index == B.index;
+}
+
+typedef KDTree::KDTree<2, point> tree_type;
+
+size_t brute_force_count(std::vector<point> const& points,
+                         point const& target, int range)
+{
+  size_t count = 0;
+  for (size_t i = 0; i != points.size(); ++i)
+    if (std::abs(points[i].xy[0] - target.xy[0]) <= range
+        && std::abs(points[i].xy[1] - target.xy[1]) <= range)
+      ++count;
+  return count;
+}
+
+void check(tree_type const& tree, std::vector<point> const& points)
+{
+  const_cast<tree_type&>(tree).check_tree();
+  assert(tree.size() == points.size());
+  assert(size_t(std::distance(tree.begin(), tree.end())) == points.size());
+  for (size_t i = 0; i != points.size(); ++i)
+    assert(tree.find_exact(points[i]) != tree.end());
+  for (size_t q = 0; q != 50; ++q)
+    {
+      point target = points[rand() % points.size()];
+      int const range = rand() % 20;
+      assert(tree.count_within_range(target, range)
+             == brute_force_count(points, target, range));
+    }
+}
+
+int main()
+{
+  std::vector<point> points;
+  tree_type tree;
+
+  // batches of every size relative to the tree, some of them sorted
+  size_t const batches[] = { 1, 1000, 10, 200, 3000, 1, 50, 20000 };
+  for (size_t b = 0; b != sizeof(batches) / sizeof(batches[0]); ++b)
+    {
+      std::vector<point> batch;
+      for (size_t i = 0; i != batches[b]; ++i)
+        {
+          point p;
+          if (b % 2)
+            {
+              p.xy[0] = int(i);
+              p.xy[1] = int(i) / 2;
+            }
+          else
+            {
+              p.xy[0] = rand() % 1000;
+              p.xy[1] = rand() % 1000;
+            }
+          p.index = points.size() + i;
+          batch.push_back(p);
+        }
+      tree.insert(batch.begin(), batch.end());
+      points.insert(points.end(), batch.begin(), batch.end());
+      check(tree, points);
+    }
+
+  // erasing afterwards still works
+  for (size_t i = 0; i < points.size(); i += 7)
+    tree.erase_exact(points[i]);
+  assert(tree.size() == points.size() - (points.size() + 6) / 7);
+  tree.check_tree();
+
+  // an empty range changes nothing
+  std::vector<point> none;
+  tree.insert(none.begin(), none.end());
+  tree.check_tree();
+
+  std::printf("batch insert test passed\n");
+  return 0;
+}
+
+/* COPYRIGHT --
+ *
+ * This file is part of libkdtree++, a C++ template KD-Tree sorting container.
+ * libkdtree++ is (c) 2004-2007 Martin F. Krafft <libkdtree@pobox.madduck.net>
+ * and Sylvain Bougerel <sylvain.bougerel.devel@gmail.com> distributed under the
+ * terms of the Artistic License 2.0. See the ./COPYING file in the source tree
+ * root for more information.
+ *
+ * THIS PACKAGE IS PROVIDED "AS IS" AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES
+ * OF MERCHANTIBILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
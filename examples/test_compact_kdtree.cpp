@@ -0,0 +1,197 @@
+// Checks that CompactKDTree answers the same queries as KDTree, whichever
+// split policy builds it, and that its nodes carry no more than two 32-bit
+// links next to their value.
+
+// Make SURE all our asserts() are checked
+#undef NDEBUG
+
+#include <kdtree++/kdtree.hpp>
+#include <kdtree++/compact_kdtree.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+#include <limits>
+#include <vector>
+
+struct point
+{
+  typedef double value_type;
+
+  value_type operator[](size_t n) const { return xyz[n]; }
+
+  double xyz[3];
+  size_t index;
+};
+
+inline bool operator==(point const& A, point const& B)
+{
+  return A.index == B.index;
+}
+
+struct count_visitor
+{
+  count_visitor() : count(0) {}
+  void operator()(point const&) { ++count; }
+  size_t count;
+};
+
+struct odd_index
+{
+  bool operator()(point const& p) const { return p.index % 2; }
+};
+
+typedef KDTree::KDTree<3, point> tree_type;
+typedef KDTree::CompactKDTree<3, point> compact_tree_type;
+typedef KDTree::CompactKDTree<3, point, KDTree::_Bracket_accessor<point>,
+                              KDTree::squared_difference<double, double>,
+                              std::less<double>, std::allocator<point>,
+                              KDTree::max_spread_split> spread_tree_type;
+typedef KDTree::CompactKDTree<3, point, KDTree::_Bracket_accessor<point>,
+                              KDTree::squared_difference<double, double>,
+                              std::less<double>, std::allocator<point>,
+                              KDTree::sliding_midpoint_split> midpoint_tree_type;
+typedef KDTree::CompactKDTree<3, point, KDTree::_Bracket_accessor<point>,
+                              KDTree::squared_difference<double, double>,
+                              std::less<double>, std::allocator<point>,
+                              KDTree::cost_model_split<> > cost_tree_type;
+
+point random_point(size_t index)
+{
+  point p;
+  // coarse grid, so that we also get points sharing coordinates
+  p.xyz[0] = double(rand() % 100) / 10;
+  p.xyz[1] = double(rand() % 100) / 10;
+  p.xyz[2] = double(rand() % 100) / 10;
+  p.index = index;
+  return p;
+}
+
+double distance(point const& a, point const& b)
+{
+  double d = 0;
+  for (size_t k = 0; k != 3; ++k)
+    d += (a[k] - b[k]) * (a[k] - b[k]);
+  return std::sqrt(d);
+}
+
+template <typename CompactTree>
+void test_compact_tree(std::vector<point> const& points, tree_type const& tree)
+{
+  typedef typename CompactTree::const_iterator const_iterator;
+  {
+    CompactTree empty;
+    point p = random_point(0);
+    assert(empty.size() == 0);
+    assert(empty.begin() == empty.end());
+    assert(empty.find(p) == empty.end());
+    assert(empty.find_nearest(p).first == empty.end());
+    assert(empty.find_nearest(p, 10).first == empty.end());
+    assert(empty.count_within_range(p, 10) == 0);
+  }
+
+  CompactTree compact_tree(points.begin(), points.end());
+  assert(compact_tree.size() == points.size());
+  assert(size_t(compact_tree.end() - compact_tree.begin()) == points.size());
+  assert(size_t(std::distance(compact_tree.rbegin(), compact_tree.rend()))
+         == points.size());
+
+  for (size_t i = 0; i != points.size(); ++i)
+    {
+      const_iterator found = compact_tree.find(points[i]);
+      assert(found != compact_tree.end());
+      const_iterator exact = compact_tree.find_exact(points[i]);
+      assert(exact != compact_tree.end() && exact->index == points[i].index);
+    }
+
+  for (size_t q = 0; q != 500; ++q)
+    {
+      point target = random_point(points.size());
+      double const range = double(rand() % 30) / 10;
+
+      std::vector<point> expected, got;
+      tree.find_within_range(target, range, std::back_inserter(expected));
+      compact_tree.find_within_range(target, range, std::back_inserter(got));
+      assert(expected.size() == got.size());
+      assert(compact_tree.count_within_range(target, range) == got.size());
+      assert(compact_tree.visit_within_range(target, range, count_visitor()).count
+             == got.size());
+
+      std::pair<tree_type::const_iterator, double> nearest
+        = tree.find_nearest(target);
+      std::pair<const_iterator, double> compact_nearest
+        = compact_tree.find_nearest(target);
+      assert(compact_nearest.first != compact_tree.end());
+      assert(nearest.second == compact_nearest.second);
+      assert(distance(*compact_nearest.first, target) == nearest.second);
+
+      std::pair<const_iterator, double> within
+        = compact_tree.find_nearest(target, range);
+      if (nearest.second <= range)
+        assert(within.first != compact_tree.end()
+               && within.second == nearest.second);
+      else
+        assert(within.first == compact_tree.end());
+
+      std::pair<tree_type::const_iterator, double> odd
+        = tree.find_nearest_if(target, 100, odd_index());
+      std::pair<const_iterator, double> compact_odd
+        = compact_tree.find_nearest_if(target, 100, odd_index());
+      assert(compact_odd.first->index % 2 && odd.second == compact_odd.second);
+
+      std::vector<std::pair<tree_type::const_iterator, double> > k_expected;
+      std::vector<std::pair<const_iterator, double> > k_got;
+      tree.find_k_nearest(target, 7, std::back_inserter(k_expected));
+      compact_tree.find_k_nearest(target, 7, std::back_inserter(k_got));
+      assert(k_expected.size() == k_got.size());
+      for (size_t i = 0; i != k_got.size(); ++i)
+        {
+          assert(k_expected[i].second == k_got[i].second);
+          assert(distance(*k_got[i].first, target) == k_got[i].second);
+        }
+    }
+
+  CompactTree swapped;
+  swapped.swap(compact_tree);
+  assert(compact_tree.empty() && swapped.size() == points.size());
+  swapped.clear();
+  assert(swapped.empty());
+}
+
+int main()
+{
+  // a value and two 32-bit words; KDTree needs three links on top of it
+  assert(sizeof(KDTree::_Compact_node<point>) <= sizeof(point) + 8);
+  assert(sizeof(KDTree::_Compact_node<point>) < sizeof(KDTree::_Node<point>));
+
+  std::vector<point> points;
+  for (size_t i = 0; i != 2000; ++i)
+    points.push_back(random_point(i));
+
+  tree_type tree(points.begin(), points.end());
+
+  test_compact_tree<compact_tree_type>(points, tree);
+  test_compact_tree<spread_tree_type>(points, tree);
+  test_compact_tree<midpoint_tree_type>(points, tree);
+  test_compact_tree<cost_tree_type>(points, tree);
+
+  std::printf("CompactKDTree agrees with KDTree on %u points\n",
+              unsigned(points.size()));
+  return 0;
+}
+
+/* COPYRIGHT --
+ *
+ * This file is part of libkdtree++, a C++ template KD-Tree sorting container.
+ * libkdtree++ is (c) 2004-2007 Martin F. Krafft <libkdtree@pobox.madduck.net>
+ * and Sylvain Bougerel <sylvain.bougerel.devel@gmail.com> distributed under the
+ * terms of the Artistic License 2.0. See the ./COPYING file in the source tree
+ * root for more information.
+ *
+ * THIS PACKAGE IS PROVIDED "AS IS" AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES
+ * OF MERCHANTIBILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
@@ -0,0 +1,152 @@
+// Checks that the nearest neighbour searches report the distances given by
+// distance_traits, for the default squared distance and for a city-block
+// distance whose sums need no conversion.
+
+// Make SURE all our asserts() are checked
+#undef NDEBUG
+
+#include <kdtree++/kdtree.hpp>
+#include <kdtree++/static_kdtree.hpp>
+#include <kdtree++/forest.hpp>
+
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iterator>
+#include <vector>
+
+struct point
+{
+  typedef int value_type;
+
+  value_type operator[](size_t n) const { return xy[n]; }
+
+  int xy[2];
+  size_t index;
+};
+
+inline bool operator==(point const& A, point const& B)
+{
+  return A.index == B.index;
+}
+
+struct city_block
+{
+  typedef int distance_type;
+
+  distance_type operator()(int a, int b) const { return std::abs(a - b); }
+};
+
+namespace KDTree
+{
+  template <>
+  struct distance_traits<city_block>
+  {
+    typedef int distance_type;
+
+    static distance_type to_distance(distance_type __sum) { return __sum; }
+    static distance_type from_distance(distance_type __d) { return __d; }
+  };
+}
+
+typedef KDTree::KDTree<2, point, KDTree::_Bracket_accessor<point>,
+                       city_block> city_tree;
+typedef KDTree::StaticKDTree<2, point, KDTree::_Bracket_accessor<point>,
+                             city_block> city_static_tree;
+typedef KDTree::KDForest<2, point, KDTree::_Bracket_accessor<point>,
+                         city_block> city_forest;
+typedef KDTree::KDTree<2, point, KDTree::_Bracket_accessor<point>,
+                       KDTree::squared_difference<int, double> > euclid_tree;
+
+int city_distance(point const& a, point const& b)
+{
+  return std::abs(a.xy[0] - b.xy[0]) + std::abs(a.xy[1] - b.xy[1]);
+}
+
+double euclid_distance(point const& a, point const& b)
+{
+  double const dx = a.xy[0] - b.xy[0], dy = a.xy[1] - b.xy[1];
+  return std::sqrt(dx * dx + dy * dy);
+}
+
+template <typename Container>
+void check_city(Container const& c, std::vector<point> const& points,
+                point const& target)
+{
+  int best = city_distance(points[0], target);
+  for (size_t i = 1; i != points.size(); ++i)
+    best = std::min(best, city_distance(points[i], target));
+
+  std::pair<typename Container::const_iterator, int> nearest
+    = c.find_nearest(target);
+  assert(nearest.second == best);
+  assert(city_distance(*nearest.first, target) == best);
+  // the bound is inclusive, and exact for integer distances
+  nearest = c.find_nearest(target, best);
+  assert(nearest.first != c.end() && nearest.second == best);
+  assert(best == 0 || c.find_nearest(target, best - 1).first == c.end());
+}
+
+int main()
+{
+  std::vector<point> points;
+  for (size_t i = 0; i != 2000; ++i)
+    {
+      point p;
+      p.xy[0] = rand() % 1000;
+      p.xy[1] = rand() % 1000;
+      p.index = i;
+      points.push_back(p);
+    }
+
+  city_tree tree(points.begin(), points.end());
+  city_static_tree static_tree(points.begin(), points.end());
+  city_forest forest(points.begin(), points.end());
+  euclid_tree euclid(points.begin(), points.end());
+
+  for (size_t q = 0; q != 200; ++q)
+    {
+      point target;
+      target.xy[0] = rand() % 1000;
+      target.xy[1] = rand() % 1000;
+      target.index = points.size();
+      check_city(tree, points, target);
+      check_city(static_tree, points, target);
+      check_city(forest, points, target);
+
+      std::vector<std::pair<city_tree::const_iterator, int> > k_nearest;
+      tree.find_k_nearest(target, 5, std::back_inserter(k_nearest));
+      assert(k_nearest.size() == 5);
+      for (size_t i = 0; i != k_nearest.size(); ++i)
+        assert(city_distance(*k_nearest[i].first, target)
+               == k_nearest[i].second);
+
+      double best = euclid_distance(points[0], target);
+      for (size_t i = 1; i != points.size(); ++i)
+        best = std::min(best, euclid_distance(points[i], target));
+      std::pair<euclid_tree::const_iterator, double> nearest
+        = euclid.find_nearest(target);
+      assert(nearest.second == best);
+      // a value at exactly the reported distance is still found
+      nearest = euclid.find_nearest(target, best);
+      assert(nearest.first != euclid.end() && nearest.second == best);
+    }
+
+  std::printf("distance traits test passed\n");
+  return 0;
+}
+
+/* COPYRIGHT --
+ *
+ * This file is part of libkdtree++, a C++ template KD-Tree sorting container.
+ * libkdtree++ is (c) 2004-2007 Martin F. Krafft <libkdtree@pobox.madduck.net>
+ * and Sylvain Bougerel <sylvain.bougerel.devel@gmail.com> distributed under the
+ * terms of the Artistic License 2.0. See the ./COPYING file in the source tree
+ * root for more information.
+ *
+ * THIS PACKAGE IS PROVIDED "AS IS" AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES
+ * OF MERCHANTIBILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
@@ -0,0 +1,139 @@
+// Checks that erase_if(), erase_within_range() and erase(first, last)
+// erase exactly the values asked for, and keep the iterators on the others.
+
+// Make SURE all our asserts() are checked
+#undef NDEBUG
+
+#include <kdtree++/kdtree.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+#include <vector>
+
+struct point
+{
+  typedef int value_type;
+
+  value_type operator[](size_t n) const { return xy[n]; }
+
+  int xy[2];
+  size_t index;
+};
+
+inline bool operator==(point const& A, point const& B)
+{
+  return A.index == B.index;
+}
+
+typedef KDTree::KDTree<2, point> tree_type;
+
+struct index_divisible_by
+{
+  index_divisible_by(size_t d) : d(d) {}
+  bool operator()(point const& p) const { return p.index % d == 0; }
+  size_t d;
+};
+
+bool inside(point const& p, point const& target, int range)
+{
+  return std::abs(p.xy[0] - target.xy[0]) <= range
+    && std::abs(p.xy[1] - target.xy[1]) <= range;
+}
+
+void check(tree_type const& tree, std::vector<point> const& points,
+           std::vector<bool> const& erased,
+           std::vector<tree_type::const_iterator> const& iterators)
+{
+  const_cast<tree_type&>(tree).check_tree();
+  size_t const live = std::count(erased.begin(), erased.end(), false);
+  assert(tree.size() == live);
+  assert(size_t(std::distance(tree.begin(), tree.end())) == live);
+  for (size_t i = 0; i != points.size(); ++i)
+    if (erased[i])
+      assert(tree.find_exact(points[i]) == tree.end());
+    else
+      assert(tree.find_exact(points[i]) == iterators[i]);
+  for (size_t q = 0; q != 50; ++q)
+    {
+      point target = points[rand() % points.size()];
+      int const range = rand() % 50;
+      size_t expected = 0;
+      for (size_t i = 0; i != points.size(); ++i)
+        expected += !erased[i] && inside(points[i], target, range);
+      assert(tree.count_within_range(target, range) == expected);
+    }
+}
+
+void test_erase(double max_dead)
+{
+  std::vector<point> points;
+  for (size_t i = 0; i != 20000; ++i)
+    {
+      point p;
+      p.xy[0] = rand() % 1000;
+      p.xy[1] = rand() % 1000;
+      p.index = i;
+      points.push_back(p);
+    }
+  std::vector<bool> erased(points.size(), false);
+
+  tree_type tree(points.begin(), points.end());
+  tree.set_lazy_erase(max_dead);
+  std::vector<tree_type::const_iterator> iterators;
+  for (size_t i = 0; i != points.size(); ++i)
+    iterators.push_back(tree.find_exact(points[i]));
+
+  assert(tree.erase_if(index_divisible_by(3)) == (points.size() + 2) / 3);
+  for (size_t i = 0; i < points.size(); i += 3)
+    erased[i] = true;
+  check(tree, points, erased, iterators);
+
+  point target = points[1];
+  size_t const in_range = tree.count_within_range(target, 100);
+  assert(tree.erase_within_range(target, 100) == in_range);
+  for (size_t i = 0; i != points.size(); ++i)
+    if (inside(points[i], target, 100))
+      erased[i] = true;
+  assert(tree.count_within_range(target, 100) == 0);
+  check(tree, points, erased, iterators);
+  assert(tree.erase_within_range(target, 100) == 0);
+
+  // a third of the values, in the order of iteration
+  tree_type::const_iterator first = tree.begin(), last = tree.begin();
+  std::advance(first, tree.size() / 3);
+  std::advance(last, 2 * tree.size() / 3);
+  for (tree_type::const_iterator it = first; it != last; ++it)
+    erased[it->index] = true;
+  tree.erase(first, last);
+  check(tree, points, erased, iterators);
+
+  assert(tree.erase_if(index_divisible_by(1)) == tree_type::size_type(
+           std::count(erased.begin(), erased.end(), false)));
+  assert(tree.empty() && tree.begin() == tree.end());
+  assert(tree.erase_if(index_divisible_by(1)) == 0);
+}
+
+int main()
+{
+  test_erase(0);
+  test_erase(0.5);
+
+  std::printf("erase_if test passed\n");
+  return 0;
+}
+
+/* COPYRIGHT --
+ *
+ * This file is part of libkdtree++, a C++ template KD-Tree sorting container.
+ * libkdtree++ is (c) 2004-2007 Martin F. Krafft <libkdtree@pobox.madduck.net>
+ * and Sylvain Bougerel <sylvain.bougerel.devel@gmail.com> distributed under the
+ * terms of the Artistic License 2.0. See the ./COPYING file in the source tree
+ * root for more information.
+ *
+ * THIS PACKAGE IS PROVIDED "AS IS" AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES
+ * OF MERCHANTIBILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
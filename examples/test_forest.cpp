@@ -0,0 +1,210 @@
+// Checks that a KDForest answers the same queries as a brute force search
+// while values keep arriving.
+
+// Make SURE all our asserts() are checked
+#undef NDEBUG
+
+#include <kdtree++/forest.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+struct point
+{
+  typedef double value_type;
+
+  value_type operator[](size_t n) const { return xyz[n]; }
+
+  double xyz[3];
+  size_t index;
+};
+
+inline bool operator==(point const& A, point const& B)
+{
+  return A.index == B.index;
+}
+
+struct count_visitor
+{
+  count_visitor() : count(0) {}
+  void operator()(point const&) { ++count; }
+  size_t count;
+};
+
+// a small buffer, so that many trees get built
+typedef KDTree::KDForest<3, point, KDTree::_Bracket_accessor<point>,
+                         KDTree::squared_difference<double, double>,
+                         std::less<double>, std::allocator<point>,
+                         KDTree::inline_coordinates, 16> forest_type;
+
+// throws while failing is set, to make the carries fail
+bool failing = false;
+
+struct failing_less
+{
+  bool operator()(double a, double b) const
+  {
+    if (failing)
+      throw std::runtime_error("comparison failed");
+    return a < b;
+  }
+};
+
+typedef KDTree::KDForest<3, point, KDTree::_Bracket_accessor<point>,
+                         KDTree::squared_difference<double, double>,
+                         failing_less, std::allocator<point>,
+                         KDTree::inline_coordinates, 16> failing_forest_type;
+
+point random_point(size_t index)
+{
+  point p;
+  // coarse grid, so that we also get points sharing coordinates
+  p.xyz[0] = double(rand() % 100) / 10;
+  p.xyz[1] = double(rand() % 100) / 10;
+  p.xyz[2] = double(rand() % 100) / 10;
+  p.index = index;
+  return p;
+}
+
+double distance(point const& a, point const& b)
+{
+  double d = 0;
+  for (size_t k = 0; k != 3; ++k)
+    d += (a[k] - b[k]) * (a[k] - b[k]);
+  return std::sqrt(d);
+}
+
+size_t brute_force_count(std::vector<point> const& points,
+                         point const& target, double range)
+{
+  // the same bounds as the region of the forest, to round alike
+  size_t count = 0;
+  for (size_t i = 0; i != points.size(); ++i)
+    {
+      bool inside = true;
+      for (size_t k = 0; k != 3; ++k)
+        inside = inside && target[k] - range <= points[i][k]
+          && points[i][k] <= target[k] + range;
+      if (inside)
+        ++count;
+    }
+  return count;
+}
+
+template <class Forest>
+void check(Forest const& forest, std::vector<point> const& points)
+{
+  assert(forest.size() == points.size());
+  assert(size_t(std::distance(forest.begin(), forest.end()))
+         == points.size());
+  for (size_t i = 0; i != points.size(); ++i)
+    {
+      typename Forest::const_iterator it = forest.find_exact(points[i]);
+      assert(it != forest.end() && *it == points[i]);
+      assert(forest.find(points[i]) != forest.end());
+    }
+
+  for (size_t q = 0; q != 50; ++q)
+    {
+      point target = random_point(points.size());
+      double const range = double(rand() % 20) / 10;
+      size_t const expected = brute_force_count(points, target, range);
+      assert(forest.count_within_range(target, range) == expected);
+      std::vector<point> found;
+      forest.find_within_range(target, range, std::back_inserter(found));
+      assert(found.size() == expected);
+      assert(forest.visit_within_range(target, range,
+                                       count_visitor()).count == expected);
+
+      double best = std::numeric_limits<double>::max();
+      for (size_t i = 0; i != points.size(); ++i)
+        best = std::min(best, distance(points[i], target));
+      std::pair<typename Forest::const_iterator, double> nearest
+        = forest.find_nearest(target);
+      assert(nearest.first != forest.end());
+      assert(nearest.second == best);
+      assert(distance(*nearest.first, target) == best);
+      // nothing is nearer than the nearest
+      assert(best == 0
+             || forest.find_nearest(target, best / 2).first == forest.end());
+    }
+}
+
+int main()
+{
+  forest_type forest;
+  assert(forest.empty() && forest.begin() == forest.end());
+  assert(forest.find_nearest(random_point(0)).first == forest.end());
+
+  std::vector<point> points;
+  size_t const checkpoints[] = { 1, 15, 16, 17, 48, 100, 1000, 5000 };
+  for (size_t c = 0; c != sizeof(checkpoints) / sizeof(checkpoints[0]); ++c)
+    {
+      while (points.size() != checkpoints[c])
+        {
+          points.push_back(random_point(points.size()));
+          forest.insert(points.back());
+        }
+      check(forest, points);
+    }
+  // 5000 values in trees of 16 * 2^i values and fewer than 16 left over
+  assert(forest.levels() == 9);
+
+  forest_type copy(points.begin(), points.end());
+  check(copy, points);
+  forest.clear();
+  assert(forest.empty() && forest.begin() == forest.end());
+  forest.swap(copy);
+  check(forest, points);
+
+  // an insert whose carry throws leaves the forest as it was
+  failing_forest_type failing_forest;
+  points.clear();
+  while (points.size() != 63)
+    {
+      points.push_back(random_point(points.size()));
+      failing_forest.insert(points.back());
+    }
+  failing = true;
+  bool thrown = false;
+  try
+    {
+      failing_forest.insert(random_point(points.size()));
+    }
+  catch (std::runtime_error const&)
+    {
+      thrown = true;
+    }
+  failing = false;
+  assert(thrown);
+  assert(failing_forest.levels() == 2);
+  check(failing_forest, points);
+  points.push_back(random_point(points.size()));
+  failing_forest.insert(points.back());
+  assert(failing_forest.levels() == 3);
+  check(failing_forest, points);
+
+  std::printf("forest test passed\n");
+  return 0;
+}
+
+/* COPYRIGHT --
+ *
+ * This file is part of libkdtree++, a C++ template KD-Tree sorting container.
+ * libkdtree++ is (c) 2004-2007 Martin F. Krafft <libkdtree@pobox.madduck.net>
+ * and Sylvain Bougerel <sylvain.bougerel.devel@gmail.com> distributed under the
+ * terms of the Artistic License 2.0. See the ./COPYING file in the source tree
+ * root for more information.
+ *
+ * THIS PACKAGE IS PROVIDED "AS IS" AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES
+ * OF MERCHANTIBILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
@@ -0,0 +1,145 @@
+// Checks find_k_nearest() and find_k_nearest_if() against a brute force
+// search.
+
+// Make SURE all our asserts() are checked
+#undef NDEBUG
+
+#include <kdtree++/kdtree.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+struct point
+{
+  typedef double value_type;
+
+  value_type operator[](size_t n) const { return xyz[n]; }
+
+  double xyz[3];
+  size_t index;
+};
+
+inline bool operator==(point const& A, point const& B)
+{
+  return A.index == B.index;
+}
+
+typedef KDTree::KDTree<3, point> tree_type;
+typedef std::pair<tree_type::const_iterator, double> result_type;
+
+struct even_index
+{
+  bool operator()(point const& p) const { return p.index % 2 == 0; }
+};
+
+point random_point(size_t index)
+{
+  point p;
+  // coarse grid, so that we also get ties
+  for (size_t k = 0; k != 3; ++k)
+    p.xyz[k] = double(rand() % 100) / 10;
+  p.index = index;
+  return p;
+}
+
+double distance(point const& a, point const& b)
+{
+  double d = 0;
+  for (size_t k = 0; k != 3; ++k)
+    d += (a[k] - b[k]) * (a[k] - b[k]);
+  return std::sqrt(d);
+}
+
+void check(tree_type const& tree, std::vector<point> const& points,
+           std::vector<bool> const& erased, point const& target, size_t k,
+           bool even_only, double max)
+{
+  std::vector<double> expected;
+  for (size_t i = 0; i != points.size(); ++i)
+    if (!erased[i] && (!even_only || i % 2 == 0)
+        && distance(points[i], target) <= max)
+      expected.push_back(distance(points[i], target));
+  std::sort(expected.begin(), expected.end());
+  if (expected.size() > k)
+    expected.resize(k);
+
+  std::vector<result_type> got;
+  if (even_only)
+    tree.find_k_nearest_if(target, k, max, even_index(),
+                           std::back_inserter(got));
+  else
+    tree.find_k_nearest(target, k, std::back_inserter(got));
+  assert(got.size() == expected.size());
+  for (size_t i = 0; i != got.size(); ++i)
+    {
+      assert(got[i].second == expected[i]);
+      assert(distance(*got[i].first, target) == got[i].second);
+      assert(!erased[got[i].first->index]);
+      assert(!even_only || got[i].first->index % 2 == 0);
+      // no value twice
+      for (size_t j = 0; j != i; ++j)
+        assert(got[j].first != got[i].first);
+    }
+}
+
+int main()
+{
+  std::vector<point> points;
+  for (size_t i = 0; i != 5000; ++i)
+    points.push_back(random_point(i));
+  std::vector<bool> erased(points.size(), false);
+  tree_type tree(points.begin(), points.end());
+
+  std::vector<result_type> none;
+  tree_type().find_k_nearest(points[0], 3, std::back_inserter(none));
+  tree.find_k_nearest(points[0], 0, std::back_inserter(none));
+  assert(none.empty());
+
+  size_t const ks[] = { 1, 2, 10, 100, 10000 };
+  for (size_t q = 0; q != 100; ++q)
+    {
+      point target = random_point(points.size());
+      size_t const k = ks[q % 5];
+      check(tree, points, erased, target, k, false, 1e9);
+      check(tree, points, erased, target, k, true, double(q % 10) / 5);
+      if (k == 1)
+        {
+          std::vector<result_type> got;
+          tree.find_k_nearest(target, 1, std::back_inserter(got));
+          assert(got[0].second == tree.find_nearest(target).second);
+        }
+    }
+
+  // dead nodes are skipped
+  tree.set_lazy_erase(0.5);
+  for (size_t i = 0; i < points.size(); i += 3)
+    {
+      tree.erase_exact(points[i]);
+      erased[i] = true;
+    }
+  for (size_t q = 0; q != 50; ++q)
+    check(tree, points, erased, random_point(points.size()), ks[q % 5],
+          false, 1e9);
+
+  std::printf("k nearest test passed\n");
+  return 0;
+}
+
+/* COPYRIGHT --
+ *
+ * This file is part of libkdtree++, a C++ template KD-Tree sorting container.
+ * libkdtree++ is (c) 2004-2007 Martin F. Krafft <libkdtree@pobox.madduck.net>
+ * and Sylvain Bougerel <sylvain.bougerel.devel@gmail.com> distributed under the
+ * terms of the Artistic License 2.0. See the ./COPYING file in the source tree
+ * root for more information.
+ *
+ * THIS PACKAGE IS PROVIDED "AS IS" AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES
+ * OF MERCHANTIBILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
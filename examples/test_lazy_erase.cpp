@@ -0,0 +1,191 @@
+// Checks that a KDTree erasing lazily hides the erased values from the
+// iterators and all the searches, and that compacting it keeps the others.
+
+// Make SURE all our asserts() are checked
+#undef NDEBUG
+
+#include <kdtree++/kdtree.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+#include <limits>
+#include <vector>
+
+struct point
+{
+  typedef double value_type;
+
+  value_type operator[](size_t n) const { return xyz[n]; }
+
+  double xyz[3];
+  size_t index;
+};
+
+inline bool operator==(point const& A, point const& B)
+{
+  return A.index == B.index;
+}
+
+typedef KDTree::KDTree<3, point> tree_type;
+
+point random_point(size_t index)
+{
+  point p;
+  for (size_t k = 0; k != 3; ++k)
+    p.xyz[k] = double(rand() % 100) / 10;
+  p.index = index;
+  return p;
+}
+
+double distance(point const& a, point const& b)
+{
+  double d = 0;
+  for (size_t k = 0; k != 3; ++k)
+    d += (a[k] - b[k]) * (a[k] - b[k]);
+  return std::sqrt(d);
+}
+
+void check(tree_type const& tree, std::vector<point> const& points,
+           std::vector<bool> const& erased)
+{
+  const_cast<tree_type&>(tree).check_tree();
+  size_t live = std::count(erased.begin(), erased.end(), false);
+  assert(tree.size() == live);
+  assert(size_t(std::distance(tree.begin(), tree.end())) == live);
+  assert(size_t(std::distance(tree.rbegin(), tree.rend())) == live);
+  for (tree_type::const_iterator it = tree.begin(); it != tree.end(); ++it)
+    assert(!erased[it->index]);
+  for (size_t i = 0; i != points.size(); ++i)
+    assert((tree.find_exact(points[i]) == tree.end()) == erased[i]);
+
+  for (size_t q = 0; q != 100; ++q)
+    {
+      // also look for the erased values themselves
+      point target = (q % 2) ? points[rand() % points.size()]
+                             : random_point(points.size());
+      double const range = double(rand() % 20) / 10;
+      size_t expected = 0;
+      double best = std::numeric_limits<double>::max();
+      for (size_t i = 0; i != points.size(); ++i)
+        if (!erased[i])
+          {
+            bool inside = true;
+            for (size_t k = 0; k != 3; ++k)
+              inside = inside && target[k] - range <= points[i][k]
+                && points[i][k] <= target[k] + range;
+            expected += inside;
+            best = std::min(best, distance(points[i], target));
+          }
+      assert(tree.count_within_range(target, range) == expected);
+      std::vector<point> found;
+      tree.find_within_range(target, range, std::back_inserter(found));
+      assert(found.size() == expected);
+
+      if (!live)
+        continue;
+      std::pair<tree_type::const_iterator, double> nearest
+        = tree.find_nearest(target);
+      assert(nearest.first != tree.end() && !erased[nearest.first->index]);
+      assert(nearest.second == best);
+      nearest = tree.find_nearest(target, 100);
+      assert(nearest.first != tree.end() && !erased[nearest.first->index]);
+      assert(nearest.second == best);
+    }
+}
+
+int main()
+{
+  std::vector<point> points;
+  for (size_t i = 0; i != 5000; ++i)
+    points.push_back(random_point(i));
+  std::vector<bool> erased(points.size(), false);
+
+  tree_type tree(points.begin(), points.end());
+  tree.set_lazy_erase(0.3);
+  assert(tree.lazy_erase() == 0.3);
+  std::vector<tree_type::const_iterator> iterators;
+  for (size_t i = 0; i != points.size(); ++i)
+    iterators.push_back(tree.find_exact(points[i]));
+
+  // a quarter of the values: no compaction yet
+  for (size_t i = 0; i < points.size(); i += 4)
+    {
+      tree.erase(iterators[i]);
+      erased[i] = true;
+    }
+  check(tree, points, erased);
+
+  // more than 30% dead compacts the tree, the other iterators stay valid
+  for (size_t i = 1; i < points.size(); i += 4)
+    {
+      tree.erase(iterators[i]);
+      erased[i] = true;
+    }
+  check(tree, points, erased);
+  for (size_t i = 0; i != points.size(); ++i)
+    if (!erased[i])
+      assert(tree.find_exact(points[i]) == iterators[i]);
+
+  // inserting among dead nodes, and turning the lazy erase off
+  for (size_t i = 2; i < points.size(); i += 8)
+    {
+      tree.erase(iterators[i]);
+      erased[i] = true;
+    }
+  for (size_t i = 0; i < points.size(); i += 8)
+    {
+      tree.insert(points[i]);
+      erased[i] = false;
+    }
+  check(tree, points, erased);
+  tree.set_lazy_erase(0);
+  check(tree, points, erased);
+  tree.erase_exact(points[3]);
+  erased[3] = true;
+  check(tree, points, erased);
+
+  // erasing almost everything, which most likely kills the root, then
+  // everything
+  tree.set_lazy_erase(0.95);
+  for (size_t i = 0; i != points.size(); ++i)
+    if (!erased[i] && i % 20)
+      {
+        tree.erase_exact(points[i]);
+        erased[i] = true;
+      }
+  check(tree, points, erased);
+  for (size_t i = 0; i != points.size(); ++i)
+    if (!erased[i])
+      {
+        tree.erase_exact(points[i]);
+        erased[i] = true;
+      }
+  check(tree, points, erased);
+  assert(tree.empty() && tree.begin() == tree.end());
+  assert(tree.find_nearest(points[0]).first == tree.end());
+  tree.compact();
+  assert(tree.begin() == tree.end());
+  tree.insert(points[0]);
+  erased[0] = false;
+  check(tree, points, erased);
+
+  std::printf("lazy erase test passed\n");
+  return 0;
+}
+
+/* COPYRIGHT --
+ *
+ * This file is part of libkdtree++, a C++ template KD-Tree sorting container.
+ * libkdtree++ is (c) 2004-2007 Martin F. Krafft <libkdtree@pobox.madduck.net>
+ * and Sylvain Bougerel <sylvain.bougerel.devel@gmail.com> distributed under the
+ * terms of the Artistic License 2.0. See the ./COPYING file in the source tree
+ * root for more information.
+ *
+ * THIS PACKAGE IS PROVIDED "AS IS" AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES
+ * OF MERCHANTIBILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
@@ -0,0 +1,141 @@
+// Checks the C++11 move support of KDTree: moving trees, and moving or
+// constructing values into them.
+
+// Make SURE all our asserts() are checked
+#undef NDEBUG
+
+#include <kdtree++/kdtree.hpp>
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#if __cplusplus >= 201103L
+
+#include <utility>
+
+// a heavy record, counting its copies
+struct record
+{
+  typedef int value_type;
+
+  record(int x, int y, int z)
+    : payload(100, x)
+  { d[0] = x; d[1] = y; d[2] = z; }
+
+  record(record const& r)
+    : payload(r.payload)
+  { d[0] = r.d[0]; d[1] = r.d[1]; d[2] = r.d[2]; ++copies; }
+
+  record(record&& r)
+    : payload(std::move(r.payload))
+  { d[0] = r.d[0]; d[1] = r.d[1]; d[2] = r.d[2]; }
+
+  record& operator=(record const&) = default;
+  record& operator=(record&&) = default;
+
+  value_type operator[](size_t n) const { return d[n]; }
+
+  int d[3];
+  std::vector<int> payload;
+  static long copies;
+};
+
+long record::copies = 0;
+
+inline bool operator==(record const& a, record const& b)
+{
+  return a.d[0] == b.d[0] && a.d[1] == b.d[1] && a.d[2] == b.d[2];
+}
+
+typedef KDTree::KDTree<3, record> tree_type;
+
+tree_type make_tree(std::vector<record> const& records)
+{
+  tree_type tree(records.begin(), records.end());
+  return tree;
+}
+
+int main()
+{
+  std::vector<record> records;
+  for (int i = 0; i != 1000; ++i)
+    records.push_back(record(rand() % 100, rand() % 100, rand() % 100));
+
+  record::copies = 0;
+  tree_type tree(make_tree(records));
+  // the range constructor copies each value once into its temporary
+  // vector, and then moves it into its node
+  assert(record::copies == long(records.size()));
+  assert(tree.size() == records.size());
+
+  record::copies = 0;
+  tree_type moved(std::move(tree));
+  assert(record::copies == 0);
+  assert(tree.empty() && tree.begin() == tree.end());
+  assert(moved.size() == records.size());
+  moved.check_tree();
+  for (size_t i = 0; i != records.size(); ++i)
+    assert(moved.find_exact(records[i]) != moved.end());
+  // the moved-from tree can be used again
+  tree.insert(records[0]);
+  assert(tree.size() == 1);
+
+  tree_type assigned;
+  assigned.insert(records[1]);
+  record::copies = 0;
+  assigned = std::move(moved);
+  assert(record::copies == 0);
+  assert(moved.empty());
+  assert(assigned.size() == records.size());
+  assert(size_t(std::distance(assigned.begin(), assigned.end()))
+         == records.size());
+  assert(assigned.find_nearest(records[2]).first != assigned.end());
+
+  record::copies = 0;
+  tree_type inserted;
+  inserted.insert(record(1, 2, 3));
+  inserted.emplace(4, 5, 6);
+  record r(7, 8, 9);
+  inserted.insert(std::move(r));
+  assert(record::copies == 0);
+  assert(inserted.size() == 3);
+  assert(inserted.find_exact(record(4, 5, 6)) != inserted.end());
+  assert(inserted.find_exact(record(4, 5, 6))->payload.size() == 100);
+
+  std::vector<record> consumed(records);
+  record::copies = 0;
+  inserted.efficient_replace_and_optimise(std::move(consumed));
+  assert(record::copies == 0);
+  assert(consumed.empty());
+  assert(inserted.size() == records.size());
+  for (size_t i = 0; i != records.size(); ++i)
+    assert(inserted.find_exact(records[i]) != inserted.end());
+
+  std::printf("move test passed\n");
+  return 0;
+}
+
+#else
+
+int main()
+{
+  std::printf("move test skipped, it needs C++11\n");
+  return 0;
+}
+
+#endif
+
+/* COPYRIGHT --
+ *
+ * This file is part of libkdtree++, a C++ template KD-Tree sorting container.
+ * libkdtree++ is (c) 2004-2007 Martin F. Krafft <libkdtree@pobox.madduck.net>
+ * and Sylvain Bougerel <sylvain.bougerel.devel@gmail.com> distributed under the
+ * terms of the Artistic License 2.0. See the ./COPYING file in the source tree
+ * root for more information.
+ *
+ * THIS PACKAGE IS PROVIDED "AS IS" AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES
+ * OF MERCHANTIBILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
@@ -0,0 +1,133 @@
+// Checks that the batch nearest neighbour searches of StaticKDTree give the
+// same answers as the queries made one at a time.
+
+// Make SURE all our asserts() are checked
+#undef NDEBUG
+
+#include <kdtree++/static_kdtree.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iterator>
+#include <vector>
+
+struct point
+{
+  typedef double value_type;
+
+  value_type operator[](size_t n) const { return xyz[n]; }
+
+  double xyz[3];
+  size_t index;
+};
+
+inline bool operator==(point const& A, point const& B)
+{
+  return A.index == B.index;
+}
+
+typedef KDTree::StaticKDTree<3, point> tree_type;
+typedef KDTree::StaticKDTree<3, point, KDTree::_Bracket_accessor<point>,
+                             KDTree::squared_difference<double, double>,
+                             std::less<double>, std::allocator<point>,
+                             KDTree::packed_coordinates, 16> packed_tree_type;
+
+point random_point(size_t index)
+{
+  point p;
+  // coarse grid, so that we also get points sharing coordinates
+  for (size_t k = 0; k != 3; ++k)
+    p.xyz[k] = double(rand() % 100) / 10;
+  p.index = index;
+  return p;
+}
+
+double distance(point const& a, point const& b)
+{
+  double d = 0;
+  for (size_t k = 0; k != 3; ++k)
+    d += (a[k] - b[k]) * (a[k] - b[k]);
+  return std::sqrt(d);
+}
+
+template <typename Tree>
+void check(Tree const& tree, std::vector<point> const& points,
+           std::vector<point> const& queries, size_t k)
+{
+  typedef std::pair<typename Tree::const_iterator, double> result;
+
+  std::vector<result> nearest(queries.size());
+  assert(tree.find_nearest_batch(queries.begin(), queries.end(),
+                                 nearest.begin()) == nearest.end());
+  for (size_t i = 0; i != queries.size(); ++i)
+    {
+      result const single = tree.find_nearest(queries[i]);
+      assert(nearest[i].second == single.second);
+      if (tree.empty())
+        assert(nearest[i].first == tree.end());
+      else
+        assert(distance(*nearest[i].first, queries[i]) == single.second);
+    }
+
+  size_t const n = std::min(k, points.size());
+  std::vector<result> k_nearest(queries.size() * n);
+  assert(tree.find_k_nearest_batch(queries.begin(), queries.end(), k,
+                                   k_nearest.begin()) == k_nearest.end());
+  for (size_t i = 0; i != queries.size(); ++i)
+    {
+      std::vector<double> expected;
+      for (size_t j = 0; j != points.size(); ++j)
+        expected.push_back(distance(points[j], queries[i]));
+      std::sort(expected.begin(), expected.end());
+      std::vector<result> single;
+      tree.find_k_nearest(queries[i], k, std::back_inserter(single));
+      assert(single.size() == n);
+      for (size_t j = 0; j != n; ++j)
+        {
+          result const& r = k_nearest[i * n + j];
+          assert(r.second == expected[j] && single[j].second == expected[j]);
+          assert(distance(*r.first, queries[i]) == r.second);
+        }
+    }
+}
+
+int main()
+{
+  std::vector<point> queries;
+  for (size_t i = 0; i != 500; ++i)
+    queries.push_back(random_point(i));
+
+  size_t const sizes[] = { 0, 1, 5, 100, 3000 };
+  for (size_t s = 0; s != sizeof(sizes) / sizeof(sizes[0]); ++s)
+    {
+      std::vector<point> points;
+      for (size_t i = 0; i != sizes[s]; ++i)
+        points.push_back(random_point(i));
+      tree_type tree(points.begin(), points.end());
+      packed_tree_type packed_tree(points.begin(), points.end());
+      check(tree, points, queries, 1);
+      check(tree, points, queries, 10);
+      check(packed_tree, points, queries, 7);
+      check(packed_tree, points, std::vector<point>(), 7);
+    }
+
+  std::printf("nearest batch test passed\n");
+  return 0;
+}
+
+/* COPYRIGHT --
+ *
+ * This file is part of libkdtree++, a C++ template KD-Tree sorting container.
+ * libkdtree++ is (c) 2004-2007 Martin F. Krafft <libkdtree@pobox.madduck.net>
+ * and Sylvain Bougerel <sylvain.bougerel.devel@gmail.com> distributed under the
+ * terms of the Artistic License 2.0. See the ./COPYING file in the source tree
+ * root for more information.
+ *
+ * THIS PACKAGE IS PROVIDED "AS IS" AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES
+ * OF MERCHANTIBILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
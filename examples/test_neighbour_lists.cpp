@@ -0,0 +1,115 @@
+// Checks that build_neighbour_lists() lists exactly the pairs of values
+// within the given distance of each other.
+
+// Make SURE all our asserts() are checked
+#undef NDEBUG
+
+#include <kdtree++/kdtree.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+struct point
+{
+  typedef int value_type;
+
+  value_type operator[](size_t n) const { return xyz[n]; }
+
+  int xyz[3];
+  size_t index;
+};
+
+inline bool operator==(point const& A, point const& B)
+{
+  return A.index == B.index;
+}
+
+typedef KDTree::KDTree<3, point, KDTree::_Bracket_accessor<point>,
+                       KDTree::squared_difference<int, double> > tree_type;
+
+double squared_distance(point const& a, point const& b)
+{
+  double d = 0;
+  for (size_t k = 0; k != 3; ++k)
+    d += double(a[k] - b[k]) * (a[k] - b[k]);
+  return d;
+}
+
+void check(tree_type const& tree, double r)
+{
+  std::vector<point> values(tree.begin(), tree.end());
+  std::vector<size_t> offsets, neighbours, once_offsets, once_neighbours;
+  tree.build_neighbour_lists(r, offsets, neighbours);
+  tree.build_neighbour_lists(r, once_offsets, once_neighbours, false);
+  assert(offsets.size() == values.size() + 1);
+  assert(once_offsets.size() == values.size() + 1);
+  assert(offsets[0] == 0 && offsets.back() == neighbours.size());
+  assert(once_offsets[0] == 0 && once_offsets.back() == once_neighbours.size());
+  assert(neighbours.size() == 2 * once_neighbours.size());
+
+  for (size_t i = 0; i != values.size(); ++i)
+    {
+      // the distances are integers under the square root, so a radius
+      // equal to one of them is compared exactly
+      std::vector<size_t> expected;
+      for (size_t j = 0; j != values.size(); ++j)
+        if (j != i && squared_distance(values[i], values[j]) <= r * r)
+          expected.push_back(j);
+      std::vector<size_t> found(neighbours.begin() + offsets[i],
+                                neighbours.begin() + offsets[i + 1]);
+      std::sort(found.begin(), found.end());
+      assert(found == expected);
+
+      expected.erase(expected.begin(),
+                     std::upper_bound(expected.begin(), expected.end(), i));
+      found.assign(once_neighbours.begin() + once_offsets[i],
+                   once_neighbours.begin() + once_offsets[i + 1]);
+      std::sort(found.begin(), found.end());
+      assert(found == expected);
+    }
+}
+
+int main()
+{
+  tree_type tree;
+  check(tree, 10);
+
+  // many values, so that the join is split into tasks
+  for (size_t i = 0; i != 5000; ++i)
+    {
+      point p;
+      for (size_t k = 0; k != 3; ++k)
+        p.xyz[k] = rand() % 150;
+      p.index = i;
+      tree.insert(p);
+    }
+  tree.optimise();
+  check(tree, 5);
+  check(tree, 12);
+
+  // erased values are neither listed nor numbered
+  tree.set_lazy_erase(0.9);
+  std::vector<point> values(tree.begin(), tree.end());
+  for (size_t i = 0; i < values.size(); i += 3)
+    tree.erase_exact(values[i]);
+  check(tree, 8);
+
+  std::printf("neighbour lists test passed\n");
+  return 0;
+}
+
+/* COPYRIGHT --
+ *
+ * This file is part of libkdtree++, a C++ template KD-Tree sorting container.
+ * libkdtree++ is (c) 2004-2007 Martin F. Krafft <libkdtree@pobox.madduck.net>
+ * and Sylvain Bougerel <sylvain.bougerel.devel@gmail.com> distributed under the
+ * terms of the Artistic License 2.0. See the ./COPYING file in the source tree
+ * root for more information.
+ *
+ * THIS PACKAGE IS PROVIDED "AS IS" AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES
+ * OF MERCHANTIBILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
@@ -0,0 +1,130 @@
+// Checks that building a KDTree on several threads gives the same tree as
+// building it on one.  Without OpenMP, both builds run on one thread.
+
+// Make SURE all our asserts() are checked
+#undef NDEBUG
+
+#include <kdtree++/kdtree.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <limits>
+#include <vector>
+
+#ifdef _OPENMP
+#  include <omp.h>
+#endif
+
+struct point
+{
+  typedef double value_type;
+
+  value_type operator[](size_t n) const { return xyz[n]; }
+
+  double xyz[3];
+  size_t index;
+};
+
+inline bool operator==(point const& A, point const& B)
+{
+  return A.index == B.index;
+}
+
+typedef KDTree::KDTree<3, point> tree_type;
+typedef KDTree::KDTree<3, point, KDTree::_Bracket_accessor<point>,
+                       KDTree::squared_difference<double, double>,
+                       std::less<double>, std::allocator<KDTree::_Node<point> >,
+                       KDTree::sliding_midpoint_split> midpoint_tree_type;
+
+void set_threads(int threads)
+{
+#ifdef _OPENMP
+  omp_set_num_threads(threads);
+#else
+  (void)threads;
+#endif
+}
+
+double brute_force_nearest(std::vector<point> const& points,
+                           point const& target)
+{
+  double best = std::numeric_limits<double>::max();
+  for (size_t i = 0; i != points.size(); ++i)
+    {
+      double d = 0;
+      for (size_t k = 0; k != 3; ++k)
+        d += (points[i][k] - target[k]) * (points[i][k] - target[k]);
+      best = std::min(best, std::sqrt(d));
+    }
+  return best;
+}
+
+template <typename Tree>
+void test_parallel_build(std::vector<point> const& points)
+{
+  set_threads(1);
+  Tree serial(points.begin(), points.end());
+  set_threads(4);
+  Tree parallel(points.begin(), points.end());
+  Tree optimised;
+  optimised.insert(points.begin(), points.end());
+  optimised.optimise();
+  std::vector<point> copy(points);
+  Tree replaced;
+  replaced.efficient_replace_and_optimise(copy);
+
+  parallel.check_tree();
+  optimised.check_tree();
+  assert(parallel.size() == points.size());
+  assert(optimised.size() == points.size());
+  // the partitions do not depend on the number of threads
+  typename Tree::const_iterator s = serial.begin(), p = parallel.begin(),
+    r = replaced.begin();
+  for (; s != serial.end(); ++s, ++p, ++r)
+    assert(*s == *p && *s == *r);
+  assert(p == parallel.end());
+
+  for (size_t q = 0; q != 100; ++q)
+    {
+      point target = points[rand() % points.size()];
+      target.xyz[0] += 0.5;
+      assert(parallel.find_nearest(target).second
+             == brute_force_nearest(points, target));
+    }
+}
+
+int main()
+{
+  std::vector<point> points;
+  for (size_t i = 0; i != 100000; ++i)
+    {
+      point p;
+      for (size_t k = 0; k != 3; ++k)
+        p.xyz[k] = double(rand() % 100000) / 100;
+      p.index = i;
+      points.push_back(p);
+    }
+
+  test_parallel_build<tree_type>(points);
+  test_parallel_build<midpoint_tree_type>(points);
+
+  std::printf("parallel build test passed\n");
+  return 0;
+}
+
+/* COPYRIGHT --
+ *
+ * This file is part of libkdtree++, a C++ template KD-Tree sorting container.
+ * libkdtree++ is (c) 2004-2007 Martin F. Krafft <libkdtree@pobox.madduck.net>
+ * and Sylvain Bougerel <sylvain.bougerel.devel@gmail.com> distributed under the
+ * terms of the Artistic License 2.0. See the ./COPYING file in the source tree
+ * root for more information.
+ *
+ * THIS PACKAGE IS PROVIDED "AS IS" AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES
+ * OF MERCHANTIBILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
@@ -0,0 +1,150 @@
+// Checks that an exception thrown by the comparator or the distance while a
+// large tree is built, or joined with itself, on several threads reaches the
+// caller instead of terminating the program.  Without OpenMP, or before
+// C++11, the same work runs on one thread.
+
+// Make SURE all our asserts() are checked
+#undef NDEBUG
+
+#include <kdtree++/kdtree.hpp>
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <stdexcept>
+#include <vector>
+
+#ifdef _OPENMP
+#  include <omp.h>
+#endif
+
+struct point
+{
+  typedef double value_type;
+
+  value_type operator[](size_t n) const { return xyz[n]; }
+
+  double xyz[3];
+  size_t index;
+};
+
+inline bool operator==(point const& A, point const& B)
+{
+  return A.index == B.index;
+}
+
+// Only the few points with negative coordinates are poisoned: comparing, or
+// measuring, two of them throws.  They lie close together, so that it
+// happens deep in the tree, on whichever thread builds that part.
+struct poisoned_less
+{
+  bool operator()(double a, double b) const
+  {
+    if (a < 0 && b < 0)
+      throw std::runtime_error("poisoned values");
+    return a < b;
+  }
+};
+
+struct poisoned_distance
+{
+  typedef double distance_type;
+
+  double operator()(double a, double b) const
+  {
+    if (a < 0 && b < 0)
+      throw std::runtime_error("poisoned values");
+    return (a - b) * (a - b);
+  }
+};
+
+typedef KDTree::KDTree<3, point, KDTree::_Bracket_accessor<point>,
+                       KDTree::squared_difference<double, double>,
+                       poisoned_less> compare_tree_type;
+typedef KDTree::KDTree<3, point, KDTree::_Bracket_accessor<point>,
+                       poisoned_distance> distance_tree_type;
+
+int main()
+{
+#ifdef _OPENMP
+  omp_set_num_threads(4);
+#endif
+  // well above the size at which the builds go parallel
+  std::vector<point> points;
+  for (size_t i = 0; i != 100000; ++i)
+    {
+      point p;
+      for (size_t k = 0; k != 3; ++k)
+        p.xyz[k] = double(rand() % 100000) / 100;
+      p.index = points.size();
+      points.push_back(p);
+    }
+  for (size_t i = 0; i != 200; ++i)
+    {
+      point p;
+      for (size_t k = 0; k != 3; ++k)
+        p.xyz[k] = -1 - double(rand() % 100) / 100;
+      p.index = points.size();
+      points.push_back(p);
+    }
+
+  bool thrown = false;
+  try
+    {
+      compare_tree_type tree(points.begin(), points.end());
+    }
+  catch (std::runtime_error const&)
+    {
+      thrown = true;
+    }
+  assert(thrown);
+
+  // a failed rebuild leaves the tree empty, but usable
+  compare_tree_type tree;
+  std::vector<point> copy(points);
+  thrown = false;
+  try
+    {
+      tree.efficient_replace_and_optimise(copy);
+    }
+  catch (std::runtime_error const&)
+    {
+      thrown = true;
+    }
+  assert(thrown);
+  assert(tree.size() == 0 && tree.begin() == tree.end());
+  tree.check_tree();
+  tree.insert(points[0]);
+  assert(tree.size() == 1);
+
+  distance_tree_type distance_tree(points.begin(), points.end());
+  std::vector<size_t> offsets, neighbours;
+  thrown = false;
+  try
+    {
+      distance_tree.build_neighbour_lists(1, offsets, neighbours);
+    }
+  catch (std::runtime_error const&)
+    {
+      thrown = true;
+    }
+  assert(thrown);
+  assert(distance_tree.size() == points.size());
+
+  std::printf("parallel exceptions test passed\n");
+  return 0;
+}
+
+/* COPYRIGHT --
+ *
+ * This file is part of libkdtree++, a C++ template KD-Tree sorting container.
+ * libkdtree++ is (c) 2004-2007 Martin F. Krafft <libkdtree@pobox.madduck.net>
+ * and Sylvain Bougerel <sylvain.bougerel.devel@gmail.com> distributed under the
+ * terms of the Artistic License 2.0. See the ./COPYING file in the source tree
+ * root for more information.
+ *
+ * THIS PACKAGE IS PROVIDED "AS IS" AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES
+ * OF MERCHANTIBILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
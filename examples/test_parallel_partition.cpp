@@ -0,0 +1,192 @@
+// Checks the partitions that the split policies run on several threads at
+// the top levels of a build.  The threshold is lowered so that small
+// ranges, deep in the trees, take that path too.  The trees built on one
+// thread and on several must be the same, node for node.  Without OpenMP,
+// everything runs on one thread.
+
+// Make SURE all our asserts() are checked
+#undef NDEBUG
+
+#define KDTREE_PARALLEL_THRESHOLD 64
+#include <kdtree++/kdtree.hpp>
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <map>
+#include <vector>
+
+#ifdef _OPENMP
+#  include <omp.h>
+#endif
+
+struct point
+{
+  typedef double value_type;
+
+  value_type operator[](size_t n) const { return xyz[n]; }
+
+  double xyz[3];
+  size_t index;
+};
+
+inline bool operator==(point const& A, point const& B)
+{
+  return A.index == B.index;
+}
+
+template <typename Split>
+struct split_tree
+{
+  typedef KDTree::KDTree<3, point, KDTree::_Bracket_accessor<point>,
+                         KDTree::squared_difference<double, double>,
+                         std::less<double>,
+                         std::allocator<KDTree::_Node<point> >,
+                         Split> type;
+};
+
+void set_threads(int threads)
+{
+#ifdef _OPENMP
+  omp_set_num_threads(threads);
+#else
+  (void)threads;
+#endif
+}
+
+struct below
+{
+  explicit below(int v) : value(v) {}
+  bool operator()(int x) const { return x < value; }
+  int value;
+};
+
+// The values before the end returned are the ones below, and none is lost.
+void test_partition(std::vector<int> const& values, int value)
+{
+  std::vector<int> one(values), several(values);
+  set_threads(1);
+  std::vector<int>::iterator const one_end
+    = KDTree::_S_parallel_partition(one.begin(), one.end(), below(value));
+  set_threads(4);
+  std::vector<int>::iterator const several_end
+    = KDTree::_S_parallel_partition(several.begin(), several.end(),
+                                    below(value));
+  assert(one == several);
+  assert(one_end - one.begin() == several_end - several.begin());
+  for (std::vector<int>::iterator i = one.begin(); i != one.end(); ++i)
+    assert((*i < value) == (i < one_end));
+  std::vector<int> sorted(values), partitioned(one);
+  std::sort(sorted.begin(), sorted.end());
+  std::sort(partitioned.begin(), partitioned.end());
+  assert(sorted == partitioned);
+}
+
+void test_nth_element(std::vector<int> const& values, size_t nth)
+{
+  std::vector<int> one(values), several(values), sorted(values);
+  std::sort(sorted.begin(), sorted.end());
+  set_threads(1);
+  KDTree::_S_parallel_nth_element(one.begin(), one.begin() + nth, one.end(),
+                                  std::less<int>());
+  set_threads(4);
+  KDTree::_S_parallel_nth_element(several.begin(), several.begin() + nth,
+                                  several.end(), std::less<int>());
+  assert(one == several);
+  assert(one[nth] == sorted[nth]);
+  for (size_t i = 0; i != one.size(); ++i)
+    assert(i < nth ? one[i] <= one[nth] : one[i] >= one[nth]);
+}
+
+// Each node, in the order of iteration, with its dimension and its parent.
+template <typename Tree>
+std::vector<size_t> shape(Tree const& tree)
+{
+  std::map<void const*, size_t> number;
+  for (typename Tree::const_iterator i = tree.begin(); i != tree.end(); ++i)
+    number[i.get_raw_node()] = i->index;
+  std::vector<size_t> nodes;
+  for (typename Tree::const_iterator i = tree.begin(); i != tree.end(); ++i)
+    {
+      KDTree::_Node_base const* const node = i.get_raw_node();
+      std::map<void const*, size_t>::const_iterator const parent
+        = number.find(node->_M_parent);
+      nodes.push_back(i->index);
+      nodes.push_back(node->_M_dim);
+      nodes.push_back(parent == number.end() ? size_t(-1) : parent->second);
+    }
+  return nodes;
+}
+
+template <typename Tree>
+void test_build(std::vector<point> const& points)
+{
+  set_threads(1);
+  Tree one(points.begin(), points.end());
+  set_threads(4);
+  Tree several(points.begin(), points.end());
+  std::vector<point> copy(points);
+  Tree replaced;
+  replaced.efficient_replace_and_optimise(copy);
+
+  one.check_tree();
+  several.check_tree();
+  replaced.check_tree();
+  assert(several.size() == points.size());
+  assert(shape(one) == shape(several));
+  assert(shape(one) == shape(replaced));
+}
+
+int main()
+{
+  // few distinct values, so that many compare equal to the pivots
+  std::vector<int> values;
+  for (size_t i = 0; i != 5000; ++i)
+    values.push_back(rand() % 50);
+  for (size_t n = 0; n <= values.size(); n += n < 300 ? 1 : 997)
+    {
+      std::vector<int> part(values.begin(), values.begin() + n);
+      test_partition(part, 25);
+      test_partition(part, 0);
+      test_partition(part, 50);
+      if (n)
+        {
+          test_nth_element(part, n / 2);
+          test_nth_element(part, 0);
+          test_nth_element(part, n - 1);
+        }
+    }
+  std::vector<int> same(1000, 7);
+  test_nth_element(same, 500);
+
+  std::vector<point> points;
+  for (size_t i = 0; i != 20000; ++i)
+    {
+      point p;
+      for (size_t k = 0; k != 3; ++k)
+        p.xyz[k] = double(rand() % 200) / 10;
+      p.index = i;
+      points.push_back(p);
+    }
+  test_build<split_tree<KDTree::cyclic_split>::type>(points);
+  test_build<split_tree<KDTree::max_spread_split>::type>(points);
+  test_build<split_tree<KDTree::sliding_midpoint_split>::type>(points);
+  test_build<split_tree<KDTree::cost_model_split<> >::type>(points);
+
+  std::printf("parallel partition test passed\n");
+  return 0;
+}
+
+/* COPYRIGHT --
+ *
+ * This file is part of libkdtree++, a C++ template KD-Tree sorting container.
+ * libkdtree++ is (c) 2004-2007 Martin F. Krafft <libkdtree@pobox.madduck.net>
+ * and Sylvain Bougerel <sylvain.bougerel.devel@gmail.com> distributed under the
+ * terms of the Artistic License 2.0. See the ./COPYING file in the source tree
+ * root for more information.
+ *
+ * THIS PACKAGE IS PROVIDED "AS IS" AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES
+ * OF MERCHANTIBILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
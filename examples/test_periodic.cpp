@@ -0,0 +1,202 @@
+// Checks the nearest neighbour and range searches of KDTree in a box whose
+// dimensions wrap around, against the minimum image distances.
+
+// Make SURE all our asserts() are checked
+#undef NDEBUG
+
+#include <kdtree++/kdtree.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+#include <limits>
+#include <vector>
+
+struct point
+{
+  typedef double value_type;
+
+  value_type operator[](size_t n) const { return xyz[n]; }
+
+  double xyz[3];
+  size_t index;
+};
+
+inline bool operator==(point const& A, point const& B)
+{
+  return A.index == B.index;
+}
+
+typedef KDTree::KDTree<3, point> tree_type;
+typedef tree_type::periodic_box_type box_type;
+
+// x and y wrap around in [0, 10), z is open; the coordinates are multiples
+// of 1/4, so that all the differences are exact
+box_type make_box()
+{
+  box_type box;
+  box.set_periodic(0, 0, 10).set_periodic(1, 0, 10);
+  return box;
+}
+
+double random_coordinate(double low, double high)
+{
+  int const steps = int((high - low) * 4);
+  return low + double(rand() % steps) / 4;
+}
+
+point random_point(size_t index)
+{
+  point p;
+  p.xyz[0] = random_coordinate(0, 10);
+  p.xyz[1] = random_coordinate(0, 10);
+  p.xyz[2] = random_coordinate(-5, 5);
+  p.index = index;
+  return p;
+}
+
+// the queries may lie outside the box
+point random_query()
+{
+  point p;
+  for (size_t k = 0; k != 3; ++k)
+    p.xyz[k] = random_coordinate(-15, 25);
+  p.index = std::numeric_limits<size_t>::max();
+  return p;
+}
+
+double image_difference(double a, double b, double period)
+{
+  double d = std::fmod(a - b, period);
+  if (d < 0) d += period;
+  return std::min(d, period - d);
+}
+
+double distance(point const& a, point const& b)
+{
+  double const dx = image_difference(a[0], b[0], 10);
+  double const dy = image_difference(a[1], b[1], 10);
+  double const dz = a[2] - b[2];
+  return std::sqrt(dx * dx + dy * dy + dz * dz);
+}
+
+bool within(point const& a, point const& b, double r)
+{
+  return image_difference(a[0], b[0], 10) <= r
+    && image_difference(a[1], b[1], 10) <= r
+    && std::abs(a[2] - b[2]) <= r;
+}
+
+struct counter
+{
+  counter() : count(0) { }
+  void operator()(point const&) { ++count; }
+  size_t count;
+};
+
+void check(tree_type const& tree, point const& q, double r)
+{
+  box_type const box = make_box();
+
+  double best = std::numeric_limits<double>::max();
+  for (tree_type::const_iterator i = tree.begin(); i != tree.end(); ++i)
+    {
+      best = std::min(best, distance(*i, q));
+      assert(tree.periodic_distance(q, *i, box) == distance(*i, q));
+    }
+  std::pair<tree_type::const_iterator, double> nearest
+    = tree.find_nearest_periodic(q, box);
+  if (tree.empty())
+    assert(nearest.first == tree.end());
+  else
+    {
+      assert(nearest.first != tree.end() && nearest.second == best);
+      assert(distance(*nearest.first, q) == best);
+      nearest = tree.find_nearest_periodic(q, box, best);
+      assert(nearest.first != tree.end() && nearest.second == best);
+      if (best > 0.1)
+        {
+          nearest = tree.find_nearest_periodic(q, box, best - 0.1);
+          assert(nearest.first == tree.end() && nearest.second == best - 0.1);
+        }
+    }
+
+  std::vector<size_t> expected;
+  for (tree_type::const_iterator i = tree.begin(); i != tree.end(); ++i)
+    if (within(*i, q, r))
+      expected.push_back(i->index);
+  std::vector<point> found;
+  tree.find_within_range_periodic(q, r, box, std::back_inserter(found));
+  std::vector<size_t> found_indices;
+  for (size_t i = 0; i != found.size(); ++i)
+    found_indices.push_back(found[i].index);
+  std::sort(expected.begin(), expected.end());
+  std::sort(found_indices.begin(), found_indices.end());
+  assert(found_indices == expected);
+  assert(tree.count_within_range_periodic(q, r, box) == expected.size());
+  assert(tree.visit_within_range_periodic(q, r, box, counter()).count
+         == expected.size());
+}
+
+int main()
+{
+  // the wrapping of the coordinates, on floating point and integer values
+  box_type const box = make_box();
+  assert(box.wrap(0, -0.25) == 9.75 && box.wrap(0, 10) == 0);
+  assert(box.wrap(1, 23.5) == 3.5 && box.wrap(2, 23.5) == 23.5);
+  assert(box.difference(0, 9.5, 0.5) == -1 && box.difference(0, 0.5, 9.5) == 1);
+  assert(box.difference(2, 9.5, 0.5) == 9);
+  KDTree::periodic_box<2, int> int_box;
+  int_box.set_periodic(0, -50, 50);
+  assert(int_box.wrap(0, -51) == 49 && int_box.wrap(0, 150) == -50);
+  assert(int_box.difference(0, 45, -45) == -10);
+
+  tree_type tree;
+  check(tree, random_query(), 2);
+
+  for (size_t i = 0; i != 2000; ++i)
+    tree.insert(random_point(i));
+  tree.optimise();
+  for (size_t i = 0; i != 200; ++i)
+    {
+      point const q = random_query();
+      check(tree, q, 0.5);
+      check(tree, q, 2.75);
+      // wider than half a period
+      check(tree, q, 6);
+    }
+
+  // a few values, so that the nearest may lie across a boundary
+  tree_type sparse;
+  for (size_t i = 0; i != 5; ++i)
+    sparse.insert(random_point(i));
+  for (size_t i = 0; i != 200; ++i)
+    check(sparse, random_query(), 3);
+
+  // with dead nodes
+  tree.set_lazy_erase(0.9);
+  std::vector<point> values(tree.begin(), tree.end());
+  for (size_t i = 0; i < values.size(); i += 2)
+    tree.erase_exact(values[i]);
+  for (size_t i = 0; i != 100; ++i)
+    check(tree, random_query(), 1.5);
+
+  std::printf("periodic test passed\n");
+  return 0;
+}
+
+/* COPYRIGHT --
+ *
+ * This file is part of libkdtree++, a C++ template KD-Tree sorting container.
+ * libkdtree++ is (c) 2004-2007 Martin F. Krafft <libkdtree@pobox.madduck.net>
+ * and Sylvain Bougerel <sylvain.bougerel.devel@gmail.com> distributed under the
+ * terms of the Artistic License 2.0. See the ./COPYING file in the source tree
+ * root for more information.
+ *
+ * THIS PACKAGE IS PROVIDED "AS IS" AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES
+ * OF MERCHANTIBILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
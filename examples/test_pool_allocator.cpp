@@ -0,0 +1,146 @@
+// Checks that a KDTree can allocate its nodes with KDTree::pool_allocator.
+
+// Make SURE all our asserts() are checked
+#undef NDEBUG
+
+#include <kdtree++/kdtree.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iterator>
+#include <vector>
+
+// counts the live instances, to check that clear() destroys every node
+struct tracked_point
+{
+  typedef int value_type;
+
+  tracked_point(int x, int y) { d[0] = x; d[1] = y; ++live; }
+  tracked_point(tracked_point const& p) { d[0] = p.d[0]; d[1] = p.d[1]; ++live; }
+  ~tracked_point() { --live; }
+
+  value_type operator[](size_t n) const { return d[n]; }
+
+  int d[2];
+  static long live;
+};
+
+long tracked_point::live = 0;
+
+inline bool operator==(tracked_point const& a, tracked_point const& b)
+{
+  return a.d[0] == b.d[0] && a.d[1] == b.d[1];
+}
+
+typedef KDTree::_Bracket_accessor<tracked_point> accessor_type;
+typedef KDTree::squared_difference<int, int> distance_type;
+typedef KDTree::KDTree<2, tracked_point, accessor_type, distance_type,
+                       std::less<int>,
+                       KDTree::pool_allocator<KDTree::_Node<tracked_point> > >
+  pool_tree_type;
+typedef KDTree::KDTree<2, tracked_point> tree_type;
+
+int main()
+{
+  {
+    KDTree::pool_allocator<int> pool(4);
+    KDTree::pool_allocator<int> copy(pool);
+    assert(pool == copy && !pool.unique());
+
+    std::vector<int*> ints;
+    for (int i = 0; i != 10; ++i)
+      ints.push_back(pool.allocate(1));
+    // objects come one after the other from a chunk
+    assert(ints[1] == ints[0] + 2 || ints[1] == ints[0] + 1);
+    // ... and the latest freed object is recycled first
+    copy.deallocate(ints[3], 1);
+    assert(pool.allocate(1) == ints[3]);
+    pool.reserve(100);
+    int* first = pool.allocate(1);
+    int* second = pool.allocate(1);
+    assert(second > first && second - first <= 2);
+  }
+
+  std::vector<tracked_point> points;
+  for (int i = 0; i != 1000; ++i)
+    points.push_back(tracked_point(rand() % 50, rand() % 50));
+  long const live = tracked_point::live;
+
+  {
+    pool_tree_type pool_tree(points.begin(), points.end());
+    tree_type tree(points.begin(), points.end());
+    assert(tracked_point::live == live + 2000);
+
+    // erase half of them, and insert them again
+    for (size_t i = 0; i < points.size(); i += 2)
+      {
+        pool_tree.erase_exact(points[i]);
+        tree.erase_exact(points[i]);
+      }
+    assert(pool_tree.size() == points.size() / 2);
+    for (size_t i = 0; i < points.size(); i += 2)
+      {
+        pool_tree.insert(points[i]);
+        tree.insert(points[i]);
+      }
+    pool_tree.optimise();
+    tree.optimise();
+    assert(pool_tree.size() == points.size());
+
+    for (size_t i = 0; i != points.size(); ++i)
+      {
+        assert(pool_tree.find_exact(points[i]) != pool_tree.end());
+        std::vector<tracked_point> a, b;
+        pool_tree.find_within_range(points[i], 3, std::back_inserter(a));
+        tree.find_within_range(points[i], 3, std::back_inserter(b));
+        assert(a.size() == b.size());
+        assert(pool_tree.find_nearest(points[i], 0).first != pool_tree.end());
+      }
+
+    // copies share the pool, so clear() must not give it back
+    pool_tree_type copied(pool_tree);
+    pool_tree.clear();
+    assert(pool_tree.empty() && pool_tree.begin() == pool_tree.end());
+    assert(copied.size() == points.size());
+    for (size_t i = 0; i != points.size(); ++i)
+      assert(copied.find_exact(points[i]) != copied.end());
+
+    copied.clear();
+    pool_tree.insert(points[0]);
+    assert(pool_tree.size() == 1);
+
+    // a bulk build takes all its nodes from one block
+    pool_tree_type bulk(points.begin(), points.end(), accessor_type(),
+                        distance_type(), std::less<int>(),
+                        KDTree::pool_allocator<KDTree::_Node<tracked_point> >(4));
+    tracked_point const* low = &*bulk.begin();
+    tracked_point const* high = low;
+    for (pool_tree_type::const_iterator i = bulk.begin(); i != bulk.end(); ++i)
+      {
+        low = std::min(low, &*i);
+        high = std::max(high, &*i);
+      }
+    assert(size_t((char const*)high - (char const*)low)
+           < points.size() * sizeof(KDTree::_Node<tracked_point>));
+  }
+  assert(tracked_point::live == live);
+
+  std::printf("pool_allocator test passed\n");
+  return 0;
+}
+
+/* COPYRIGHT --
+ *
+ * This file is part of libkdtree++, a C++ template KD-Tree sorting container.
+ * libkdtree++ is (c) 2004-2007 Martin F. Krafft <libkdtree@pobox.madduck.net>
+ * and Sylvain Bougerel <sylvain.bougerel.devel@gmail.com> distributed under the
+ * terms of the Artistic License 2.0. See the ./COPYING file in the source tree
+ * root for more information.
+ *
+ * THIS PACKAGE IS PROVIDED "AS IS" AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES
+ * OF MERCHANTIBILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
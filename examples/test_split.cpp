@@ -0,0 +1,162 @@
+// Checks that a KDTree built with another split policy answers the same
+// queries as the default one, on data spread very unevenly.
+
+// Make SURE all our asserts() are checked
+#undef NDEBUG
+
+#include <kdtree++/kdtree.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <vector>
+
+struct point
+{
+  typedef double value_type;
+
+  value_type operator[](size_t n) const { return xyz[n]; }
+
+  double xyz[3];
+  size_t index;
+};
+
+inline bool operator==(point const& A, point const& B)
+{
+  return A.index == B.index;
+}
+
+typedef KDTree::KDTree<3, point> tree_type;
+typedef KDTree::KDTree<3, point, KDTree::_Bracket_accessor<point>,
+                       KDTree::squared_difference<double, double>,
+                       std::less<double>, std::allocator<KDTree::_Node<point> >,
+                       KDTree::max_spread_split> spread_tree_type;
+typedef KDTree::KDTree<3, point, KDTree::_Bracket_accessor<point>,
+                       KDTree::squared_difference<double, double>,
+                       std::less<double>, std::allocator<KDTree::_Node<point> >,
+                       KDTree::sliding_midpoint_split> midpoint_tree_type;
+typedef KDTree::KDTree<3, point, KDTree::_Bracket_accessor<point>,
+                       KDTree::squared_difference<double, double>,
+                       std::less<double>, std::allocator<KDTree::_Node<point> >,
+                       KDTree::cost_model_split<> > cost_tree_type;
+
+// a thin slab: long in x, narrow in y and flat in z
+point slab_point(size_t index)
+{
+  point p;
+  p.xyz[0] = double(rand() % 10000) / 10;
+  p.xyz[1] = double(rand() % 100) / 10;
+  p.xyz[2] = double(rand() % 10) / 10;
+  p.index = index;
+  return p;
+}
+
+// a few tight clusters in a large empty box
+point cluster_point(size_t index)
+{
+  static double const centres[4][3]
+    = { { 10, 10, 10 }, { 900, 50, 500 }, { 500, 900, 20 }, { 910, 60, 505 } };
+  point p;
+  double const* centre = centres[rand() % 4];
+  for (size_t k = 0; k != 3; ++k)
+    p.xyz[k] = centre[k] + double(rand() % 100) / 20;
+  p.index = index;
+  return p;
+}
+
+double brute_force_nearest(std::vector<point> const& points,
+                           point const& target)
+{
+  double best = std::numeric_limits<double>::max();
+  for (size_t i = 0; i != points.size(); ++i)
+    {
+      double d = 0;
+      for (size_t k = 0; k != 3; ++k)
+        d += (points[i][k] - target[k]) * (points[i][k] - target[k]);
+      best = std::min(best, std::sqrt(d));
+    }
+  return best;
+}
+
+template <typename Tree>
+void test_split_tree(std::vector<point> const& points)
+{
+  tree_type tree(points.begin(), points.end());
+
+  Tree split_tree(points.begin(), points.end());
+  split_tree.check_tree();
+  assert(split_tree.size() == points.size());
+
+  for (size_t i = 0; i != points.size(); ++i)
+    assert(split_tree.find_exact(points[i]) != split_tree.end());
+
+  for (size_t q = 0; q != 500; ++q)
+    {
+      point target = (q % 2) ? slab_point(points.size())
+                             : cluster_point(points.size());
+      double const range = double(rand() % 100) / 10;
+
+      std::vector<point> expected, got;
+      tree.find_within_range(target, range, std::back_inserter(expected));
+      split_tree.find_within_range(target, range, std::back_inserter(got));
+      assert(expected.size() == got.size());
+      assert(split_tree.count_within_range(target, range) == got.size());
+
+      std::pair<typename Tree::const_iterator, double> nearest
+        = split_tree.find_nearest(target);
+      assert(nearest.first != split_tree.end());
+      assert(nearest.second == brute_force_nearest(points, target));
+    }
+
+  // erase and insert keep the dimensions stored in the nodes
+  for (size_t i = 0; i < points.size(); i += 3)
+    split_tree.erase_exact(points[i]);
+  split_tree.check_tree();
+  for (size_t i = 0; i < points.size(); i += 3)
+    {
+      assert(split_tree.find_exact(points[i]) == split_tree.end());
+      split_tree.insert(points[i]);
+    }
+  split_tree.check_tree();
+  for (size_t i = 0; i != points.size(); ++i)
+    assert(split_tree.find_exact(points[i]) != split_tree.end());
+}
+
+int main()
+{
+  std::vector<point> slab, clusters;
+  for (size_t i = 0; i != 3000; ++i)
+    {
+      slab.push_back(slab_point(i));
+      clusters.push_back(cluster_point(i));
+    }
+
+  test_split_tree<tree_type>(slab);
+  test_split_tree<spread_tree_type>(slab);
+  test_split_tree<midpoint_tree_type>(slab);
+  test_split_tree<cost_tree_type>(slab);
+  test_split_tree<spread_tree_type>(clusters);
+  test_split_tree<midpoint_tree_type>(clusters);
+  test_split_tree<cost_tree_type>(clusters);
+
+  std::printf("split policies agree on %u points\n", unsigned(slab.size()));
+  return 0;
+}
+
+/* COPYRIGHT --
+ *
+ * This file is part of libkdtree++, a C++ template KD-Tree sorting container.
+ * libkdtree++ is (c) 2004-2007 Martin F. Krafft <libkdtree@pobox.madduck.net>
+ * and Sylvain Bougerel <sylvain.bougerel.devel@gmail.com> distributed under the
+ * terms of the Artistic License 2.0. See the ./COPYING file in the source tree
+ * root for more information.
+ *
+ * THIS PACKAGE IS PROVIDED "AS IS" AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES
+ * OF MERCHANTIBILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
@@ -0,0 +1,175 @@
+// Checks that StaticKDTree answers the same queries as KDTree.
+
+// Make SURE all our asserts() are checked
+#undef NDEBUG
+
+#include <kdtree++/kdtree.hpp>
+#include <kdtree++/static_kdtree.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+#include <limits>
+#include <vector>
+
+struct point
+{
+  typedef double value_type;
+
+  value_type operator[](size_t n) const { return xyz[n]; }
+
+  double xyz[3];
+  size_t index;
+};
+
+inline bool operator==(point const& A, point const& B)
+{
+  return A.index == B.index;
+}
+
+struct count_visitor
+{
+  count_visitor() : count(0) {}
+  void operator()(point const&) { ++count; }
+  size_t count;
+};
+
+typedef KDTree::KDTree<3, point> tree_type;
+typedef KDTree::StaticKDTree<3, point> static_tree_type;
+typedef KDTree::StaticKDTree<3, point, KDTree::_Bracket_accessor<point>,
+                             KDTree::squared_difference<double, double>,
+                             std::less<double>, std::allocator<point>,
+                             KDTree::packed_coordinates> packed_tree_type;
+// one value per leaf, and large leaf buckets
+typedef KDTree::StaticKDTree<3, point, KDTree::_Bracket_accessor<point>,
+                             KDTree::squared_difference<double, double>,
+                             std::less<double>, std::allocator<point>,
+                             KDTree::inline_coordinates, 1> unbucketed_tree_type;
+typedef KDTree::StaticKDTree<3, point, KDTree::_Bracket_accessor<point>,
+                             KDTree::squared_difference<double, double>,
+                             std::less<double>, std::allocator<point>,
+                             KDTree::packed_coordinates, 64> bucketed_tree_type;
+
+point random_point(size_t index)
+{
+  point p;
+  // coarse grid, so that we also get points sharing coordinates
+  p.xyz[0] = double(rand() % 100) / 10;
+  p.xyz[1] = double(rand() % 100) / 10;
+  p.xyz[2] = double(rand() % 100) / 10;
+  p.index = index;
+  return p;
+}
+
+double brute_force_nearest(std::vector<point> const& points,
+                           point const& target)
+{
+  double best = std::numeric_limits<double>::max();
+  for (size_t i = 0; i != points.size(); ++i)
+    {
+      double d = 0;
+      for (size_t k = 0; k != 3; ++k)
+        d += (points[i][k] - target[k]) * (points[i][k] - target[k]);
+      best = std::min(best, std::sqrt(d));
+    }
+  return best;
+}
+
+template <typename StaticTree>
+void test_static_tree(std::vector<point> const& points, tree_type const& tree)
+{
+  {
+    StaticTree empty;
+    point p = random_point(0);
+    assert(empty.size() == 0);
+    assert(empty.begin() == empty.end());
+    assert(empty.find(p) == empty.end());
+    assert(empty.find_nearest(p).first == empty.end());
+    assert(empty.find_nearest(p, 10).first == empty.end());
+    assert(empty.count_within_range(p, 10) == 0);
+  }
+
+  StaticTree static_tree(points.begin(), points.end());
+  assert(static_tree.size() == points.size());
+
+  // efficient_replace_and_optimise() takes over the vector
+  {
+    std::vector<point> copy(points);
+    StaticTree replaced;
+    replaced.efficient_replace_and_optimise(copy);
+    assert(copy.empty());
+    assert(replaced.size() == points.size());
+  }
+
+  for (size_t i = 0; i != points.size(); ++i)
+    {
+      typename StaticTree::const_iterator found = static_tree.find(points[i]);
+      assert(found != static_tree.end());
+      typename StaticTree::const_iterator exact = static_tree.find_exact(points[i]);
+      assert(exact != static_tree.end() && exact->index == points[i].index);
+    }
+
+  for (size_t q = 0; q != 500; ++q)
+    {
+      point target = random_point(points.size());
+      double const range = double(rand() % 30) / 10;
+
+      std::vector<point> expected, got;
+      tree.find_within_range(target, range, std::back_inserter(expected));
+      static_tree.find_within_range(target, range, std::back_inserter(got));
+      assert(expected.size() == got.size());
+      assert(static_tree.count_within_range(target, range) == got.size());
+      assert(static_tree.visit_within_range(target, range, count_visitor()).count
+             == got.size());
+
+      std::pair<tree_type::const_iterator, double> nearest
+        = tree.find_nearest(target);
+      std::pair<typename StaticTree::const_iterator, double> static_nearest
+        = static_tree.find_nearest(target);
+      assert(static_nearest.first != static_tree.end());
+      assert(nearest.second == static_nearest.second);
+      assert(static_nearest.second == brute_force_nearest(points, target));
+
+      std::pair<typename StaticTree::const_iterator, double> within
+        = static_tree.find_nearest(target, range);
+      if (nearest.second <= range)
+        assert(within.first != static_tree.end()
+               && within.second == nearest.second);
+      else
+        assert(within.first == static_tree.end());
+    }
+}
+
+int main()
+{
+  std::vector<point> points;
+  for (size_t i = 0; i != 2000; ++i)
+    points.push_back(random_point(i));
+
+  tree_type tree(points.begin(), points.end());
+
+  test_static_tree<static_tree_type>(points, tree);
+  test_static_tree<packed_tree_type>(points, tree);
+  test_static_tree<unbucketed_tree_type>(points, tree);
+  test_static_tree<bucketed_tree_type>(points, tree);
+
+  std::printf("StaticKDTree agrees with KDTree on %u points\n",
+              unsigned(points.size()));
+  return 0;
+}
+
+/* COPYRIGHT --
+ *
+ * This file is part of libkdtree++, a C++ template KD-Tree sorting container.
+ * libkdtree++ is (c) 2004-2007 Martin F. Krafft <libkdtree@pobox.madduck.net>
+ * and Sylvain Bougerel <sylvain.bougerel.devel@gmail.com> distributed under the
+ * terms of the Artistic License 2.0. See the ./COPYING file in the source tree
+ * root for more information.
+ *
+ * THIS PACKAGE IS PROVIDED "AS IS" AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES
+ * OF MERCHANTIBILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
@@ -0,0 +1,192 @@
+// Checks that the nodes keep the number of live values of their subtrees
+// through every kind of update, and that count_within_range() and
+// visit_subtrees_within_range(), which rely on them, find the right values.
+// Trees whose nodes do not keep them must find the same values one by one.
+
+// Make SURE all our asserts() are checked
+#undef NDEBUG
+
+#include <kdtree++/kdtree.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+#include <vector>
+
+struct point
+{
+  typedef int value_type;
+
+  value_type operator[](size_t n) const { return xyz[n]; }
+
+  int xyz[3];
+  size_t index;
+};
+
+inline bool operator==(point const& A, point const& B)
+{
+  return A.index == B.index;
+}
+
+typedef KDTree::KDTree<3, point, KDTree::_Bracket_accessor<point>,
+                       KDTree::squared_difference<int, int>, std::less<int>,
+                       std::allocator<KDTree::_Node<point> >,
+                       KDTree::cyclic_split, KDTree::subtree_sizes> tree_type;
+typedef KDTree::KDTree<3, point> plain_tree_type;
+
+point random_point(size_t index)
+{
+  point p;
+  for (size_t k = 0; k != 3; ++k)
+    p.xyz[k] = rand() % 50;
+  p.index = index;
+  return p;
+}
+
+// collects the values, telling apart those given in whole subtrees
+template <class Tree>
+struct collector
+{
+  void operator()(point const& p) { indices.push_back(p.index); }
+
+  void operator()(typename Tree::const_iterator first,
+                  typename Tree::const_iterator last, size_t n)
+  {
+    assert(n > 0);
+    for (; first != last; ++first, --n)
+      indices.push_back(first->index);
+    assert(n == 0);
+    ++subtrees;
+  }
+
+  collector() : subtrees(0) { }
+
+  std::vector<size_t> indices;
+  size_t subtrees;
+};
+
+bool within(point const& p, point const& q, int r)
+{
+  for (size_t k = 0; k != 3; ++k)
+    if (std::abs(p.xyz[k] - q.xyz[k]) > r)
+      return false;
+  return true;
+}
+
+// returns the number of whole subtrees visited
+template <class Tree>
+size_t check(Tree& tree, point const& q, int r)
+{
+  tree.check_tree();
+  std::vector<size_t> expected;
+  for (typename Tree::const_iterator i = tree.begin(); i != tree.end(); ++i)
+    if (within(*i, q, r))
+      expected.push_back(i->index);
+  std::sort(expected.begin(), expected.end());
+
+  assert(tree.count_within_range(q, r) == expected.size());
+  collector<Tree> c = tree.visit_subtrees_within_range(q, r, collector<Tree>());
+  std::sort(c.indices.begin(), c.indices.end());
+  assert(c.indices == expected);
+  return c.subtrees;
+}
+
+template <class Tree>
+void check_all(Tree& tree)
+{
+  for (size_t i = 0; i != 20; ++i)
+    {
+      point const q = random_point(0);
+      check(tree, q, 3);
+      check(tree, q, 20);
+    }
+}
+
+int main()
+{
+  tree_type tree;
+  check(tree, random_point(0), 10);
+
+  // one by one, then rebuilt
+  size_t next = 0;
+  for (; next != 2000; ++next)
+    tree.insert(random_point(next));
+  check_all(tree);
+  tree.optimise();
+  check_all(tree);
+  // a query covering most of the values visits whole subtrees
+  point centre;
+  centre.xyz[0] = centre.xyz[1] = centre.xyz[2] = 25;
+  assert(check(tree, centre, 20) > 0);
+  assert(check(tree, centre, 100) > 0);
+
+  // erased one by one, moving the nodes around
+  std::vector<point> values(tree.begin(), tree.end());
+  for (size_t i = 0; i < values.size(); i += 4)
+    tree.erase_exact(values[i]);
+  check_all(tree);
+
+  // in batches, and erased in bulk
+  std::vector<point> batch;
+  for (size_t i = 0; i != 500; ++i)
+    batch.push_back(random_point(next++));
+  tree.insert(batch.begin(), batch.end());
+  check_all(tree);
+  point low;
+  low.xyz[0] = low.xyz[1] = low.xyz[2] = 10;
+  tree.erase_within_range(low, 10);
+  check_all(tree);
+
+  // erased lazily, then compacted
+  tree.set_lazy_erase(0.5);
+  values.assign(tree.begin(), tree.end());
+  for (size_t i = 0; i < values.size(); i += 3)
+    tree.erase_exact(values[i]);
+  check_all(tree);
+  tree.erase_within_range(centre, 5);
+  check_all(tree);
+  tree.set_lazy_erase(0);
+  check_all(tree);
+
+  // kept balanced while values arrive sorted
+  tree_type sorted;
+  sorted.set_balance(0.7);
+  for (size_t i = 0; i != 2000; ++i)
+    {
+      point p;
+      p.xyz[0] = int(i % 50);
+      p.xyz[1] = int(i / 50);
+      p.xyz[2] = 0;
+      p.index = i;
+      sorted.insert(p);
+    }
+  check_all(sorted);
+
+  // without the sizes, every value is visited alone
+  plain_tree_type plain;
+  for (size_t i = 0; i != 2000; ++i)
+    plain.insert(random_point(i));
+  check_all(plain);
+  assert(check(plain, centre, 100) == 0);
+  plain.set_lazy_erase(0.5);
+  plain.erase_within_range(centre, 10);
+  check_all(plain);
+
+  std::printf("subtree counts test passed\n");
+  return 0;
+}
+
+/* COPYRIGHT --
+ *
+ * This file is part of libkdtree++, a C++ template KD-Tree sorting container.
+ * libkdtree++ is (c) 2004-2007 Martin F. Krafft <libkdtree@pobox.madduck.net>
+ * and Sylvain Bougerel <sylvain.bougerel.devel@gmail.com> distributed under the
+ * terms of the Artistic License 2.0. See the ./COPYING file in the source tree
+ * root for more information.
+ *
+ * THIS PACKAGE IS PROVIDED "AS IS" AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES
+ * OF MERCHANTIBILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
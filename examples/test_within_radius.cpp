@@ -0,0 +1,121 @@
+// Checks that find_within_radius(), count_within_radius() and
+// visit_within_radius() give exactly the values inside the ball.
+
+// Make SURE all our asserts() are checked
+#undef NDEBUG
+
+#include <kdtree++/kdtree.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+#include <vector>
+
+struct point
+{
+  typedef int value_type;
+
+  value_type operator[](size_t n) const { return xyz[n]; }
+
+  int xyz[3];
+  size_t index;
+};
+
+inline bool operator==(point const& A, point const& B)
+{
+  return A.index == B.index;
+}
+
+typedef KDTree::KDTree<3, point, KDTree::_Bracket_accessor<point>,
+                       KDTree::squared_difference<int, double> > tree_type;
+
+double distance(point const& a, point const& b)
+{
+  double d = 0;
+  for (size_t k = 0; k != 3; ++k)
+    d += double(a[k] - b[k]) * (a[k] - b[k]);
+  return std::sqrt(d);
+}
+
+point random_point(size_t index)
+{
+  point p;
+  for (size_t k = 0; k != 3; ++k)
+    p.xyz[k] = rand() % 100;
+  p.index = index;
+  return p;
+}
+
+struct counter
+{
+  counter() : count(0) { }
+  void operator()(point const&) { ++count; }
+  size_t count;
+};
+
+void check(tree_type const& tree, point const& q, double r)
+{
+  std::vector<size_t> expected;
+  for (tree_type::const_iterator i = tree.begin(); i != tree.end(); ++i)
+    if (distance(*i, q) <= r)
+      expected.push_back(i->index);
+
+  std::vector<point> found;
+  tree.find_within_radius(q, r, std::back_inserter(found));
+  std::vector<size_t> indices;
+  for (size_t i = 0; i != found.size(); ++i)
+    indices.push_back(found[i].index);
+  std::sort(expected.begin(), expected.end());
+  std::sort(indices.begin(), indices.end());
+  assert(indices == expected);
+  assert(tree.count_within_radius(q, r) == expected.size());
+  assert(tree.visit_within_radius(q, r, counter()).count == expected.size());
+}
+
+int main()
+{
+  tree_type tree;
+  check(tree, random_point(0), 10);
+
+  for (size_t i = 0; i != 3000; ++i)
+    tree.insert(random_point(i));
+  for (size_t i = 0; i != 200; ++i)
+    {
+      point const q = random_point(i);
+      check(tree, q, 0);
+      check(tree, q, 7.5);
+      check(tree, q, 20);
+      // a radius equal to the distance of a value includes it
+      check(tree, q, distance(q, *tree.begin()));
+    }
+
+  tree.optimise();
+  check(tree, random_point(0), 150);
+
+  // with dead nodes
+  tree.set_lazy_erase(0.9);
+  std::vector<point> values(tree.begin(), tree.end());
+  for (size_t i = 0; i < values.size(); i += 3)
+    tree.erase_exact(values[i]);
+  for (size_t i = 0; i != 100; ++i)
+    check(tree, random_point(i), 12);
+
+  std::printf("within radius test passed\n");
+  return 0;
+}
+
+/* COPYRIGHT --
+ *
+ * This file is part of libkdtree++, a C++ template KD-Tree sorting container.
+ * libkdtree++ is (c) 2004-2007 Martin F. Krafft <libkdtree@pobox.madduck.net>
+ * and Sylvain Bougerel <sylvain.bougerel.devel@gmail.com> distributed under the
+ * terms of the Artistic License 2.0. See the ./COPYING file in the source tree
+ * root for more information.
+ *
+ * THIS PACKAGE IS PROVIDED "AS IS" AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES
+ * OF MERCHANTIBILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
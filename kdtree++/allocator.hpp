@@ -8,19 +8,290 @@
 #define INCLUDE_KDTREE_ALLOCATOR_HPP
 
 #include <cstddef>
+#include <new>
+#include <vector>
+#include <algorithm>
+
+#if __cplusplus >= 201103L
+#  include <memory>
+#  include <type_traits>
+#endif
 
 #include "node.hpp"
 
 namespace KDTree
 {
 
-  template <typename _Tp, typename _Alloc>
+  /*! An allocator handing out single objects from large contiguous chunks.
+
+      Objects given back with deallocate() are kept on a free list and
+      recycled by the next allocate(); the chunks are only given back to the
+      system by release() or when the last copy of the allocator goes away.
+      Copies of a pool_allocator share the same pool.  The pool is not
+      thread-safe.
+
+      To use it for the nodes of a KDTree, pass it as the _Alloc parameter:
+
+        KDTree::KDTree<3, T, _Acc, _Dist, _Cmp,
+                       KDTree::pool_allocator<KDTree::_Node<T> > >
+
+      KDTree::clear() then gives back all the nodes at once when the tree
+      does not share its allocator with another tree.
+   */
+  template <typename _Tp>
+    class pool_allocator
+    {
+    public:
+      typedef size_t size_type;
+      typedef ptrdiff_t difference_type;
+      typedef _Tp* pointer;
+      typedef _Tp const* const_pointer;
+      typedef _Tp& reference;
+      typedef _Tp const& const_reference;
+      typedef _Tp value_type;
+
+      template <typename _Up>
+        struct rebind
+        { typedef pool_allocator<_Up> other; };
+
+      explicit
+      pool_allocator(size_type const __chunk_size = 1024)
+        : _M_pool(new _Pool(__chunk_size)) {}
+
+      pool_allocator(pool_allocator const& __x)
+        : _M_pool(__x._M_pool)
+      { ++_M_pool->_M_refs; }
+
+      // objects of another type need a pool of their own
+      template <typename _Up>
+        pool_allocator(pool_allocator<_Up> const& __x)
+        : _M_pool(new _Pool(__x.chunk_size())) {}
+
+      ~pool_allocator()
+      {
+        if (--_M_pool->_M_refs == 0)
+          delete _M_pool;
+      }
+
+      pool_allocator&
+      operator=(pool_allocator const& __x)
+      {
+        ++__x._M_pool->_M_refs;
+        if (--_M_pool->_M_refs == 0)
+          delete _M_pool;
+        _M_pool = __x._M_pool;
+        return *this;
+      }
+
+      pointer address(reference __x) const { return &__x; }
+      const_pointer address(const_reference __x) const { return &__x; }
+
+      size_type
+      max_size() const
+      { return size_type(-1) / sizeof(_Tp); }
+
+      pointer
+      allocate(size_type const __n, void const* = 0)
+      {
+        if (__n != 1)
+          return static_cast<pointer>(::operator new(__n * sizeof(_Tp)));
+        return static_cast<pointer>(_M_pool->_M_allocate());
+      }
+
+      void
+      deallocate(pointer const __p, size_type const __n)
+      {
+        if (__n != 1)
+          ::operator delete(__p);
+        else
+          _M_pool->_M_deallocate(__p);
+      }
+
+      void
+      construct(pointer const __p, const_reference __V)
+      { new (__p) _Tp(__V); }
+
+      void
+      destroy(pointer const __p)
+      { __p->~_Tp(); }
+
+      /*! Make sure that the next __n objects allocated beyond those on the
+          free list come from a single chunk, one after the other.
+       */
+      void
+      reserve(size_type const __n)
+      { _M_pool->_M_reserve(__n); }
+
+      /*! Give back all the chunks of the pool at once.
+
+          All objects allocated from the pool (or its copies) become invalid,
+          they must have been destroyed beforehand.
+       */
+      void
+      release()
+      { _M_pool->_M_release(); }
+
+      //! true when no other allocator shares this pool.
+      bool
+      unique() const
+      { return _M_pool->_M_refs == 1; }
+
+      size_type
+      chunk_size() const
+      { return _M_pool->_M_chunk_size; }
+
+      friend bool
+      operator==(pool_allocator const& __a, pool_allocator const& __b)
+      { return __a._M_pool == __b._M_pool; }
+
+      friend bool
+      operator!=(pool_allocator const& __a, pool_allocator const& __b)
+      { return __a._M_pool != __b._M_pool; }
+
+    private:
+      // A free slot holds the link to the next free slot.
+      struct _Free_slot
+      {
+        _Free_slot* _M_next;
+      };
+
+      class _Pool
+      {
+      public:
+        explicit
+        _Pool(size_type const __chunk_size)
+          : _M_refs(1), _M_chunk_size(std::max(__chunk_size, size_type(1))),
+            _M_free(NULL), _M_next(NULL), _M_end(NULL) {}
+
+        ~_Pool() { _M_release(); }
+
+        void*
+        _M_allocate()
+        {
+          if (_M_free)
+            {
+              _Free_slot* const __slot = _M_free;
+              _M_free = __slot->_M_next;
+              return __slot;
+            }
+          if (_M_next == _M_end)
+            _M_new_chunk(_M_chunk_size);
+          void* const __p = _M_next;
+          _M_next += _S_slot_size;
+          return __p;
+        }
+
+        void
+        _M_deallocate(void* const __p)
+        {
+          _Free_slot* const __slot = static_cast<_Free_slot*>(__p);
+          __slot->_M_next = _M_free;
+          _M_free = __slot;
+        }
+
+        void
+        _M_reserve(size_type const __n)
+        {
+          if (size_type(_M_end - _M_next) < __n * _S_slot_size)
+            _M_new_chunk(std::max(__n, _M_chunk_size));
+        }
+
+        void
+        _M_release()
+        {
+          for (size_type __i = 0; __i != _M_chunks.size(); ++__i)
+            ::operator delete(_M_chunks[__i]);
+          _M_chunks.clear();
+          _M_free = NULL;
+          _M_next = _M_end = NULL;
+        }
+
+        size_type _M_refs;
+        size_type const _M_chunk_size;
+
+      private:
+        // A slot must be able to hold either an object or a free-list link,
+        // and keep the alignment of both: sizeof(_Tp) is a multiple of the
+        // alignment of _Tp.
+        static const size_type _S_slot_size =
+          (((sizeof(_Tp) > sizeof(_Free_slot)) ? sizeof(_Tp) : sizeof(_Free_slot))
+           + sizeof(_Free_slot) - 1) / sizeof(_Free_slot) * sizeof(_Free_slot);
+
+        void
+        _M_new_chunk(size_type const __slots)
+        {
+          _M_chunks.reserve(_M_chunks.size() + 1);
+          _M_next = static_cast<char*>(::operator new(__slots * _S_slot_size));
+          _M_end = _M_next + __slots * _S_slot_size;
+          _M_chunks.push_back(_M_next);
+        }
+
+        _Pool(_Pool const&);
+        _Pool& operator=(_Pool const&);
+
+        std::vector<void*> _M_chunks;
+        _Free_slot* _M_free;
+        char* _M_next;
+        char* _M_end;
+      };
+
+      _Pool* _M_pool;
+    };
+
+  // Only a pool_allocator can give back all of its objects at once, see
+  // _Alloc_base::_M_owns_pool().
+  template <typename _Alloc>
+    inline bool
+    _S_owns_pool(_Alloc const&)
+    { return false; }
+
+  template <typename _Tp>
+    inline bool
+    _S_owns_pool(pool_allocator<_Tp> const& __a)
+    { return __a.unique(); }
+
+  template <typename _Alloc>
+    inline void
+    _S_release_pool(_Alloc&)
+    { }
+
+  template <typename _Alloc>
+    inline void
+    _S_reserve_pool(_Alloc&, size_t const)
+    { }
+
+  template <typename _Tp>
+    inline void
+    _S_reserve_pool(pool_allocator<_Tp>& __a, size_t const __n)
+    { __a.reserve(__n); }
+
+  template <typename _Tp>
+    inline void
+    _S_release_pool(pool_allocator<_Tp>& __a)
+    { __a.release(); }
+
+  // _Alloc, made to allocate objects of type _Tp.
+  template <typename _Alloc, typename _Tp>
+    struct _Rebind_alloc
+    {
+#if __cplusplus >= 201103L
+      typedef typename std::allocator_traits<_Alloc>::template rebind_alloc<_Tp>
+        other;
+#else
+      typedef typename _Alloc::template rebind<_Tp>::other other;
+#endif
+    };
+
+  /*! Allocates the nodes of type _NodeT holding values of type _Tp.  _Alloc
+      is rebound to _NodeT, so that the nodes may be larger than _Node<_Tp>.
+   */
+  template <typename _Tp, typename _Alloc, typename _NodeT = _Node<_Tp> >
     class _Alloc_base
     {
     public:
-      typedef _Node<_Tp> _Node_;
+      typedef _NodeT _Node_;
       typedef typename _Node_::_Base_ptr _Base_ptr;
-      typedef _Alloc allocator_type;
+      typedef typename _Rebind_alloc<_Alloc, _Node_>::other allocator_type;
 
       _Alloc_base(allocator_type const& __A)
         : _M_node_allocator(__A) {}
@@ -63,19 +334,76 @@ namespace KDTree
       }
 
       void
-      _M_construct_node(_Node_* __p, _Tp const __V = _Tp(),
+      _M_construct_node(_Node_* __p, _Tp const& __V = _Tp(),
                         _Base_ptr const __PARENT = NULL,
                         _Base_ptr const __LEFT = NULL,
-                        _Base_ptr const __RIGHT = NULL)
+                        _Base_ptr const __RIGHT = NULL,
+                        size_t const __DIM = 0)
       {
-        new (__p) _Node_(__V, __PARENT, __LEFT, __RIGHT);
+        new (__p) _Node_(__V, __PARENT, __LEFT, __RIGHT, __DIM);
       }
 
+#if __cplusplus >= 201103L
+      void
+      _M_construct_node(_Node_* __p, _Tp&& __V,
+                        _Base_ptr const __PARENT = NULL,
+                        _Base_ptr const __LEFT = NULL,
+                        _Base_ptr const __RIGHT = NULL,
+                        size_t const __DIM = 0)
+      {
+        new (__p) _Node_(std::move(__V), __PARENT, __LEFT, __RIGHT, __DIM);
+      }
+
+      template <typename... _Args>
+        void
+        _M_emplace_node(_Node_* __p, _Args&&... __args)
+        {
+          new (__p) _Node_(_Emplace_tag(), std::forward<_Args>(__args)...);
+        }
+#endif
+
       void
       _M_destroy_node(_Node_* __p)
       {
         _M_node_allocator.destroy(__p);
       }
+
+      /*! true if the allocator is a pool_allocator used by nobody else,
+          in which case all the nodes can be given back at once with
+          _M_release_pool() once they are destroyed.
+       */
+      bool
+      _M_owns_pool() const
+      {
+        return _S_owns_pool(_M_node_allocator);
+      }
+
+      void
+      _M_release_pool()
+      {
+        _S_release_pool(_M_node_allocator);
+      }
+
+      /*! Prepare the allocation of __n nodes in a row.  A pool_allocator
+          then takes them from one block of memory, other allocators ignore
+          the hint.
+       */
+      void
+      _M_reserve_nodes(size_t const __n)
+      {
+        _S_reserve_pool(_M_node_allocator, __n);
+      }
+
+      //! true if the nodes can be released without calling their destructor.
+      static bool
+      _S_trivial_node()
+      {
+#if __cplusplus >= 201103L
+        return std::is_trivially_destructible<_Node_>::value;
+#else
+        return false;
+#endif
+      }
     };
 
 } // namespace KDTree
@@ -0,0 +1,665 @@
+/** \file
+ * Defines the interface for the CompactKDTree class.
+ *
+ * A CompactKDTree is a read-only kd-tree that is built once from a sequence
+ * of values, like StaticKDTree, but with any of the split policies of KDTree
+ * (see split.hpp), which may cut anywhere and on any dimension.  Its nodes,
+ * see _Compact_node, lie in a single array in the pre-order of the tree:
+ *
+ *  * The left child of the node at i, if any, is the node at i + 1.
+ *  * Its right child is the node at _M_right, one past the left subtree.
+ *  * There is no parent link; the searches keep the path they walk down.
+ *
+ * Beyond its value, a node thus costs two 32-bit words, the index of its
+ * right child and its split dimension, where a node of KDTree holds three
+ * pointers and the dimension.  A tree holds at most 2^32 - 1 values.  As for
+ * KDTree, the left subtree holds values <= the node on its splitting
+ * dimension and the right subtree holds values >= it.
+ */
+
+#ifndef INCLUDE_KDTREE_COMPACT_KDTREE_HPP
+#define INCLUDE_KDTREE_COMPACT_KDTREE_HPP
+
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+
+#include <cstddef>
+
+#include "allocator.hpp"
+#include "function.hpp"
+#include "node.hpp"
+#include "region.hpp"
+#include "split.hpp"
+
+namespace KDTree
+{
+
+  //! Iterates over the values of a CompactKDTree, in the order of its nodes.
+  template <typename _Val>
+    class _Compact_iterator
+    {
+    public:
+      typedef std::random_access_iterator_tag iterator_category;
+      typedef _Val value_type;
+      typedef ptrdiff_t difference_type;
+      typedef _Val const* pointer;
+      typedef _Val const& reference;
+      typedef _Compact_node<_Val> const* _Link_const_type;
+
+      _Compact_iterator() : _M_node(NULL) { }
+
+      explicit
+      _Compact_iterator(_Link_const_type const __N) : _M_node(__N) { }
+
+      _Link_const_type
+      get_raw_node() const
+      { return _M_node; }
+
+      reference operator*() const { return _M_node->_M_value; }
+      pointer operator->() const { return &_M_node->_M_value; }
+
+      reference
+      operator[](difference_type const __n) const
+      { return _M_node[__n]._M_value; }
+
+      _Compact_iterator& operator++() { ++_M_node; return *this; }
+      _Compact_iterator& operator--() { --_M_node; return *this; }
+
+      _Compact_iterator
+      operator++(int)
+      { return _Compact_iterator(_M_node++); }
+
+      _Compact_iterator
+      operator--(int)
+      { return _Compact_iterator(_M_node--); }
+
+      _Compact_iterator&
+      operator+=(difference_type const __n)
+      { _M_node += __n; return *this; }
+
+      _Compact_iterator&
+      operator-=(difference_type const __n)
+      { _M_node -= __n; return *this; }
+
+      _Compact_iterator
+      operator+(difference_type const __n) const
+      { return _Compact_iterator(_M_node + __n); }
+
+      _Compact_iterator
+      operator-(difference_type const __n) const
+      { return _Compact_iterator(_M_node - __n); }
+
+      friend _Compact_iterator
+      operator+(difference_type const __n, _Compact_iterator const& __x)
+      { return __x + __n; }
+
+      friend difference_type
+      operator-(_Compact_iterator const& __x, _Compact_iterator const& __y)
+      { return __x._M_node - __y._M_node; }
+
+      friend bool
+      operator==(_Compact_iterator const& __x, _Compact_iterator const& __y)
+      { return __x._M_node == __y._M_node; }
+
+      friend bool
+      operator!=(_Compact_iterator const& __x, _Compact_iterator const& __y)
+      { return __x._M_node != __y._M_node; }
+
+      friend bool
+      operator<(_Compact_iterator const& __x, _Compact_iterator const& __y)
+      { return __x._M_node < __y._M_node; }
+
+      friend bool
+      operator>(_Compact_iterator const& __x, _Compact_iterator const& __y)
+      { return __y._M_node < __x._M_node; }
+
+      friend bool
+      operator<=(_Compact_iterator const& __x, _Compact_iterator const& __y)
+      { return !(__y._M_node < __x._M_node); }
+
+      friend bool
+      operator>=(_Compact_iterator const& __x, _Compact_iterator const& __y)
+      { return !(__x._M_node < __y._M_node); }
+
+    private:
+      _Link_const_type _M_node;
+    };
+
+  template <size_t const __K, typename _Val,
+            typename _Acc = _Bracket_accessor<_Val>,
+	    typename _Dist = squared_difference<typename _Acc::result_type,
+						typename _Acc::result_type>,
+            typename _Cmp = std::less<typename _Acc::result_type>,
+            typename _Alloc = std::allocator<_Val>,
+            typename _Split = cyclic_split>
+    class CompactKDTree
+    {
+    protected:
+      typedef _Compact_node<_Val> _Node_;
+      typedef typename _Rebind_alloc<_Alloc, _Node_>::other _Node_allocator;
+      typedef std::vector<_Node_, _Node_allocator> _Nodes;
+      typedef distance_traits<_Dist> _Dist_traits;
+
+    public:
+      typedef _Region<__K, _Val, typename _Acc::result_type, _Acc, _Cmp>
+        _Region_;
+      typedef _Val value_type;
+      typedef value_type* pointer;
+      typedef value_type const* const_pointer;
+      typedef value_type& reference;
+      typedef value_type const& const_reference;
+      typedef typename _Acc::result_type subvalue_type;
+      typedef typename _Dist::distance_type distance_type;
+      typedef size_t size_type;
+      typedef ptrdiff_t difference_type;
+      typedef _Alloc allocator_type;
+
+      // The values cannot be modified in place, it would invalidate the tree.
+      typedef _Compact_iterator<_Val> const_iterator;
+      typedef const_iterator iterator;
+      typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+      typedef const_reverse_iterator reverse_iterator;
+
+      CompactKDTree(_Acc const& __acc = _Acc(), _Dist const& __dist = _Dist(),
+		    _Cmp const& __cmp = _Cmp(),
+		    const allocator_type& __a = allocator_type())
+        : _M_nodes(_Node_allocator(__a)),
+	  _M_acc(__acc), _M_cmp(__cmp), _M_dist(__dist)
+      { }
+
+      /*! Build the tree from the values of [__first, __last).
+
+	\throw std::length_error if there are more values than a 32-bit
+	index can tell apart.
+       */
+      template<typename _InputIterator>
+        CompactKDTree(_InputIterator __first, _InputIterator __last,
+		      _Acc const& __acc = _Acc(), _Dist const& __dist = _Dist(),
+		      _Cmp const& __cmp = _Cmp(),
+		      const allocator_type& __a = allocator_type())
+        : _M_nodes(_Node_allocator(__a)),
+	  _M_acc(__acc), _M_cmp(__cmp), _M_dist(__dist)
+      {
+        for (; __first != __last; ++__first)
+          {
+            if (_M_nodes.size() == max_size())
+              throw std::length_error("CompactKDTree: too many values");
+            _Node_ const __node = { *__first, 0, 0 };
+            _M_nodes.push_back(__node);
+          }
+        if (!_M_nodes.empty())
+          _M_build(0, _M_nodes.size(), 0);
+      }
+
+      void
+      swap(CompactKDTree& __x)
+      {
+        _M_nodes.swap(__x._M_nodes);
+        std::swap(_M_acc, __x._M_acc);
+        std::swap(_M_cmp, __x._M_cmp);
+        std::swap(_M_dist, __x._M_dist);
+      }
+
+      allocator_type
+      get_allocator() const
+      {
+        return allocator_type(_M_nodes.get_allocator());
+      }
+
+      size_type
+      size() const
+      {
+        return _M_nodes.size();
+      }
+
+      size_type
+      max_size() const
+      {
+        return std::min(_M_nodes.max_size(),
+                        size_type(std::numeric_limits<unsigned int>::max()));
+      }
+
+      bool
+      empty() const
+      {
+        return _M_nodes.empty();
+      }
+
+      void
+      clear()
+      {
+        _M_nodes.clear();
+      }
+
+      _Cmp
+      value_comp() const
+      { return _M_cmp; }
+
+      _Acc
+      value_acc() const
+      { return _M_acc; }
+
+      const _Dist&
+      value_distance() const
+      { return _M_dist; }
+
+      _Dist&
+      value_distance()
+      { return _M_dist; }
+
+      const_iterator
+      begin() const
+      { return const_iterator(empty() ? NULL : &_M_nodes[0]); }
+
+      const_iterator
+      end() const
+      { return begin() + size(); }
+
+      const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+      const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
+
+      // compares via equivalence, see KDTree::find()
+      template <class SearchVal>
+      const_iterator
+      find(SearchVal const& __V) const
+      {
+        return begin() + _M_find(0, size(), __V, false);
+      }
+
+      // compares via equality, see KDTree::find_exact()
+      template <class SearchVal>
+      const_iterator
+      find_exact(SearchVal const& __V) const
+      {
+        return begin() + _M_find(0, size(), __V, true);
+      }
+
+      // NOTE: see notes on KDTree::find_within_range().
+      size_type
+      count_within_range(const_reference __V, subvalue_type const __R) const
+      {
+        if (empty()) return 0;
+        _Region_ __region(__V, __R, _M_acc, _M_cmp);
+        return this->count_within_range(__region);
+      }
+
+      size_type
+      count_within_range(_Region_ const& __REGION) const
+      {
+        _Count_visitor __count;
+        _M_visit_within_range(__count, 0, size(), __REGION);
+        return __count._M_count;
+      }
+
+      template <typename SearchVal, class Visitor>
+        Visitor
+        visit_within_range(SearchVal const& V, subvalue_type const R,
+                           Visitor visitor) const
+        {
+          if (empty()) return visitor;
+          _Region_ region(V, R, _M_acc, _M_cmp);
+          return this->visit_within_range(region, visitor);
+        }
+
+      template <class Visitor>
+        Visitor
+        visit_within_range(_Region_ const& REGION, Visitor visitor) const
+        {
+          _M_visit_within_range(visitor, 0, size(), REGION);
+          return visitor;
+        }
+
+      // NOTE: see notes on KDTree::find_within_range(), this returns the
+      // values within a box, not within a sphere.
+      template <typename SearchVal, typename _OutputIterator>
+        _OutputIterator
+        find_within_range(SearchVal const& val, subvalue_type const range,
+                          _OutputIterator out) const
+        {
+          if (empty()) return out;
+          _Region_ region(val, range, _M_acc, _M_cmp);
+          return this->find_within_range(region, out);
+        }
+
+      template <typename _OutputIterator>
+        _OutputIterator
+        find_within_range(_Region_ const& region,
+                          _OutputIterator out) const
+        {
+          _Output_visitor<_OutputIterator> __visitor(out);
+          _M_visit_within_range(__visitor, 0, size(), region);
+          return __visitor._M_out;
+        }
+
+      template <class SearchVal>
+      std::pair<const_iterator, distance_type>
+      find_nearest(SearchVal const& __val) const
+      {
+        if (empty())
+          return std::pair<const_iterator, distance_type>(end(), 0);
+        subvalue_type __q[__K];
+        _M_get_coords(__val, __q);
+        size_type __best = 0;
+        distance_type __max_sum = _M_distance(__best, __q);
+        _M_find_nearest(0, size(), __q, always_true<value_type>(),
+                        __best, __max_sum);
+        return std::pair<const_iterator, distance_type>
+          (begin() + __best, _Dist_traits::to_distance(__max_sum));
+      }
+
+      template <class SearchVal>
+      std::pair<const_iterator, distance_type>
+      find_nearest(SearchVal const& __val, distance_type __max) const
+      {
+        return find_nearest_if(__val, __max, always_true<value_type>());
+      }
+
+      template <class SearchVal, class _Predicate>
+      std::pair<const_iterator, distance_type>
+      find_nearest_if(SearchVal const& __val, distance_type __max,
+                      _Predicate __p) const
+      {
+        size_type __best = size();
+        if (!empty())
+          {
+            subvalue_type __q[__K];
+            _M_get_coords(__val, __q);
+            distance_type __max_sum = _Dist_traits::from_distance(__max);
+            _M_find_nearest(0, size(), __q, __p, __best, __max_sum);
+            if (__best != size())
+              __max = _Dist_traits::to_distance(__max_sum);
+          }
+        return std::pair<const_iterator, distance_type>
+          (begin() + __best, __max);
+      }
+
+      /*! Find the __k values nearest to __val, see KDTree::find_k_nearest().
+
+	Writes to __out a std::pair<const_iterator, distance_type> for each of
+	them, nearest first.  Fewer are written if the tree holds fewer than
+	__k values.
+       */
+      template <class SearchVal, typename _OutputIterator>
+      _OutputIterator
+      find_k_nearest(SearchVal const& __val, size_type const __k,
+                     _OutputIterator __out) const
+      {
+        if (!__k || empty()) return __out;
+        subvalue_type __q[__K];
+        _M_get_coords(__val, __q);
+        std::vector<_Candidate> __heap;
+        _M_find_k_nearest(0, size(), __q, __k, __heap);
+        std::sort_heap(__heap.begin(), __heap.end());
+        for (size_type __i = 0; __i != __heap.size(); ++__i)
+          *__out++ = std::pair<const_iterator, distance_type>
+            (begin() + __heap[__i].second,
+             _Dist_traits::to_distance(__heap[__i].first));
+        return __out;
+      }
+
+    protected:
+      // a distance, as a sum of _Dist, and the index of the value; the
+      // farthest candidate, then the last in the array, is on top of the heap
+      typedef std::pair<distance_type, size_type> _Candidate;
+
+      // Gives the split policies the values of the nodes.
+      struct _Node_accessor
+      {
+        typedef subvalue_type result_type;
+
+        _Node_accessor(_Acc const& __acc) : _M_acc(__acc) {}
+
+        result_type
+        operator()(_Node_ const& __N, size_t const __dim) const
+        { return _M_acc(__N._M_value, __dim); }
+
+        _Acc _M_acc;
+      };
+
+      // Partitions the nodes [__lo, __hi) into the pre-order of their
+      // subtree, whose root is at depth __L, and links them.
+      void
+      _M_build(size_type const __lo, size_type const __hi,
+               size_type const __L)
+      {
+        typename _Nodes::iterator const __first = _M_nodes.begin();
+        size_type __dim;
+        typename _Nodes::iterator const __m = _Split::template split<__K>
+          (__first + __lo, __first + __hi, __L, _Node_accessor(_M_acc),
+           _M_cmp, __dim);
+        std::iter_swap(__first + __lo, __m);
+        // the left subtree is [__lo+1,__m+1), the right one [__m+1,__hi)
+        size_type const __right = (__m - __first) + 1;
+        _M_nodes[__lo]._M_right = static_cast<unsigned int>(__right);
+        _M_nodes[__lo]._M_dim = static_cast<unsigned int>(__dim);
+        if (__lo + 1 != __right)
+          _M_build(__lo + 1, __right, __L + 1);
+        if (__right != __hi)
+          _M_build(__right, __hi, __L + 1);
+      }
+
+      subvalue_type
+      _M_coord(size_type const __i, size_type const __dim) const
+      {
+        return _M_acc(_M_nodes[__i]._M_value, __dim);
+      }
+
+      template <class SearchVal>
+      void
+      _M_get_coords(SearchVal const& __V, subvalue_type* __q) const
+      {
+        for (size_type __i = 0; __i != __K; ++__i)
+          __q[__i] = _M_acc(__V, __i);
+      }
+
+      distance_type
+      _M_distance(size_type const __i, subvalue_type const* __q) const
+      {
+        distance_type d = 0;
+        for (size_type __dim = 0; __dim != __K; ++__dim)
+          d += _M_dist(_M_coord(__i, __dim), __q[__dim]);
+        return d;
+      }
+
+      template <class SearchVal>
+      bool
+      _M_matches(size_type const __i, SearchVal const& __V) const
+      {
+        for (size_type __dim = 0; __dim != __K; ++__dim)
+          {
+            subvalue_type const __c = _M_coord(__i, __dim);
+            subvalue_type const __q = _M_acc(__V, __dim);
+            if (_M_cmp(__c, __q) || _M_cmp(__q, __c))
+              return false;
+          }
+        return true;
+      }
+
+      // the index of a value of the subtree [__i, __end) matching __V, or
+      // size() when there is none
+      template <class SearchVal>
+      size_type
+      _M_find(size_type __i, size_type const __end, SearchVal const& __V,
+              bool const __exact) const
+      {
+        // be aware! identical values can be found down both branches, see
+        // the notes on top of kdtree.hpp
+        while (__i != __end)
+          {
+            _Node_ const& __n = _M_nodes[__i];
+            subvalue_type const __c = _M_coord(__i, __n._M_dim);
+            subvalue_type const __q = _M_acc(__V, __n._M_dim);
+            if (!_M_cmp(__c, __q))   // note, this is a <= test
+              {
+                if (__exact ? __V == __n._M_value : _M_matches(__i, __V))
+                  return __i;
+                size_type const __found
+                  = _M_find(__i + 1, __n._M_right, __V, __exact);
+                if (__found != size())
+                  return __found;
+              }
+            if (_M_cmp(__q, __c))
+              break;
+            __i = __n._M_right;
+          }
+        return size();
+      }
+
+      template <typename _OutputIterator>
+        struct _Output_visitor
+        {
+          _Output_visitor(_OutputIterator const& __out) : _M_out(__out) { }
+
+          void
+          operator()(const_reference __V)
+          { *_M_out++ = __V; }
+
+          _OutputIterator _M_out;
+        };
+
+      struct _Count_visitor
+      {
+        _Count_visitor() : _M_count(0) { }
+
+        void
+        operator()(const_reference)
+        { ++_M_count; }
+
+        size_type _M_count;
+      };
+
+      /*! Visit the values of the subtree [__i, __end) within __REGION.  The
+	cell of the subtree intersects __REGION, so the cell of a child does
+	too unless the plane of the node leaves it beyond __REGION; only that
+	bound is tested.  The right subtrees are visited in the loop, the
+	left ones by recursion.
+       */
+      template <class Visitor>
+        void
+        _M_visit_within_range(Visitor& __visitor, size_type __i,
+                              size_type const __end,
+                              _Region_ const& __REGION) const
+        {
+          while (__i != __end)
+            {
+              _Node_ const& __n = _M_nodes[__i];
+              if (__REGION.encloses(__n._M_value))
+                __visitor(__n._M_value);
+              size_type const __dim = __n._M_dim;
+              subvalue_type const __c = _M_coord(__i, __dim);
+              if (__i + 1 != __n._M_right
+                  && !_M_cmp(__c, __REGION._M_low_bounds[__dim]))
+                _M_visit_within_range(__visitor, __i + 1, __n._M_right,
+                                      __REGION);
+              if (_M_cmp(__REGION._M_high_bounds[__dim], __c))
+                break;
+              __i = __n._M_right;
+            }
+        }
+
+      /*! Find the nearest value to the point __q in the subtree [__i,
+          __end) that satisfies __p and is no further than __max_sum, see
+          StaticKDTree::_M_find_nearest().
+       */
+      template <class _Predicate>
+      void
+      _M_find_nearest(size_type const __i, size_type const __end,
+                      subvalue_type const* __q, _Predicate __p,
+                      size_type& __best, distance_type& __max_sum) const
+      {
+        _Node_ const& __n = _M_nodes[__i];
+        if (__p(__n._M_value))
+          {
+            distance_type const d = _M_distance(__i, __q);
+            if (d <= __max_sum)
+              {
+                __best = __i;
+                __max_sum = d;
+              }
+          }
+        size_type const __dim = __n._M_dim;
+        size_type const __right = __n._M_right;
+        subvalue_type const __split = _M_coord(__i, __dim);
+        bool const __left_is_near = _M_cmp(__q[__dim], __split);
+        size_type const __near_lo = __left_is_near ? __i + 1 : __right;
+        size_type const __near_hi = __left_is_near ? __right : __end;
+        size_type const __far_lo = __left_is_near ? __right : __i + 1;
+        size_type const __far_hi = __left_is_near ? __end : __right;
+        if (__near_lo != __near_hi)
+          _M_find_nearest(__near_lo, __near_hi, __q, __p, __best, __max_sum);
+        // only visit the far side if its plane intersects the hypersphere
+        if (__far_lo != __far_hi
+            && _M_dist(__split, __q[__dim]) <= __max_sum)
+          _M_find_nearest(__far_lo, __far_hi, __q, __p, __best, __max_sum);
+      }
+
+      static void
+      _S_offer(_Candidate const& __c, size_type const __k,
+               std::vector<_Candidate>& __heap)
+      {
+        if (__heap.size() < __k)
+          {
+            __heap.push_back(__c);
+            std::push_heap(__heap.begin(), __heap.end());
+          }
+        else if (__c < __heap.front())
+          {
+            std::pop_heap(__heap.begin(), __heap.end());
+            __heap.back() = __c;
+            std::push_heap(__heap.begin(), __heap.end());
+          }
+      }
+
+      // Adds to __heap, a max-heap of at most __k candidates, the values of
+      // the subtree [__i, __end) nearer than the candidates it holds.
+      void
+      _M_find_k_nearest(size_type const __i, size_type const __end,
+                        subvalue_type const* __q, size_type const __k,
+                        std::vector<_Candidate>& __heap) const
+      {
+        _Node_ const& __n = _M_nodes[__i];
+        _S_offer(_Candidate(_M_distance(__i, __q), __i), __k, __heap);
+        size_type const __dim = __n._M_dim;
+        size_type const __right = __n._M_right;
+        subvalue_type const __split = _M_coord(__i, __dim);
+        bool const __left_is_near = _M_cmp(__q[__dim], __split);
+        size_type const __near_lo = __left_is_near ? __i + 1 : __right;
+        size_type const __near_hi = __left_is_near ? __right : __end;
+        size_type const __far_lo = __left_is_near ? __right : __i + 1;
+        size_type const __far_hi = __left_is_near ? __end : __right;
+        if (__near_lo != __near_hi)
+          _M_find_k_nearest(__near_lo, __near_hi, __q, __k, __heap);
+        // only visit the far side if its plane is nearer than the k-th
+        if (__far_lo != __far_hi
+            && (__heap.size() < __k
+                || _M_dist(__split, __q[__dim]) <= __heap.front().first))
+          _M_find_k_nearest(__far_lo, __far_hi, __q, __k, __heap);
+      }
+
+      _Nodes _M_nodes;
+      _Acc _M_acc;
+      _Cmp _M_cmp;
+      _Dist _M_dist;
+    };
+
+} // namespace KDTree
+
+#endif // include guard
+
+/* COPYRIGHT --
+ *
+ * This file is part of libkdtree++, a C++ template KD-Tree sorting container.
+ * libkdtree++ is (c) 2004-2007 Martin F. Krafft <libkdtree@pobox.madduck.net>
+ * and Sylvain Bougerel <sylvain.bougerel.devel@gmail.com> distributed under the
+ * terms of the Artistic License 2.0. See the ./COPYING file in the source tree
+ * root for more information.
+ *
+ * THIS PACKAGE IS PROVIDED "AS IS" AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES
+ * OF MERCHANTIBILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
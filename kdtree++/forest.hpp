@@ -0,0 +1,515 @@
+/** \file
+ * Defines the interface for the KDForest class.
+ *
+ * A KDForest is a kd-tree container for values that keep arriving.  It keeps
+ * them in a small unsorted buffer of __Buffer values and in a sequence of
+ * StaticKDTree, the i-th of which is either empty or holds __Buffer * 2^i
+ * values (the logarithmic method of Bentley and Saxe):
+ *
+ *  * insert() appends to the buffer.  When the buffer is full, it is merged
+ *    with the trees 0 to j-1 into tree j, the first empty one, like a carry
+ *    in a binary counter.
+ *  * Every value is rebuilt into a larger tree at most log(n / __Buffer)
+ *    times, so an insert costs O(log^2 n) amortised, and every tree is
+ *    perfectly balanced.
+ *  * The searches scan the buffer and search each of the O(log n) trees,
+ *    then merge the answers.
+ *
+ * Values cannot be erased one by one, only all at once with clear().
+ */
+
+#ifndef INCLUDE_KDTREE_FOREST_HPP
+#define INCLUDE_KDTREE_FOREST_HPP
+
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <memory>
+
+#include <cmath>
+#include <cstddef>
+
+#include "function.hpp"
+#include "region.hpp"
+#include "static_kdtree.hpp"
+
+namespace KDTree
+{
+
+  template <size_t const __K, typename _Val,
+            typename _Acc = _Bracket_accessor<_Val>,
+	    typename _Dist = squared_difference<typename _Acc::result_type,
+						typename _Acc::result_type>,
+            typename _Cmp = std::less<typename _Acc::result_type>,
+            typename _Alloc = std::allocator<_Val>,
+            typename _Coords = inline_coordinates,
+            size_t const __Buffer = 64>
+    class KDForest
+    {
+    protected:
+      typedef std::vector<_Val, _Alloc> _Storage;
+      typedef StaticKDTree<__K, _Val, _Acc, _Dist, _Cmp, _Alloc, _Coords>
+        _Tree;
+      typedef distance_traits<_Dist> _Dist_traits;
+
+    public:
+      typedef typename _Tree::_Region_ _Region_;
+      typedef _Val value_type;
+      typedef value_type* pointer;
+      typedef value_type const* const_pointer;
+      typedef value_type& reference;
+      typedef value_type const& const_reference;
+      typedef typename _Acc::result_type subvalue_type;
+      typedef typename _Dist::distance_type distance_type;
+      typedef size_t size_type;
+      typedef ptrdiff_t difference_type;
+      typedef _Alloc allocator_type;
+
+      /*! Walks the buffer, then the trees from the smallest to the largest.
+
+        Any insert() may move the values around and invalidates the
+        iterators.
+       */
+      class const_iterator
+      {
+      public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef _Val value_type;
+        typedef ptrdiff_t difference_type;
+        typedef value_type const* pointer;
+        typedef value_type const& reference;
+
+        const_iterator() : _M_forest(0), _M_level(0), _M_pos(0) {}
+
+        reference
+        operator*() const
+        { return _M_forest->_M_value(_M_level, _M_pos); }
+
+        pointer
+        operator->() const
+        { return &**this; }
+
+        const_iterator&
+        operator++()
+        {
+          ++_M_pos;
+          _M_skip_empty();
+          return *this;
+        }
+
+        const_iterator
+        operator++(int)
+        {
+          const_iterator __tmp = *this;
+          ++*this;
+          return __tmp;
+        }
+
+        bool
+        operator==(const_iterator const& __x) const
+        { return _M_level == __x._M_level && _M_pos == __x._M_pos; }
+
+        bool
+        operator!=(const_iterator const& __x) const
+        { return !(*this == __x); }
+
+      private:
+        friend class KDForest;
+
+        // level 0 is the buffer, level i+1 the i-th tree
+        const_iterator(KDForest const* __forest, size_type const __level,
+                       size_type const __pos)
+          : _M_forest(__forest), _M_level(__level), _M_pos(__pos)
+        { _M_skip_empty(); }
+
+        void
+        _M_skip_empty()
+        {
+          while (_M_level <= _M_forest->_M_levels.size()
+                 && _M_pos == _M_forest->_M_level_size(_M_level))
+            {
+              ++_M_level;
+              _M_pos = 0;
+            }
+        }
+
+        KDForest const* _M_forest;
+        size_type _M_level;
+        size_type _M_pos;
+      };
+
+      typedef const_iterator iterator;
+      friend class const_iterator;
+
+      KDForest(_Acc const& __acc = _Acc(), _Dist const& __dist = _Dist(),
+	       _Cmp const& __cmp = _Cmp(),
+	       const allocator_type& __a = allocator_type())
+        : _M_buffer(__a), _M_count(0),
+	  _M_acc(__acc), _M_cmp(__cmp), _M_dist(__dist)
+      {
+        _M_buffer.reserve(__Buffer);
+      }
+
+      template<typename _InputIterator>
+        KDForest(_InputIterator __first, _InputIterator __last,
+		 _Acc const& __acc = _Acc(), _Dist const& __dist = _Dist(),
+		 _Cmp const& __cmp = _Cmp(),
+		 const allocator_type& __a = allocator_type())
+        : _M_buffer(__a), _M_count(0),
+	  _M_acc(__acc), _M_cmp(__cmp), _M_dist(__dist)
+      {
+        _M_buffer.reserve(__Buffer);
+        this->insert(__first, __last);
+      }
+
+      void
+      swap(KDForest& __x)
+      {
+        _M_buffer.swap(__x._M_buffer);
+        _M_levels.swap(__x._M_levels);
+        std::swap(_M_count, __x._M_count);
+        std::swap(_M_acc, __x._M_acc);
+        std::swap(_M_cmp, __x._M_cmp);
+        std::swap(_M_dist, __x._M_dist);
+      }
+
+      allocator_type
+      get_allocator() const
+      {
+        return _M_buffer.get_allocator();
+      }
+
+      size_type
+      size() const
+      {
+        return _M_count;
+      }
+
+      size_type
+      max_size() const
+      {
+        return _M_buffer.max_size();
+      }
+
+      bool
+      empty() const
+      {
+        return _M_count == 0;
+      }
+
+      void
+      clear()
+      {
+        _M_buffer.clear();
+        _M_levels.clear();
+        _M_count = 0;
+      }
+
+      //! The number of trees, empty or not, behind the buffer.
+      size_type
+      levels() const
+      {
+        return _M_levels.size();
+      }
+
+      _Cmp
+      value_comp() const
+      { return _M_cmp; }
+
+      _Acc
+      value_acc() const
+      { return _M_acc; }
+
+      const _Dist&
+      value_distance() const
+      { return _M_dist; }
+
+      _Dist&
+      value_distance()
+      { return _M_dist; }
+
+      const_iterator begin() const { return const_iterator(this, 0, 0); }
+      const_iterator end() const
+      { return const_iterator(this, _M_levels.size() + 1, 0); }
+
+      //! Nothing changes if an exception is thrown.
+      void
+      insert(const_reference __V)
+      {
+        _M_buffer.push_back(__V);
+        if (_M_buffer.size() >= __Buffer)
+          {
+            try
+              {
+                _M_carry();
+              }
+            catch (...)
+              {
+                _M_buffer.pop_back();
+                throw;
+              }
+          }
+        ++_M_count;
+      }
+
+      //! If an exception is thrown, the values before it are kept.
+      template <class _InputIterator>
+        void
+        insert(_InputIterator __first, _InputIterator __last)
+        {
+          for (; __first != __last; ++__first)
+            this->insert(*__first);
+        }
+
+      // compares via equivalence, see KDTree::find()
+      template <class SearchVal>
+      const_iterator
+      find(SearchVal const& __V) const
+      {
+        for (size_type __i = 0; __i != _M_buffer.size(); ++__i)
+          if (_M_matches(_M_buffer[__i], __V))
+            return const_iterator(this, 0, __i);
+        for (size_type __l = 0; __l != _M_levels.size(); ++__l)
+          {
+            typename _Tree::const_iterator const __found
+              = _M_levels[__l].find(__V);
+            if (__found != _M_levels[__l].end())
+              return const_iterator(this, __l + 1,
+                                    __found - _M_levels[__l].begin());
+          }
+        return end();
+      }
+
+      // compares via equality, see KDTree::find_exact()
+      template <class SearchVal>
+      const_iterator
+      find_exact(SearchVal const& __V) const
+      {
+        for (size_type __i = 0; __i != _M_buffer.size(); ++__i)
+          if (__V == _M_buffer[__i])
+            return const_iterator(this, 0, __i);
+        for (size_type __l = 0; __l != _M_levels.size(); ++__l)
+          {
+            typename _Tree::const_iterator const __found
+              = _M_levels[__l].find_exact(__V);
+            if (__found != _M_levels[__l].end())
+              return const_iterator(this, __l + 1,
+                                    __found - _M_levels[__l].begin());
+          }
+        return end();
+      }
+
+      // NOTE: see notes on KDTree::find_within_range().
+      size_type
+      count_within_range(const_reference __V, subvalue_type const __R) const
+      {
+        _Region_ __region(__V, __R, _M_acc, _M_cmp);
+        return this->count_within_range(__region);
+      }
+
+      size_type
+      count_within_range(_Region_ const& __REGION) const
+      {
+        size_type __count = 0;
+        for (size_type __i = 0; __i != _M_buffer.size(); ++__i)
+          if (__REGION.encloses(_M_buffer[__i]))
+            ++__count;
+        for (size_type __l = 0; __l != _M_levels.size(); ++__l)
+          __count += _M_levels[__l].count_within_range(__REGION);
+        return __count;
+      }
+
+      template <typename SearchVal, class Visitor>
+        Visitor
+        visit_within_range(SearchVal const& V, subvalue_type const R,
+                           Visitor visitor) const
+        {
+          _Region_ region(V, R, _M_acc, _M_cmp);
+          return this->visit_within_range(region, visitor);
+        }
+
+      template <class Visitor>
+        Visitor
+        visit_within_range(_Region_ const& REGION, Visitor visitor) const
+        {
+          for (size_type i = 0; i != _M_buffer.size(); ++i)
+            if (REGION.encloses(_M_buffer[i]))
+              visitor(_M_buffer[i]);
+          for (size_type l = 0; l != _M_levels.size(); ++l)
+            visitor = _M_levels[l].visit_within_range(REGION, visitor);
+          return visitor;
+        }
+
+      // NOTE: see notes on KDTree::find_within_range(), this returns the
+      // values within a box, not within a sphere.
+      template <typename SearchVal, typename _OutputIterator>
+        _OutputIterator
+        find_within_range(SearchVal const& val, subvalue_type const range,
+                          _OutputIterator out) const
+        {
+          _Region_ region(val, range, _M_acc, _M_cmp);
+          return this->find_within_range(region, out);
+        }
+
+      template <typename _OutputIterator>
+        _OutputIterator
+        find_within_range(_Region_ const& region,
+                          _OutputIterator out) const
+        {
+          for (size_type i = 0; i != _M_buffer.size(); ++i)
+            if (region.encloses(_M_buffer[i]))
+              *out++ = _M_buffer[i];
+          for (size_type l = 0; l != _M_levels.size(); ++l)
+            out = _M_levels[l].find_within_range(region, out);
+          return out;
+        }
+
+      template <class SearchVal>
+      std::pair<const_iterator, distance_type>
+      find_nearest(SearchVal const& __val) const
+      {
+        if (empty())
+          return std::pair<const_iterator, distance_type>(end(), 0);
+        // any value bounds the search, and is found again
+        return find_nearest_if(__val, _Dist_traits::to_distance
+                                 (_M_distance(*begin(), __val)),
+                               always_true<value_type>());
+      }
+
+      template <class SearchVal>
+      std::pair<const_iterator, distance_type>
+      find_nearest(SearchVal const& __val, distance_type __max) const
+      {
+        return find_nearest_if(__val, __max, always_true<value_type>());
+      }
+
+      template <class SearchVal, class _Predicate>
+      std::pair<const_iterator, distance_type>
+      find_nearest_if(SearchVal const& __val, distance_type __max,
+                      _Predicate __p) const
+      {
+        const_iterator __best = end();
+        // the buffer compares sums of _Dist, see distance_traits
+        distance_type __max_sum = _Dist_traits::from_distance(__max);
+        for (size_type __i = 0; __i != _M_buffer.size(); ++__i)
+          {
+            distance_type const __d = _M_distance(_M_buffer[__i], __val);
+            if (__d <= __max_sum && __p(_M_buffer[__i]))
+              {
+                __best = const_iterator(this, 0, __i);
+                __max_sum = __d;
+              }
+          }
+        if (__best != end())
+          __max = _Dist_traits::to_distance(__max_sum);
+        // each tree only looks for values nearer than the best so far
+        for (size_type __l = 0; __l != _M_levels.size(); ++__l)
+          {
+            std::pair<typename _Tree::const_iterator, distance_type> const
+              __found = _M_levels[__l].find_nearest_if(__val, __max, __p);
+            if (__found.first != _M_levels[__l].end())
+              {
+                __best = const_iterator(this, __l + 1,
+                                        __found.first - _M_levels[__l].begin());
+                __max = __found.second;
+              }
+          }
+        return std::pair<const_iterator, distance_type>(__best, __max);
+      }
+
+    protected:
+
+      // Merges the full buffer and the trees in front of the first empty
+      // one into that tree.  Nothing changes if an exception is thrown.
+      void
+      _M_carry()
+      {
+        size_type __j = 0;
+        while (__j != _M_levels.size() && !_M_levels[__j].empty())
+          ++__j;
+        size_type __n = _M_buffer.size();
+        for (size_type __l = 0; __l != __j; ++__l)
+          __n += _M_levels[__l].size();
+        _Storage __values(_M_buffer.get_allocator());
+        __values.reserve(__n);
+        __values.insert(__values.end(), _M_buffer.begin(), _M_buffer.end());
+        for (size_type __l = 0; __l != __j; ++__l)
+          __values.insert(__values.end(),
+                          _M_levels[__l].begin(), _M_levels[__l].end());
+        _Tree __tree(_M_acc, _M_dist, _M_cmp, _M_buffer.get_allocator());
+        __tree.efficient_replace_and_optimise(__values);
+        if (__j == _M_levels.size())
+          {
+            // grow by swapping, a reallocation would copy the trees
+            std::vector<_Tree> __levels(__j + 1,
+                                        _Tree(_M_acc, _M_dist, _M_cmp,
+                                              _M_buffer.get_allocator()));
+            for (size_type __l = 0; __l != __j; ++__l)
+              __levels[__l].swap(_M_levels[__l]);
+            _M_levels.swap(__levels);
+          }
+        _M_levels[__j].swap(__tree);
+        for (size_type __l = 0; __l != __j; ++__l)
+          _M_levels[__l].clear();
+        _M_buffer.clear();
+      }
+
+      size_type
+      _M_level_size(size_type const __level) const
+      {
+        return __level ? _M_levels[__level - 1].size() : _M_buffer.size();
+      }
+
+      const_reference
+      _M_value(size_type const __level, size_type const __pos) const
+      {
+        return __level ? _M_levels[__level - 1].begin()[__pos]
+                       : _M_buffer[__pos];
+      }
+
+      template <class SearchVal>
+      bool
+      _M_matches(const_reference __V, SearchVal const& __W) const
+      {
+        for (size_type __dim = 0; __dim != __K; ++__dim)
+          if (_M_cmp(_M_acc(__V, __dim), _M_acc(__W, __dim))
+              || _M_cmp(_M_acc(__W, __dim), _M_acc(__V, __dim)))
+            return false;
+        return true;
+      }
+
+      template <class SearchVal>
+      distance_type
+      _M_distance(const_reference __V, SearchVal const& __W) const
+      {
+        distance_type __d = 0;
+        for (size_type __dim = 0; __dim != __K; ++__dim)
+          __d += _M_dist(_M_acc(__V, __dim), _M_acc(__W, __dim));
+        return __d;
+      }
+
+      _Storage _M_buffer;
+      std::vector<_Tree> _M_levels;
+      size_type _M_count;
+      _Acc _M_acc;
+      _Cmp _M_cmp;
+      _Dist _M_dist;
+    };
+
+} // namespace KDTree
+
+#endif // include guard
+
+/* COPYRIGHT --
+ *
+ * This file is part of libkdtree++, a C++ template KD-Tree sorting container.
+ * libkdtree++ is (c) 2004-2007 Martin F. Krafft <libkdtree@pobox.madduck.net>
+ * and Sylvain Bougerel <sylvain.bougerel.devel@gmail.com> distributed under the
+ * terms of the Artistic License 2.0. See the ./COPYING file in the source tree
+ * root for more information.
+ *
+ * THIS PACKAGE IS PROVIDED "AS IS" AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES
+ * OF MERCHANTIBILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
@@ -8,7 +8,9 @@
 #ifndef INCLUDE_KDTREE_ACCESSOR_HPP
 #define INCLUDE_KDTREE_ACCESSOR_HPP
 
+#include <cmath>
 #include <cstddef>
+#include <limits>
 
 namespace KDTree
 {
@@ -71,6 +73,39 @@ namespace KDTree
     mutable long _M_count;
   };
 
+  /*! How the sums of _Dist over the dimensions become the distances that
+      the searches take and report, and back.
+
+      The nearest neighbour searches compare the sums themselves, and only
+      convert the distance given to them and the one they report.  The
+      default takes the square root, as needed for squared_difference;
+      specialise it for a _Dist whose sums are the distances already.
+      to_distance() must be increasing.
+   */
+  template <typename _Dist>
+  struct distance_traits
+  {
+    typedef typename _Dist::distance_type distance_type;
+
+    static distance_type
+    to_distance(distance_type const __sum)
+    {
+      return std::sqrt(__sum);
+    }
+
+    // saturates instead of overflowing, and rounds up by a few ulps so
+    // that the values reported at __d, rounded, are still found at __d
+    static distance_type
+    from_distance(distance_type const __d)
+    {
+      typedef std::numeric_limits<distance_type> _Limits;
+      if (__d > to_distance(_Limits::max() / 2))
+        return _Limits::max();
+      distance_type const __sum = __d * __d;
+      return __sum + __sum * 4 * _Limits::epsilon();
+    }
+  };
+
 } // namespace KDTree
 
 #endif // include guard
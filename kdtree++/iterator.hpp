@@ -57,8 +57,23 @@ namespace KDTree
     inline _Base_iterator(_Base_iterator const& __THAT)
       : _M_node(__THAT._M_node) {}
 
+    // both skip the dead nodes, see _Node_base::_M_dead
     inline void
     _M_increment()
+    {
+      do _M_step_forward();
+      while (_M_node->_M_dead);
+    }
+
+    inline void
+    _M_decrement()
+    {
+      do _M_step_backward();
+      while (_M_node->_M_dead);
+    }
+
+    inline void
+    _M_step_forward()
     {
       if (_M_node->_M_right)
       {
@@ -80,7 +95,7 @@ namespace KDTree
     }
 
     inline void
-    _M_decrement()
+    _M_step_backward()
     {
       if (!_M_node->_M_parent) // clearly identify the header node
 	{
@@ -107,7 +122,8 @@ namespace KDTree
     }
 
     template <size_t const __K, typename _Val, typename _Acc,
-	      typename _Dist, typename _Cmp, typename _Alloc>
+	      typename _Dist, typename _Cmp, typename _Alloc, typename _Split,
+	      typename _Aggregate>
       friend class KDTree;
   };
 
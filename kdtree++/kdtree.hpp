@@ -68,6 +68,11 @@
 #endif
 #include <algorithm>
 #include <functional>
+#include <iterator>
+#include <limits>
+#if __cplusplus >= 201103L
+#  include <utility>
+#endif
 
 #ifdef KDTREE_DEFINE_OSTREAM_OPERATORS
 #  include <ostream>
@@ -82,7 +87,10 @@
 #include "allocator.hpp"
 #include "iterator.hpp"
 #include "node.hpp"
+#include "parallel.hpp"
+#include "periodic.hpp"
 #include "region.hpp"
+#include "split.hpp"
 
 namespace KDTree
 {
@@ -96,23 +104,31 @@ namespace KDTree
 	    typename _Dist = squared_difference<typename _Acc::result_type,
 						typename _Acc::result_type>,
             typename _Cmp = std::less<typename _Acc::result_type>,
-            typename _Alloc = std::allocator<_Node<_Val> > >
-    class KDTree : protected _Alloc_base<_Val, _Alloc>
+            typename _Alloc = std::allocator<_Node<_Val> >,
+            typename _Split = cyclic_split,
+            typename _Aggregate = no_aggregate>
+    class KDTree
+      : protected _Alloc_base<_Val, _Alloc,
+                              typename _Node_aggregate<_Val, _Aggregate>::_Node_type>
     {
     protected:
-      typedef _Alloc_base<_Val, _Alloc> _Base;
+      typedef _Node_aggregate<_Val, _Aggregate> _Node_aggregate_;
+      typedef typename _Node_aggregate_::_Node_type _Node_;
+      typedef _Alloc_base<_Val, _Alloc, _Node_> _Base;
       typedef typename _Base::allocator_type allocator_type;
 
       typedef _Node_base* _Base_ptr;
       typedef _Node_base const* _Base_const_ptr;
-      typedef _Node<_Val>* _Link_type;
-      typedef _Node<_Val> const* _Link_const_type;
+      typedef _Node_* _Link_type;
+      typedef _Node_ const* _Link_const_type;
 
       typedef _Node_compare<_Val, _Acc, _Cmp> _Node_compare_;
+      typedef distance_traits<_Dist> _Dist_traits;
 
     public:
       typedef _Region<__K, _Val, typename _Acc::result_type, _Acc, _Cmp>
         _Region_;
+      typedef periodic_box<__K, typename _Acc::result_type> periodic_box_type;
       typedef _Val value_type;
       typedef value_type* pointer;
       typedef value_type const* const_pointer;
@@ -120,20 +136,25 @@ namespace KDTree
       typedef value_type const& const_reference;
       typedef typename _Acc::result_type subvalue_type;
       typedef typename _Dist::distance_type distance_type;
+      //! What aggregate_within_range() returns, void without _Aggregate.
+      typedef typename _Node_aggregate_::aggregate_type aggregate_type;
       typedef size_t size_type;
       typedef ptrdiff_t difference_type;
 
       KDTree(_Acc const& __acc = _Acc(), _Dist const& __dist = _Dist(),
 	     _Cmp const& __cmp = _Cmp(), const allocator_type& __a = allocator_type())
         : _Base(__a), _M_header(),
-	  _M_count(0), _M_acc(__acc), _M_cmp(__cmp), _M_dist(__dist)
+	  _M_count(0), _M_acc(__acc), _M_cmp(__cmp), _M_dist(__dist),
+	  _M_alpha(0), _M_max_count(0), _M_max_dead(0), _M_dead_count(0)
       {
          _M_empty_initialise();
       }
 
       KDTree(const KDTree& __x)
          : _Base(__x.get_allocator()), _M_header(), _M_count(0),
-	   _M_acc(__x._M_acc), _M_cmp(__x._M_cmp), _M_dist(__x._M_dist)
+	   _M_acc(__x._M_acc), _M_cmp(__x._M_cmp), _M_dist(__x._M_dist),
+	   _M_alpha(__x._M_alpha), _M_max_count(0),
+	   _M_max_dead(__x._M_max_dead), _M_dead_count(0)
       {
          _M_empty_initialise();
          // this is slow:
@@ -147,7 +168,7 @@ namespace KDTree
          std::vector<value_type> temp;
          temp.reserve(__x.size());
          std::copy(__x.begin(),__x.end(),std::back_inserter(temp));
-         _M_optimise(temp.begin(), temp.end(), 0);
+         _M_optimise_consume(temp.begin(), temp.end(), 0);
       }
 
       template<typename _InputIterator>
@@ -155,7 +176,8 @@ namespace KDTree
 	       _Acc const& acc = _Acc(), _Dist const& __dist = _Dist(),
 	       _Cmp const& __cmp = _Cmp(), const allocator_type& __a = allocator_type())
         : _Base(__a), _M_header(), _M_count(0),
-	  _M_acc(acc), _M_cmp(__cmp), _M_dist(__dist)
+	  _M_acc(acc), _M_cmp(__cmp), _M_dist(__dist),
+	  _M_alpha(0), _M_max_count(0), _M_max_dead(0), _M_dead_count(0)
       {
          _M_empty_initialise();
          // this is slow:
@@ -169,7 +191,7 @@ namespace KDTree
          std::vector<value_type> temp;
          temp.reserve(std::distance(__first,__last));
          std::copy(__first,__last,std::back_inserter(temp));
-         _M_optimise(temp.begin(), temp.end(), 0);
+         _M_optimise_consume(temp.begin(), temp.end(), 0);
 
          // NOTE: this will BREAK users that are passing in
          // read-once data via the iterator...
@@ -195,6 +217,46 @@ namespace KDTree
          _M_optimise(writable_vector.begin(), writable_vector.end(), 0);
       }
 
+#if __cplusplus >= 201103L
+      // as above, but the values are moved into the tree and
+      // 'consumed_vector' is left empty.
+      void efficient_replace_and_optimise( std::vector<value_type> && consumed_vector )
+      {
+         this->clear();
+         _M_optimise_consume(consumed_vector.begin(), consumed_vector.end(), 0);
+         consumed_vector.clear();
+      }
+
+      // O(1): takes the nodes of __x, which is left empty.
+      KDTree(KDTree&& __x)
+         : _Base(__x.get_allocator()), _M_header(), _M_count(0),
+	   _M_acc(__x._M_acc), _M_cmp(__x._M_cmp), _M_dist(__x._M_dist),
+	   _M_alpha(__x._M_alpha), _M_max_count(0),
+	   _M_max_dead(__x._M_max_dead), _M_dead_count(0)
+      {
+         _M_empty_initialise();
+         _M_steal(__x);
+      }
+
+      KDTree&
+      operator=(KDTree&& __x)
+      {
+	if (this != &__x)
+	  {
+	    this->clear();
+	    _M_acc = __x._M_acc;
+	    _M_dist = __x._M_dist;
+	    _M_alpha = __x._M_alpha;
+	    _M_max_dead = __x._M_max_dead;
+	    _M_cmp = __x._M_cmp;
+	    // the nodes go on being freed by the allocator of __x
+	    _Base::_M_node_allocator = __x._M_node_allocator;
+	    _M_steal(__x);
+	  }
+	return *this;
+      }
+#endif
+
 
 
       KDTree&
@@ -204,6 +266,8 @@ namespace KDTree
 	  {
 	    _M_acc = __x._M_acc;
 	    _M_dist = __x._M_dist;
+	    _M_alpha = __x._M_alpha;
+	    _M_max_dead = __x._M_max_dead;
 	    _M_cmp = __x._M_cmp;
          // this is slow:
          // this->insert(begin(), __x.begin(), __x.end());
@@ -216,7 +280,8 @@ namespace KDTree
          std::vector<value_type> temp;
          temp.reserve(__x.size());
          std::copy(__x.begin(),__x.end(),std::back_inserter(temp));
-         efficient_replace_and_optimise(temp);
+         this->clear();
+         _M_optimise_consume(temp.begin(), temp.end(), 0);
 	  }
 	return *this;
       }
@@ -253,11 +318,72 @@ namespace KDTree
       void
       clear()
       {
-        _M_erase_subtree(_M_get_root());
+        if (_Base::_M_owns_pool())
+          {
+            // give back the memory of all the nodes at once
+            if (!_Base::_S_trivial_node())
+              _M_destroy_subtree(_M_get_root());
+            _Base::_M_release_pool();
+          }
+        else
+          _M_erase_subtree(_M_get_root());
         _M_set_leftmost(&_M_header);
         _M_set_rightmost(&_M_header);
         _M_set_root(NULL);
         _M_count = 0;
+        _M_max_count = 0;
+        _M_dead_count = 0;
+      }
+
+      /*! \brief Keep the tree balanced in insert() and erase().
+
+	With 0.5 < __alpha < 1, insert() rebuilds the smallest subtree holding
+	more than __alpha times the values of its parent's subtree on the path
+	of a new node that went deeper than log(n) / log(1 / __alpha), and
+	erase() rebuilds the whole tree once it has shrunk to __alpha times
+	its largest size (scapegoat trees).  The depth of the tree then stays
+	in O(log n).  The nodes are relinked, not copied, so iterators stay
+	valid.  The default, 0, turns this off: the tree is only rebalanced by
+	optimise().
+       */
+      void
+      set_balance(double const __alpha)
+      {
+        _M_alpha = __alpha;
+        _M_max_count = _M_count;
+      }
+
+      double
+      balance() const
+      { return _M_alpha; }
+
+      /*! \brief Let erase() only mark the nodes as dead.
+
+	With 0 < __max_dead < 1, erase() leaves the node in the tree, marked
+	dead, instead of looking for a replacement in its subtrees.  The
+	iterators and the searches skip the dead nodes, and the tree is
+	compacted, which frees them, once they are more than __max_dead of
+	all its nodes.  The default, 0, erases the nodes right away.
+       */
+      void
+      set_lazy_erase(double const __max_dead)
+      {
+        _M_max_dead = __max_dead;
+        if (!_M_lazy_erase())
+          this->compact();
+      }
+
+      double
+      lazy_erase() const
+      { return _M_max_dead; }
+
+      //! Frees the nodes erased lazily, and balances the tree.
+      void
+      compact()
+      {
+        if (!_M_dead_count) return;
+        _M_rebalance_subtree(&_M_header, &_M_root, 0);
+        _M_max_count = _M_count;
       }
 
       /*! \brief Comparator for the values in the KDTree.
@@ -302,7 +428,14 @@ namespace KDTree
       // Note: the static_cast in end() is invalid (_M_header is not convertable to a _Link_type), but
       // thats ok as it just means undefined behaviour if the user dereferences the end() iterator.
 
-      const_iterator begin() const { return const_iterator(_M_get_leftmost()); }
+      const_iterator
+      begin() const
+      {
+        const_iterator __it(_M_get_leftmost());
+        if (_M_get_leftmost()->_M_dead) ++__it;
+        return __it;
+      }
+
       const_iterator end() const { return const_iterator(static_cast<_Link_const_type>(&_M_header)); }
       const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
       const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
@@ -316,22 +449,42 @@ namespace KDTree
       iterator
       insert(const_reference __V)
       {
-        if (!_M_get_root())
-          {
-            _Link_type __n = _M_new_node(__V, &_M_header);
-            ++_M_count;
-            _M_set_root(__n);
-            _M_set_leftmost(__n);
-            _M_set_rightmost(__n);
-            return iterator(__n);
-          }
-        return _M_insert(_M_get_root(), __V, 0);
+        return _M_insert(_M_new_node(__V, 0));
+      }
+
+#if __cplusplus >= 201103L
+      iterator
+      insert(value_type&& __V)
+      {
+        return _M_insert(_M_new_node(std::move(__V), 0));
       }
 
+      iterator
+      insert(iterator /* ignored */, value_type&& __V)
+      {
+        return this->insert(std::move(__V));
+      }
+
+      // constructs the value in its node from __args
+      template <typename... _Args>
+        iterator
+        emplace(_Args&&... __args)
+        {
+          typename _Base::NoLeakAlloc noleak(this);
+          _Link_type new_node = noleak.get();
+          _Base::_M_emplace_node(new_node, std::forward<_Args>(__args)...);
+          noleak.disconnect();
+          return _M_insert(new_node);
+        }
+#endif
+
+      // Inserts the values in one go: each subtree receiving about as many
+      // new values as it holds is rebuilt balanced with them, and the new
+      // values falling off the leaves make balanced subtrees of their own.
       template <class _InputIterator>
       void insert(_InputIterator __first, _InputIterator __last) {
-         for (; __first != __last; ++__first)
-            this->insert(*__first);
+         std::vector<value_type> __batch(__first, __last);
+         _M_insert_batch(__batch.begin(), __batch.end());
       }
 
       void
@@ -343,9 +496,8 @@ namespace KDTree
 
       template<typename _InputIterator>
       void
-      insert(iterator __pos, _InputIterator __first, _InputIterator __last) {
-         for (; __first != __last; ++__first)
-            this->insert(__pos, *__first);
+      insert(iterator /* ignored */, _InputIterator __first, _InputIterator __last) {
+         this->insert(__first, __last);
       }
 
       // Note: this uses the find() to location the item you want to erase.
@@ -374,31 +526,76 @@ namespace KDTree
       erase(const_iterator const& __IT)
       {
          assert(__IT != this->end());
-        _Link_const_type target = __IT.get_raw_node();
-        _Link_const_type n = target;
-        size_type level = 0;
-        while ((n = _S_parent(n)) != &_M_header)
-           ++level;
-        _M_erase( const_cast<_Link_type>(target), level );
+        _Link_const_type target
+          = static_cast<_Link_const_type>(__IT.get_raw_node());
+        if (_M_lazy_erase())
+          {
+            _M_mark_dead(const_cast<_Link_type>(target));
+            _M_compact_if_needed();
+            return;
+          }
+        _M_erase( const_cast<_Link_type>(target) );
         _M_delete_node( const_cast<_Link_type>(target) );
         --_M_count;
+        if (_M_balanced() && _M_count < _M_alpha * _M_max_count)
+          {
+            _M_rebalance_subtree(&_M_header, &_M_root, 0);
+            _M_max_count = _M_count;
+          }
       }
 
-/* this does not work since erasure changes sort order
+      // Erasing the nodes one by one would move the nodes around, and
+      // change the order of iteration on the way.  Instead the nodes of
+      // [__A,__B) are only marked dead, then each subtree holding any is
+      // rebuilt once from the other nodes.  The iterators on the nodes left
+      // stay valid.
       void
       erase(const_iterator __A, const_iterator const& __B)
       {
-        if (0 && __A == this->begin() && __B == this->end())
+        if (__A == this->begin() && __B == this->end())
           {
             this->clear();
+            return;
           }
-        else
+        while (__A != __B)
           {
-            while (__A != __B)
-              this->erase(__A++);
+            _Link_type const __N = const_cast<_Link_type>
+              (static_cast<_Link_const_type>(__A.get_raw_node()));
+            ++__A;
+            _M_mark_dead(__N);
           }
+        if (_M_lazy_erase())
+          _M_compact_if_needed();
+        else
+          _M_erase_matching(_Match_none());
+      }
+
+      /*! \brief Erase all the values satisfying __pred in one pass.
+
+	Each subtree holding values to erase is rebuilt once from its other
+	nodes, so the iterators on the values left stay valid.  Returns the
+	number of values erased.
+       */
+      template <class _Predicate>
+        size_type
+        erase_if(_Predicate __pred)
+        {
+          return _M_erase_matching(_Match_if<_Predicate>(__pred));
+        }
+
+      //! Erase all the values within __REGION, see erase_if().
+      size_type
+      erase_within_range(_Region_ const& __REGION)
+      {
+        return _M_erase_matching(_Match_region(__REGION));
+      }
+
+      // NOTE: see notes on find_within_range().
+      size_type
+      erase_within_range(const_reference __V, subvalue_type const __R)
+      {
+        return this->erase_within_range(_Region_(__V, __R, _M_acc, _M_cmp));
       }
-*/
 
       // compares via equivalence
       // so if you are looking for any item with the same location,
@@ -409,7 +606,7 @@ namespace KDTree
       find(SearchVal const& __V) const
       {
         if (!_M_get_root()) return this->end();
-        return _M_find(_M_get_root(), __V, 0);
+        return _M_find(_M_get_root(), __V);
       }
 
       // compares via equality
@@ -431,7 +628,7 @@ namespace KDTree
       find_exact(SearchVal const& __V) const
       {
         if (!_M_get_root()) return this->end();
-        return _M_find_exact(_M_get_root(), __V, 0);
+        return _M_find_exact(_M_get_root(), __V);
       }
 
       // NOTE: see notes on find_within_range().
@@ -447,10 +644,10 @@ namespace KDTree
         count_within_range(_Region_ const& __REGION) const
         {
           if (!_M_get_root()) return 0;
-
-          _Region_ __bounds(__REGION);
-          return _M_count_within_range(_M_get_root(),
-                               __REGION, __bounds, 0);
+          _Count_visitor __count;
+          _M_walk_within_range(__count, __REGION,
+                               _Whole_tag<_Node_aggregate_::_S_sized>());
+          return __count._M_count;
         }
 
       // NOTE: see notes on find_within_range().
@@ -468,13 +665,92 @@ namespace KDTree
         visit_within_range(_Region_ const& REGION, Visitor visitor) const
         {
           if (_M_get_root())
-            {
-              _Region_ bounds(REGION);
-              return _M_visit_within_range(visitor, _M_get_root(), REGION, bounds, 0);
-            }
+            return _M_visit_within_range(visitor, REGION);
           return visitor;
         }
 
+      /*! \brief Visit the values within __REGION, a whole subtree at a time
+	where the cell of the subtree lies within __REGION.
+
+	__visitor(__V) is called for each value found alone, and
+	__visitor(__first, __last, __n) for the __n values of [__first,
+	__last), the values of such a subtree, which are not tested one by
+	one.  The visitor gets each value once, in no particular order.  This
+	is how count_within_range() counts, from the number of values kept
+	in each node, so that a query covering a dense area costs about as
+	much as its boundary rather than its contents.  Only the nodes of a
+	tree whose _Aggregate is subtree_sizes, or an aggregate, keep these
+	numbers; in other trees every value is given to __visitor(__V).
+       */
+      template <class Visitor>
+        Visitor
+        visit_subtrees_within_range(_Region_ const& __REGION,
+                                    Visitor __visitor) const
+        {
+          if (!_M_get_root()) return __visitor;
+          _Subtree_visitor<Visitor> __subtrees(__visitor);
+          _M_walk_within_range(__subtrees, __REGION,
+                               _Whole_tag<_Node_aggregate_::_S_sized>());
+          return __subtrees._M_visitor;
+        }
+
+      // NOTE: see notes on find_within_range().
+      template <typename SearchVal, class Visitor>
+        Visitor
+        visit_subtrees_within_range(SearchVal const& __V,
+                                    subvalue_type const __R,
+                                    Visitor __visitor) const
+        {
+          if (!_M_get_root()) return __visitor;
+          return this->visit_subtrees_within_range
+            (_Region_(__V, __R, _M_acc, _M_cmp), __visitor);
+        }
+
+      /*! \brief Combine the values within __REGION under the _Aggregate
+	policy of the tree.
+
+	_Aggregate, the last template parameter of KDTree, gives the type
+	aggregate_type and three static functions:
+
+	  aggregate_type identity();
+	  aggregate_type lift(value_type const&);
+	  aggregate_type combine(aggregate_type const&, aggregate_type const&);
+
+	where combine() is associative and commutative, with identity() as
+	neutral element, such as a sum of weights, a minimum or a maximum.
+	Each node then keeps the aggregate of the live values of its subtree,
+	updated by every change to the tree, and a subtree whose cell lies
+	within __REGION is combined at once, as count_within_range() counts
+	it.  An empty region gives identity().
+       */
+      aggregate_type
+      aggregate_within_range(_Region_ const& __REGION) const
+      {
+        _Aggregate_visitor __visitor;
+        if (_M_get_root())
+          _M_walk_within_range(__visitor, __REGION, _Whole_tag<true>());
+        return __visitor._M_aggregate;
+      }
+
+      // NOTE: see notes on find_within_range().
+      template <typename SearchVal>
+        aggregate_type
+        aggregate_within_range(SearchVal const& __V,
+                               subvalue_type const __R) const
+        {
+          if (!_M_get_root()) return _Aggregate::identity();
+          return this->aggregate_within_range
+            (_Region_(__V, __R, _M_acc, _M_cmp));
+        }
+
+      //! The aggregate of all the values, see aggregate_within_range().
+      aggregate_type
+      aggregate() const
+      {
+        if (!_M_get_root()) return _Aggregate::identity();
+        return _M_get_root()->_M_aggregate;
+      }
+
       // NOTE: this will visit points based on 'Manhattan distance' aka city-block distance
       // aka taxicab metric. Meaning it will find all points within:
       //    max(x_dist,max(y_dist,z_dist));
@@ -501,11 +777,8 @@ namespace KDTree
                           _OutputIterator out) const
         {
           if (_M_get_root())
-            {
-              _Region_ bounds(region);
-              out = _M_find_within_range(out, _M_get_root(),
-                                   region, bounds, 0);
-            }
+            out = _M_visit_within_range(_Output_visitor<_OutputIterator>(out),
+                                        region)._M_out;
           return out;
         }
 
@@ -513,18 +786,21 @@ namespace KDTree
       std::pair<const_iterator, distance_type>
       find_nearest (SearchVal const& __val) const
       {
-	if (_M_get_root())
+	if (_M_count)
 	  {
-	    std::pair<const _Node<_Val>*,
-	      std::pair<size_type, typename _Acc::result_type> >
+	    // a dead root cannot be the answer, start from a live node
+	    _Link_const_type start = _M_get_root();
+	    if (start->_M_dead)
+	      start = static_cast<_Link_const_type>(begin().get_raw_node());
+	    std::pair<_Link_const_type, std::pair<size_type, distance_type> >
 	      best = _S_node_nearest (__K, 0, __val,
-				      _M_get_root(), &_M_header, _M_get_root(),
-				      std::sqrt(_S_accumulate_node_distance
-				      (__K, _M_dist, _M_acc, _M_get_root()->_M_value, __val)),
+				      _M_get_root(), &_M_header, start,
+				      _S_accumulate_node_distance
+				      (__K, _M_dist, _M_acc, start->_M_value, __val),
 				      _M_cmp, _M_acc, _M_dist,
 				      always_true<value_type>());
 	    return std::pair<const_iterator, distance_type>
-	      (best.first, best.second.second);
+	      (best.first, _Dist_traits::to_distance(best.second.second));
 	  }
 	  return std::pair<const_iterator, distance_type>(end(), 0);
       }
@@ -536,25 +812,26 @@ namespace KDTree
 	if (_M_get_root())
 	  {
         bool root_is_candidate = false;
-	    const _Node<_Val>* node = _M_get_root();
+	    _Link_const_type node = _M_get_root();
+	    // compared as sums of _Dist, see distance_traits
+	    distance_type max_sum = _Dist_traits::from_distance(__max);
        { // scope to ensure we don't use 'root_dist' anywhere else
-	    distance_type root_dist = std::sqrt(_S_accumulate_node_distance
-	      (__K, _M_dist, _M_acc, _M_get_root()->_M_value, __val));
-	    if (root_dist <= __max)
+	    distance_type root_dist = _S_accumulate_node_distance
+	      (__K, _M_dist, _M_acc, _M_get_root()->_M_value, __val);
+	    if (root_dist <= max_sum && !node->_M_dead)
 	      {
             root_is_candidate = true;
-            __max = root_dist;
+            max_sum = root_dist;
 	      }
        }
-	    std::pair<const _Node<_Val>*,
-	      std::pair<size_type, typename _Acc::result_type> >
+	    std::pair<_Link_const_type, std::pair<size_type, distance_type> >
 	      best = _S_node_nearest (__K, 0, __val, _M_get_root(), &_M_header,
-				      node, __max, _M_cmp, _M_acc, _M_dist,
+				      node, max_sum, _M_cmp, _M_acc, _M_dist,
 				      always_true<value_type>());
        // make sure we didn't just get stuck with the root node...
        if (root_is_candidate || best.first != _M_get_root())
           return std::pair<const_iterator, distance_type>
-            (best.first, best.second.second);
+            (best.first, _Dist_traits::to_distance(best.second.second));
 	  }
 	  return std::pair<const_iterator, distance_type>(end(), __max);
       }
@@ -567,29 +844,285 @@ namespace KDTree
 	if (_M_get_root())
 	  {
         bool root_is_candidate = false;
-	    const _Node<_Val>* node = _M_get_root();
-	    if (__p(_M_get_root()->_M_value))
+	    _Link_const_type node = _M_get_root();
+	    // compared as sums of _Dist, see distance_traits
+	    distance_type max_sum = _Dist_traits::from_distance(__max);
+	    if (!node->_M_dead && __p(_M_get_root()->_M_value))
 	      {
             { // scope to ensure we don't use root_dist anywhere else
-	    distance_type root_dist = std::sqrt(_S_accumulate_node_distance
-		  (__K, _M_dist, _M_acc, _M_get_root()->_M_value, __val));
-		if (root_dist <= __max)
+	    distance_type root_dist = _S_accumulate_node_distance
+		  (__K, _M_dist, _M_acc, _M_get_root()->_M_value, __val);
+		if (root_dist <= max_sum)
 		  {
            root_is_candidate = true;
-		    root_dist = __max;
+		    max_sum = root_dist;
 		  }
             }
 	      }
-	    std::pair<const _Node<_Val>*,
-	      std::pair<size_type, typename _Acc::result_type> >
+	    std::pair<_Link_const_type, std::pair<size_type, distance_type> >
 	      best = _S_node_nearest (__K, 0, __val, _M_get_root(), &_M_header,
-				      node, __max, _M_cmp, _M_acc, _M_dist, __p);
+				      node, max_sum, _M_cmp, _M_acc, _M_dist, __p);
        // make sure we didn't just get stuck with the root node...
        if (root_is_candidate || best.first != _M_get_root())
           return std::pair<const_iterator, distance_type>
-            (best.first, best.second.second);
+            (best.first, _Dist_traits::to_distance(best.second.second));
+	  }
+	  return std::pair<const_iterator, distance_type>(end(), __max);
+      }
+
+      /*! \brief Visit the values within distance __r of __val.
+
+	Unlike visit_within_range(), the distance is the one of
+	find_nearest(), measured with _Dist, so only the values inside the
+	ball are visited.  The search keeps, for each dimension, the distance
+	from __val to the cell of the current subtree, and skips a subtree as
+	soon as the sum of these exceeds __r.
+       */
+      template <typename SearchVal, class Visitor>
+        Visitor
+        visit_within_radius(SearchVal const& __val, distance_type const __r,
+                            Visitor __visitor) const
+        {
+          if (!_M_get_root())
+            return __visitor;
+          distance_type __offsets[__K];
+          std::fill(__offsets, __offsets + __K, distance_type());
+          return _M_visit_within_radius(__visitor, _M_get_root(), __val,
+                                        _Dist_traits::from_distance(__r),
+                                        __offsets);
+        }
+
+      //! Copy the values within distance __r of __val to __out.
+      template <typename SearchVal, typename _OutputIterator>
+        _OutputIterator
+        find_within_radius(SearchVal const& __val, distance_type const __r,
+                           _OutputIterator __out) const
+        {
+          return visit_within_radius
+            (__val, __r, _Output_visitor<_OutputIterator>(__out))._M_out;
+        }
+
+      //! Count the values within distance __r of __val.
+      template <typename SearchVal>
+        size_type
+        count_within_radius(SearchVal const& __val,
+                            distance_type const __r) const
+        {
+          return visit_within_radius(__val, __r, _Count_visitor())._M_count;
+        }
+
+      /*! \brief Find the value nearest to __val when the periodic dimensions
+	of __box wrap around.
+
+	The values must lie within __box on its periodic dimensions, __val
+	may lie anywhere.  The distance is the one between nearest images, see
+	periodic_distance().  The images of __val are searched one after the
+	other, starting with the one inside __box, and an image is skipped when
+	the box itself is further from it than the nearest value found so far,
+	which leaves only the images across the nearby boundaries.  Returns
+	(end(), __max) when no value is within __max.
+       */
+      template <class SearchVal>
+      std::pair<const_iterator, distance_type>
+      find_nearest_periodic (SearchVal const& __val,
+			     periodic_box_type const& __box,
+			     distance_type const __max
+			     = std::numeric_limits<distance_type>::max()) const
+      {
+	_Link_const_type __best = NULL;
+	distance_type __best_sum = _Dist_traits::from_distance(__max);
+	if (_M_get_root())
+	  {
+	    _Image __image;
+	    for (size_t __i = 0; __i != __K; ++__i)
+	      __image._M_coords[__i] = __box.wrap(__i, _M_acc(__val, __i));
+	    _M_find_nearest_images(__image, __box, 0, 0, __best, __best_sum);
 	  }
+	if (!__best)
 	  return std::pair<const_iterator, distance_type>(end(), __max);
+	return std::pair<const_iterator, distance_type>
+	  (__best, _Dist_traits::to_distance(__best_sum));
+      }
+
+      //! The distance between the nearest images of __a and __b in __box.
+      template <class SearchVal>
+        distance_type
+        periodic_distance(SearchVal const& __a, const_reference __b,
+                          periodic_box_type const& __box) const
+        {
+          distance_type __sum = 0;
+          for (size_t __i = 0; __i != __K; ++__i)
+            __sum += _M_dist(__box.difference(__i, _M_acc(__a, __i),
+                                              _M_acc(__b, __i)),
+                             subvalue_type());
+          return _Dist_traits::to_distance(__sum);
+        }
+
+      /*! \brief Find the values within __range of __val on each dimension,
+	when the periodic dimensions of __box wrap around.
+
+	As find_within_range(), with the values lying within __box on its
+	periodic dimensions.  The region around __val is cut where it crosses
+	a boundary, and the part beyond is moved to the other side of the box,
+	so the tree is searched with up to 2^k ordinary regions for a region
+	crossing k boundaries.  These do not overlap, so each value is found
+	once.
+       */
+      template <typename SearchVal, typename _OutputIterator>
+        _OutputIterator
+        find_within_range_periodic(SearchVal const& __val,
+                                   subvalue_type const __range,
+                                   periodic_box_type const& __box,
+                                   _OutputIterator __out) const
+        {
+          std::vector<_Region_> __pieces;
+          _M_periodic_regions(__val, __range, __box, __pieces);
+          for (size_type __i = 0; __i != __pieces.size(); ++__i)
+            __out = this->find_within_range(__pieces[__i], __out);
+          return __out;
+        }
+
+      //! As find_within_range_periodic(), counting the values.
+      template <typename SearchVal>
+        size_type
+        count_within_range_periodic(SearchVal const& __val,
+                                    subvalue_type const __range,
+                                    periodic_box_type const& __box) const
+        {
+          std::vector<_Region_> __pieces;
+          _M_periodic_regions(__val, __range, __box, __pieces);
+          size_type __count = 0;
+          for (size_type __i = 0; __i != __pieces.size(); ++__i)
+            __count += this->count_within_range(__pieces[__i]);
+          return __count;
+        }
+
+      //! As find_within_range_periodic(), visiting the values.
+      template <typename SearchVal, class Visitor>
+        Visitor
+        visit_within_range_periodic(SearchVal const& __val,
+                                    subvalue_type const __range,
+                                    periodic_box_type const& __box,
+                                    Visitor __visitor) const
+        {
+          std::vector<_Region_> __pieces;
+          _M_periodic_regions(__val, __range, __box, __pieces);
+          for (size_type __i = 0; __i != __pieces.size(); ++__i)
+            __visitor = this->visit_within_range(__pieces[__i], __visitor);
+          return __visitor;
+        }
+
+      /*! \brief Find the __k values nearest to __val.
+
+	Writes to __out a std::pair<const_iterator, distance_type> for each of
+	them, nearest first.  Fewer are written if the tree holds fewer than
+	__k values.  The candidates are kept in a heap of __k entries, and the
+	search skips every subtree that cannot hold anything nearer than the
+	__k-th candidate found so far.
+       */
+      template <class SearchVal, typename _OutputIterator>
+        _OutputIterator
+        find_k_nearest(SearchVal const& __val, size_type const __k,
+                       _OutputIterator __out) const
+        {
+          return _M_find_k_nearest(__val, __k,
+                                   std::numeric_limits<distance_type>::max(),
+                                   always_true<value_type>(), __out);
+        }
+
+      //! As find_k_nearest(), for the values satisfying __p within __max.
+      template <class SearchVal, class _Predicate, typename _OutputIterator>
+        _OutputIterator
+        find_k_nearest_if(SearchVal const& __val, size_type const __k,
+                          distance_type const __max, _Predicate __p,
+                          _OutputIterator __out) const
+        {
+          return _M_find_k_nearest(__val, __k,
+                                   _Dist_traits::from_distance(__max),
+                                   __p, __out);
+        }
+
+      /*! \brief List, for each value, the other values within __r of it.
+
+	The values are numbered in the order of iteration.  On return,
+	__offsets holds size() + 1 entries, and the neighbours of the i-th
+	value are __neighbours[__offsets[i]] to __neighbours[__offsets[i + 1]
+	- 1], in no particular order.  With __both_ways false, each pair is
+	listed once, among the neighbours of the smaller of its two numbers.
+
+	The distance is measured with _Dist, as for find_nearest().  The
+	values are copied into a balanced tree of small buckets, which is then
+	joined with itself: two nodes further apart than __r are skipped
+	together, and two buckets are compared value by value.  The join runs
+	on several threads when compiled with OpenMP.
+       */
+      void
+      build_neighbour_lists(distance_type const __r,
+                            std::vector<size_type>& __offsets,
+                            std::vector<size_type>& __neighbours,
+                            bool const __both_ways = true) const
+      {
+        _Bucket_tree __t;
+        _M_bucket_tree(__t);
+        size_type const __n = __t._M_index.size();
+        distance_type const __max_sum = _Dist_traits::from_distance(__r);
+
+        // split the join into node pairs that can be joined independently
+        std::vector<_Join_task> __tasks;
+        if (__n)
+          _M_join(__t, __max_sum, _Join_task(1, 0, __n, 1, 0, __n),
+                  &__tasks, NULL);
+        std::vector<std::vector<_Join_pair> > __pairs(__tasks.size());
+        difference_type const __ntasks = __tasks.size();
+        _Parallel_error __error;
+#ifdef KDTREE_PARALLEL
+#       pragma omp parallel for schedule(dynamic) if (__n >= _S_parallel_threshold)
+#endif
+        for (difference_type __i = 0; __i < __ntasks; ++__i)
+          {
+#ifdef KDTREE_PARALLEL
+            try
+              {
+#endif
+                _M_join(__t, __max_sum, __tasks[__i], NULL, &__pairs[__i]);
+#ifdef KDTREE_PARALLEL
+              }
+            catch (...)
+              {
+                __error._M_catch();
+              }
+#endif
+          }
+        __error._M_rethrow();
+
+        __offsets.assign(__n + 1, 0);
+        for (size_type __i = 0; __i != __pairs.size(); ++__i)
+          for (size_type __j = 0; __j != __pairs[__i].size(); ++__j)
+            {
+              size_type const __a = __t._M_index[__pairs[__i][__j].first];
+              size_type const __b = __t._M_index[__pairs[__i][__j].second];
+              ++__offsets[std::min(__a, __b) + 1];
+              if (__both_ways)
+                ++__offsets[std::max(__a, __b) + 1];
+            }
+        for (size_type __i = 0; __i != __n; ++__i)
+          __offsets[__i + 1] += __offsets[__i];
+        __neighbours.resize(__offsets[__n]);
+        std::vector<size_type> __next(__offsets.begin(), __offsets.end() - 1);
+        for (size_type __i = 0; __i != __pairs.size(); ++__i)
+          {
+            for (size_type __j = 0; __j != __pairs[__i].size(); ++__j)
+              {
+                size_type __a = __t._M_index[__pairs[__i][__j].first];
+                size_type __b = __t._M_index[__pairs[__i][__j].second];
+                if (__b < __a)
+                  std::swap(__a, __b);
+                __neighbours[__next[__a]++] = __b;
+                if (__both_ways)
+                  __neighbours[__next[__b]++] = __a;
+              }
+            std::vector<_Join_pair>().swap(__pairs[__i]);
+          }
       }
 
       void
@@ -597,7 +1130,7 @@ namespace KDTree
       {
         std::vector<value_type> __v(this->begin(),this->end());
         this->clear();
-        _M_optimise(__v.begin(), __v.end(), 0);
+        _M_optimise_consume(__v.begin(), __v.end(), 0);
       }
 
       void
@@ -608,43 +1141,63 @@ namespace KDTree
 
       void check_tree()
       {
-         _M_check_node(_M_get_root(),0);
+         _M_check_node(_M_get_root());
       }
 
     protected:
 
-      void _M_check_children( _Link_const_type child, _Link_const_type parent, size_type const level, bool to_the_left )
+      void _M_check_children( _Link_const_type child, _Link_const_type parent, bool to_the_left )
       {
          assert(parent);
          if (child)
          {
-	   _Node_compare_ compare(level % __K, _M_acc, _M_cmp);
+	   _Node_compare_ compare(_S_dim(parent), _M_acc, _M_cmp);
             // REMEMBER! its a <= relationship for BOTH branches
             // for left-case (true), child<=node --> !(node<child)
             // for right-case (false), node<=child --> !(child<node)
             assert(!to_the_left || !compare(parent->_M_value,child->_M_value));  // check the left
             assert(to_the_left || !compare(child->_M_value,parent->_M_value));   // check the right
             // and recurse down the tree, checking everything
-            _M_check_children(_S_left(child),parent,level,to_the_left);
-            _M_check_children(_S_right(child),parent,level,to_the_left);
+            _M_check_children(_S_left(child),parent,to_the_left);
+            _M_check_children(_S_right(child),parent,to_the_left);
          }
       }
 
-      void _M_check_node( _Link_const_type node, size_type const level )
+      void _M_check_node( _Link_const_type node )
       {
          if (node)
          {
-            // (comparing on this level)
+            assert(_S_dim(node) < __K);
+            assert(!_Node_aggregate_::_S_sized
+                   || _Node_aggregate_::_S_size(node)
+                   == size_type(!node->_M_dead)
+                   + (_S_left(node) ? _Node_aggregate_::_S_size(_S_left(node)) : 0)
+                   + (_S_right(node) ? _Node_aggregate_::_S_size(_S_right(node)) : 0));
+            // (comparing on this node's dimension)
             // everything to the left of this node must be smaller than this
-            _M_check_children( _S_left(node), node, level, true );
+            _M_check_children( _S_left(node), node, true );
             // everything to the right of this node must be larger than this
-            _M_check_children( _S_right(node), node, level, false );
+            _M_check_children( _S_right(node), node, false );
 
-            _M_check_node( _S_left(node), level+1 );
-            _M_check_node( _S_right(node), level+1 );
+            _M_check_node( _S_left(node) );
+            _M_check_node( _S_right(node) );
          }
       }
 
+      // sets the leftmost and rightmost nodes again after the tree changed
+      void
+      _M_update_extremes()
+      {
+        if (!_M_root)
+          {
+            _M_set_leftmost(&_M_header);
+            _M_set_rightmost(&_M_header);
+            return;
+          }
+        _M_set_leftmost(_Node_base::_S_minimum(_M_root));
+        _M_set_rightmost(_Node_base::_S_maximum(_M_root));
+      }
+
       void _M_empty_initialise()
       {
         _M_set_leftmost(&_M_header);
@@ -654,100 +1207,976 @@ namespace KDTree
       }
 
       iterator
-      _M_insert_left(_Link_type __N, const_reference __V)
+      _M_insert_left(_Link_type __N, _Link_type __new)
       {
-        _S_set_left(__N, _M_new_node(__V)); ++_M_count;
-        _S_set_parent( _S_left(__N), __N );
+        _S_set_left(__N, __new); ++_M_count;
+        _S_set_parent( __new, __N );
+        _M_update_summaries(__new);
+        _S_set_dim( __new, (_S_dim(__N) + 1) % __K );
         if (__N == _M_get_leftmost())
-           _M_set_leftmost( _S_left(__N) );
-        return iterator(_S_left(__N));
+           _M_set_leftmost( __new );
+        return iterator(__new);
       }
 
       iterator
-      _M_insert_right(_Link_type __N, const_reference __V)
+      _M_insert_right(_Link_type __N, _Link_type __new)
       {
-        _S_set_right(__N, _M_new_node(__V)); ++_M_count;
-        _S_set_parent( _S_right(__N), __N );
+        _S_set_right(__N, __new); ++_M_count;
+        _S_set_parent( __new, __N );
+        _M_update_summaries(__new);
+        _S_set_dim( __new, (_S_dim(__N) + 1) % __K );
         if (__N == _M_get_rightmost())
-           _M_set_rightmost( _S_right(__N) );
-        return iterator(_S_right(__N));
+           _M_set_rightmost( __new );
+        return iterator(__new);
       }
 
+      // Links the new, unlinked node __new where its value belongs.  The
+      // node is deleted if a comparison throws.
       iterator
-      _M_insert(_Link_type __N, const_reference __V,
-             size_type const __L)
+      _M_insert(_Link_type __new)
       {
-        if (_Node_compare_(__L % __K, _M_acc, _M_cmp)(__V, __N->_M_value))
+        _Link_type __N = _M_get_root();
+        if (!__N)
           {
-            if (!_S_left(__N))
-              return _M_insert_left(__N, __V);
-            return _M_insert(_S_left(__N), __V, __L+1);
+            ++_M_count;
+            _S_set_parent(__new, &_M_header);
+            _S_set_dim(__new, 0);
+            _Node_aggregate_::_S_update(__new);
+            _M_set_root(__new);
+            _M_set_leftmost(__new);
+            _M_set_rightmost(__new);
+            return iterator(__new);
           }
-        else
+        try
+          {
+            for (;;)
+              {
+                if (_Node_compare_(_S_dim(__N), _M_acc, _M_cmp)(__new->_M_value, __N->_M_value))
+                  {
+                    if (!_S_left(__N))
+                      {
+                        _M_insert_left(__N, __new);
+                        break;
+                      }
+                    __N = _S_left(__N);
+                  }
+                else
+                  {
+                    if (!_S_right(__N) || __N == _M_get_rightmost())
+                      {
+                        _M_insert_right(__N, __new);
+                        break;
+                      }
+                    __N = _S_right(__N);
+                  }
+              }
+          }
+        catch (...)
           {
-            if (!_S_right(__N) || __N == _M_get_rightmost())
-              return _M_insert_right(__N, __V);
-            return _M_insert(_S_right(__N), __V, __L+1);
+            _M_delete_node(__new);
+            throw;
           }
+        if (_M_balanced())
+          _M_rebalance_after_insert(__new);
+        return iterator(__new);
       }
 
-      _Link_type
-      _M_erase(_Link_type dead_dad, size_type const level)
+      bool
+      _M_balanced() const
       {
-         // find a new step_dad, he will become a drop-in replacement.
-        _Link_type step_dad = _M_get_erase_replacement(dead_dad, level);
-
-         // tell dead_dad's parent that his new child is step_dad
-        if (dead_dad == _M_get_root())
-           _M_set_root(step_dad);
-        else if (_S_left(_S_parent(dead_dad)) == dead_dad)
-            _S_set_left(_S_parent(dead_dad), step_dad);
-        else
-            _S_set_right(_S_parent(dead_dad), step_dad);
+        return _M_alpha > 0.5 && _M_alpha < 1;
+      }
 
-        // deal with the left and right edges of the tree...
-        // if the dead_dad was at the edge, then substitude...
-        // but if there IS no new dead, then left_most is the dead_dad's parent
-         if (dead_dad == _M_get_leftmost())
-           _M_set_leftmost( (step_dad ? step_dad : _S_parent(dead_dad)) );
-         if (dead_dad == _M_get_rightmost())
-           _M_set_rightmost( (step_dad ? step_dad : _S_parent(dead_dad)) );
+      bool
+      _M_lazy_erase() const
+      {
+        return _M_max_dead > 0 && _M_max_dead < 1;
+      }
 
-        if (step_dad)
-          {
-             // step_dad gets dead_dad's parent
-            _S_set_parent(step_dad, _S_parent(dead_dad));
+      void
+      _M_mark_dead(_Link_type const __N)
+      {
+        __N->_M_dead = true;
+        --_M_count;
+        ++_M_dead_count;
+        _M_update_summaries(__N);
+      }
 
-            // first tell the children that step_dad is their new dad
-            if (_S_left(dead_dad))
-               _S_set_parent(_S_left(dead_dad), step_dad);
-            if (_S_right(dead_dad))
-               _S_set_parent(_S_right(dead_dad), step_dad);
+      // Sets the sizes and the aggregates of __N and of all the nodes above
+      // it from those of their children, after the nodes below __N changed.
+      void
+      _M_update_summaries(_Base_ptr __N)
+      {
+        if (!_Node_aggregate_::_S_sized) return;
+        for (; __N != &_M_header; __N = __N->_M_parent)
+          _Node_aggregate_::_S_update(static_cast<_Link_type>(__N));
+      }
 
-            // step_dad gets dead_dad's children
-            _S_set_left(step_dad, _S_left(dead_dad));
-            _S_set_right(step_dad, _S_right(dead_dad));
-          }
+      // Sets the sizes and the aggregates of the subtree __N from the bottom
+      // up, once it was built.
+      static void
+      _S_aggregate_subtree(_Base_ptr const __N)
+      {
+        if (!_Node_aggregate_::_S_sized || !__N) return;
+        _S_aggregate_subtree(__N->_M_left);
+        _S_aggregate_subtree(__N->_M_right);
+        _Node_aggregate_::_S_update(static_cast<_Link_type>(__N));
+      }
 
-        return step_dad;
+      void
+      _M_compact_if_needed()
+      {
+        if (_M_dead_count > _M_max_dead * (_M_count + _M_dead_count))
+          this->compact();
       }
 
+      // What erase_if() and erase_within_range() erase, and where they look.
+      template <class _Predicate>
+        struct _Match_if
+        {
+          _Match_if(_Predicate const& __pred) : _M_pred(__pred) {}
 
+          bool
+          operator()(const_reference __V) const
+          { return _M_pred(__V); }
 
-      _Link_type
-      _M_get_erase_replacement(_Link_type node, size_type const level)
+          bool
+          visits(_Region_ const&) const
+          { return true; }
+
+          _Region_
+          bounds(const_reference __V, _Acc const& __acc, _Cmp const& __cmp) const
+          { return _Region_(__V, __acc, __cmp); }
+
+          mutable _Predicate _M_pred;
+        };
+
+      struct _Match_region
       {
-         // if 'node' is null, then we can't do any better
-        if (_S_is_leaf(node))
-           return NULL;
+        _Match_region(_Region_ const& __region) : _M_region(__region) {}
 
-        std::pair<_Link_type,size_type> candidate;
-        // if there is nothing to the left, find a candidate on the right tree
-        if (!_S_left(node))
-          candidate = _M_get_j_min( std::pair<_Link_type,size_type>(_S_right(node),level), level+1);
-        // ditto for the right
-        else if ((!_S_right(node)))
-          candidate = _M_get_j_max( std::pair<_Link_type,size_type>(_S_left(node),level), level+1);
+        bool
+        operator()(const_reference __V) const
+        { return _M_region.encloses(__V); }
+
+        bool
+        visits(_Region_ const& __bounds) const
+        { return _M_region.intersects_with(__bounds); }
+
+        // starting from __REGION itself, only the bounds tightened on the
+        // way down can miss it
+        _Region_
+        bounds(const_reference, _Acc const&, _Cmp const&) const
+        { return _M_region; }
+
+        _Region_ const& _M_region;
+      };
+
+      // only looks for the nodes already dead
+      struct _Match_none
+      {
+        bool
+        operator()(const_reference) const
+        { return false; }
+
+        bool
+        visits(_Region_ const&) const
+        { return true; }
+
+        _Region_
+        bounds(const_reference __V, _Acc const& __acc, _Cmp const& __cmp) const
+        { return _Region_(__V, __acc, __cmp); }
+      };
+
+      // Erases the values matching __match, and the dead nodes it meets.
+      template <class _Match>
+        size_type
+        _M_erase_matching(_Match const& __match)
+        {
+          if (!_M_get_root()) return 0;
+          _Region_ const __bounds
+            = __match.bounds(_S_value(_M_get_root()), _M_acc, _M_cmp);
+          size_type __erased;
+          if (_M_lazy_erase())
+            {
+              __erased = _M_mark_matching(_M_get_root(), __match, __bounds);
+              _M_compact_if_needed();
+              return __erased;
+            }
+          __erased = _M_erase_matching(&_M_root, __match, __bounds);
+          _M_update_extremes();
+          if (_M_balanced() && _M_count < _M_alpha * _M_max_count)
+            {
+              _M_rebalance_subtree(&_M_header, &_M_root, 0);
+              _M_max_count = _M_count;
+            }
+          return __erased;
+        }
+
+      // __max_sum is a sum of _Dist, see distance_traits
+      template <class SearchVal, class _Predicate, typename _OutputIterator>
+        _OutputIterator
+        _M_find_k_nearest(SearchVal const& __val, size_type const __k,
+                          distance_type const __max_sum, _Predicate __p,
+                          _OutputIterator __out) const
+        {
+          if (!_M_get_root() || !__k) return __out;
+          std::vector<_Candidate> __heap;
+          __heap.reserve(__k < _M_count ? __k : _M_count);
+          _M_find_k_nearest(_M_get_root(), __val, __k, __max_sum, __p, __heap);
+          std::sort_heap(__heap.begin(), __heap.end(), _Candidate_compare());
+          for (size_type __i = 0; __i != __heap.size(); ++__i)
+            *__out++ = std::pair<const_iterator, distance_type>
+              (const_iterator(__heap[__i].second),
+               _Dist_traits::to_distance(__heap[__i].first));
+          return __out;
+        }
+
+      // The live values of a tree, copied into a balanced kd-tree of buckets
+      // laid out in arrays.  The node __h covers a range of positions, its
+      // children are 2 * __h and 2 * __h + 1, and the root is 1.
+      struct _Bucket_tree
+      {
+        // the largest number of values compared one by one
+        static size_type _S_bucket() { return 16; }
+
+        subvalue_type const*
+        low(size_type const __h) const { return &_M_box[__h * 2 * __K]; }
+
+        subvalue_type const*
+        high(size_type const __h) const
+        { return &_M_box[__h * 2 * __K + __K]; }
+
+        // __K coordinates per position
+        std::vector<subvalue_type> _M_coords;
+        // the number in the order of iteration of the value at each position
+        std::vector<size_type> _M_index;
+        // the low then high bounds of the values of each node
+        std::vector<subvalue_type> _M_box;
+      };
+
+      // orders numbers of values on one of their coordinates
+      struct _Coord_compare
+      {
+        _Coord_compare(subvalue_type const* __coords, size_type const __dim,
+                       _Cmp const& __cmp)
+          : _M_coords(__coords), _M_dim(__dim), _M_cmp(__cmp) { }
+
+        bool
+        operator()(size_type const __a, size_type const __b) const
+        {
+          return _M_cmp(_M_coords[__a * __K + _M_dim],
+                        _M_coords[__b * __K + _M_dim]);
+        }
+
+        subvalue_type const* _M_coords;
+        size_type _M_dim;
+        _Cmp _M_cmp;
+      };
+
+      void
+      _M_bucket_tree(_Bucket_tree& __t) const
+      {
+        std::vector<subvalue_type> __coords;
+        __coords.reserve(_M_count * __K);
+        for (const_iterator __i = begin(); __i != end(); ++__i)
+          for (size_type __dim = 0; __dim != __K; ++__dim)
+            __coords.push_back(_M_acc(*__i, __dim));
+        size_type const __n = __coords.size() / __K;
+        __t._M_index.resize(__n);
+        for (size_type __i = 0; __i != __n; ++__i)
+          __t._M_index[__i] = __i;
+        size_type __nodes = 2;
+        while (__nodes * _Bucket_tree::_S_bucket() < 2 * __n)
+          __nodes *= 2;
+        __t._M_box.resize(2 * __nodes * 2 * __K);
+        if (__n)
+          _M_bucket_tree(__t, __coords, 1, 0, __n);
+        __t._M_coords.resize(__n * __K);
+        for (size_type __p = 0; __p != __n; ++__p)
+          std::copy(&__coords[__t._M_index[__p] * __K],
+                    &__coords[__t._M_index[__p] * __K] + __K,
+                    &__t._M_coords[__p * __K]);
+      }
+
+      // Computes the box of the node __h, which covers [__lo, __hi), and
+      // splits it at the median of its widest side.
+      void
+      _M_bucket_tree(_Bucket_tree& __t,
+                     std::vector<subvalue_type> const& __coords,
+                     size_type const __h, size_type const __lo,
+                     size_type const __hi) const
+      {
+        std::vector<size_type>& __index = __t._M_index;
+        subvalue_type* const __low = &__t._M_box[__h * 2 * __K];
+        subvalue_type* const __high = __low + __K;
+        std::copy(&__coords[__index[__lo] * __K],
+                  &__coords[__index[__lo] * __K] + __K, __low);
+        std::copy(__low, __low + __K, __high);
+        for (size_type __i = __lo + 1; __i != __hi; ++__i)
+          for (size_type __dim = 0; __dim != __K; ++__dim)
+            {
+              subvalue_type const __c = __coords[__index[__i] * __K + __dim];
+              if (_M_cmp(__c, __low[__dim])) __low[__dim] = __c;
+              if (_M_cmp(__high[__dim], __c)) __high[__dim] = __c;
+            }
+        if (__hi - __lo <= _Bucket_tree::_S_bucket())
+          return;
+        size_type __dim = 0;
+        for (size_type __d = 1; __d != __K; ++__d)
+          if (_M_cmp(__high[__dim] - __low[__dim], __high[__d] - __low[__d]))
+            __dim = __d;
+        size_type const __mid = __lo + (__hi - __lo) / 2;
+        std::nth_element(__index.begin() + __lo, __index.begin() + __mid,
+                         __index.begin() + __hi,
+                         _Coord_compare(&__coords[0], __dim, _M_cmp));
+        _M_bucket_tree(__t, __coords, 2 * __h, __lo, __mid);
+        _M_bucket_tree(__t, __coords, 2 * __h + 1, __mid, __hi);
+      }
+
+      // the distance between two boxes, as a sum of _Dist
+      distance_type
+      _M_box_distance(subvalue_type const* __low1, subvalue_type const* __high1,
+                      subvalue_type const* __low2,
+                      subvalue_type const* __high2) const
+      {
+        distance_type __d = 0;
+        for (size_type __dim = 0; __dim != __K; ++__dim)
+          if (_M_cmp(__high1[__dim], __low2[__dim]))
+            __d += _M_dist(__high1[__dim], __low2[__dim]);
+          else if (_M_cmp(__high2[__dim], __low1[__dim]))
+            __d += _M_dist(__high2[__dim], __low1[__dim]);
+        return __d;
+      }
+
+      // two nodes of a _Bucket_tree, each with the range it covers
+      struct _Join_task
+      {
+        _Join_task(size_type const __a, size_type const __alo,
+                   size_type const __ahi, size_type const __b,
+                   size_type const __blo, size_type const __bhi)
+          : _M_a(__a), _M_alo(__alo), _M_ahi(__ahi),
+            _M_b(__b), _M_blo(__blo), _M_bhi(__bhi) { }
+
+        size_type _M_a, _M_alo, _M_ahi;
+        size_type _M_b, _M_blo, _M_bhi;
+      };
+
+      typedef std::pair<size_type, size_type> _Join_pair;
+
+      // Above this many values, the nodes of a join are split into tasks.
+      static const size_type _S_join_task = 1 << 12;
+
+      /*! Appends to __pairs the pairs of positions of the node __j._M_a and
+          of the node __j._M_b that are no further apart than __max_sum.
+          The two nodes are either the same or disjoint; the pairs of a node
+          with itself are listed once.
+
+          If __tasks is not NULL, the pairs of nodes small enough to be
+          joined on their own are appended to it instead.
+       */
+      void
+      _M_join(_Bucket_tree const& __t, distance_type const __max_sum,
+              _Join_task const& __j, std::vector<_Join_task>* const __tasks,
+              std::vector<_Join_pair>* const __pairs) const
+      {
+        size_type const __asize = __j._M_ahi - __j._M_alo;
+        size_type const __bsize = __j._M_bhi - __j._M_blo;
+        bool const __same = __j._M_a == __j._M_b;
+        if (!__same
+            && _M_box_distance(__t.low(__j._M_a), __t.high(__j._M_a),
+                               __t.low(__j._M_b), __t.high(__j._M_b))
+               > __max_sum)
+          return;
+        if (__tasks && __asize <= _S_join_task && __bsize <= _S_join_task)
+          {
+            __tasks->push_back(__j);
+            return;
+          }
+        size_type const __bucket = _Bucket_tree::_S_bucket();
+        if (__asize <= __bucket && __bsize <= __bucket)
+          {
+            _M_join_buckets(__t, __max_sum, __j, *__pairs);
+            return;
+          }
+        size_type const __a = __j._M_a, __b = __j._M_b;
+        size_type const __amid = __j._M_alo + __asize / 2;
+        size_type const __bmid = __j._M_blo + __bsize / 2;
+        if (__same)
+          {
+            // both children with themselves, then with each other
+            _Join_task const __left(2 * __a, __j._M_alo, __amid,
+                                    2 * __a, __j._M_alo, __amid);
+            _Join_task const __right(2 * __a + 1, __amid, __j._M_ahi,
+                                     2 * __a + 1, __amid, __j._M_ahi);
+            _M_join(__t, __max_sum, __left, __tasks, __pairs);
+            _M_join(__t, __max_sum, __right, __tasks, __pairs);
+            _M_join(__t, __max_sum,
+                    _Join_task(2 * __a, __j._M_alo, __amid,
+                               2 * __a + 1, __amid, __j._M_ahi),
+                    __tasks, __pairs);
+          }
+        else if (__bsize <= __bucket
+                 || (__asize > __bucket && __asize >= __bsize))
+          {
+            _M_join(__t, __max_sum,
+                    _Join_task(2 * __a, __j._M_alo, __amid,
+                               __b, __j._M_blo, __j._M_bhi),
+                    __tasks, __pairs);
+            _M_join(__t, __max_sum,
+                    _Join_task(2 * __a + 1, __amid, __j._M_ahi,
+                               __b, __j._M_blo, __j._M_bhi),
+                    __tasks, __pairs);
+          }
+        else
+          {
+            _M_join(__t, __max_sum,
+                    _Join_task(__a, __j._M_alo, __j._M_ahi,
+                               2 * __b, __j._M_blo, __bmid),
+                    __tasks, __pairs);
+            _M_join(__t, __max_sum,
+                    _Join_task(__a, __j._M_alo, __j._M_ahi,
+                               2 * __b + 1, __bmid, __j._M_bhi),
+                    __tasks, __pairs);
+          }
+      }
+
+      void
+      _M_join_buckets(_Bucket_tree const& __t, distance_type const __max_sum,
+                      _Join_task const& __j,
+                      std::vector<_Join_pair>& __out) const
+      {
+        bool const __same = __j._M_a == __j._M_b;
+        for (size_type __i = __j._M_alo; __i != __j._M_ahi; ++__i)
+          {
+            subvalue_type const* const __c = &__t._M_coords[__i * __K];
+            for (size_type __k = __same ? __i + 1 : __j._M_blo;
+                 __k != __j._M_bhi; ++__k)
+              {
+                distance_type __d = 0;
+                for (size_type __dim = 0; __dim != __K; ++__dim)
+                  __d += _M_dist(__t._M_coords[__k * __K + __dim], __c[__dim]);
+                if (__d <= __max_sum)
+                  __out.push_back(_Join_pair(__i, __k));
+              }
+          }
+      }
+
+      template <typename _OutputIterator>
+        struct _Output_visitor
+        {
+          _Output_visitor(_OutputIterator const& __out) : _M_out(__out) { }
+
+          void
+          operator()(const_reference __V)
+          { *_M_out++ = __V; }
+
+          _OutputIterator _M_out;
+        };
+
+      struct _Count_visitor
+      {
+        _Count_visitor() : _M_count(0) { }
+
+        void
+        operator()(const_reference)
+        { ++_M_count; }
+
+        // a whole subtree, see _M_walk_within_range()
+        void
+        operator()(_Link_const_type __N)
+        { _M_count += _Node_aggregate_::_S_size(__N); }
+
+        size_type _M_count;
+      };
+
+      struct _Aggregate_visitor
+      {
+        _Aggregate_visitor() : _M_aggregate(_Aggregate::identity()) { }
+
+        void
+        operator()(const_reference __V)
+        {
+          _M_aggregate = _Aggregate::combine(_M_aggregate,
+                                             _Aggregate::lift(__V));
+        }
+
+        // a whole subtree, see _M_walk_within_range()
+        void
+        operator()(_Link_const_type __N)
+        { _M_aggregate = _Aggregate::combine(_M_aggregate, __N->_M_aggregate); }
+
+        aggregate_type _M_aggregate;
+      };
+
+      // gives the subtrees to a visitor as ranges of iterators
+      template <class Visitor>
+        struct _Subtree_visitor
+        {
+          _Subtree_visitor(Visitor const& __visitor)
+            : _M_visitor(__visitor) { }
+
+          void
+          operator()(const_reference __V)
+          { _M_visitor(__V); }
+
+          void
+          operator()(_Link_const_type __N)
+          {
+            _Base_const_ptr __first = __N;
+            while (__first->_M_left) __first = __first->_M_left;
+            _Base_const_ptr __last = __N;
+            while (__last->_M_right) __last = __last->_M_right;
+            const_iterator __begin(static_cast<_Link_const_type>(__first));
+            if (__first->_M_dead) ++__begin;
+            const_iterator __end(static_cast<_Link_const_type>(__last));
+            ++__end;
+            _M_visitor(__begin, __end, _Node_aggregate_::_S_size(__N));
+          }
+
+          Visitor _M_visitor;
+        };
+
+      /*! Visit the values of the subtree __N within __max_sum of __val.
+	__offsets holds, for each dimension, the distance from __val to the
+	cell of __N, which is further than __max_sum from __val as soon as
+	their sum is.  The sum is recomputed rather than updated, so that it
+	never rounds above the distance of a value in the cell.
+       */
+      template <typename SearchVal, class Visitor>
+        Visitor
+        _M_visit_within_radius(Visitor __visitor, _Link_const_type __N,
+                               SearchVal const& __val,
+                               distance_type const __max_sum,
+                               distance_type* __offsets) const
+        {
+          if (!__N->_M_dead
+              && _S_accumulate_node_distance(__K, _M_dist, _M_acc,
+                                             _S_value(__N), __val)
+                 <= __max_sum)
+            __visitor(_S_value(__N));
+
+          size_t const __dim = _S_dim(__N);
+          subvalue_type const __q = _M_acc(__val, __dim);
+          subvalue_type const __s = _M_acc(_S_value(__N), __dim);
+          distance_type const __offset = __offsets[__dim];
+          for (int __side = 0; __side != 2; ++__side)
+            {
+              _Link_const_type const __child
+                = __side ? _S_right(__N) : _S_left(__N);
+              if (!__child)
+                continue;
+              // the plane of __N only bounds the cell on the far side
+              if (__side ? _M_cmp(__q, __s) : _M_cmp(__s, __q))
+                {
+                  __offsets[__dim] = _M_dist(__q, __s);
+                  distance_type __sum = 0;
+                  for (size_t __i = 0; __i != __K; ++__i)
+                    __sum += __offsets[__i];
+                  if (__sum <= __max_sum)
+                    __visitor = _M_visit_within_radius(__visitor, __child,
+                                                       __val, __max_sum,
+                                                       __offsets);
+                  __offsets[__dim] = __offset;
+                }
+              else
+                __visitor = _M_visit_within_radius(__visitor, __child, __val,
+                                                   __max_sum, __offsets);
+            }
+          return __visitor;
+        }
+
+      // an image of a query for the periodic searches, by its coordinates
+      struct _Image
+      {
+        subvalue_type _M_coords[__K];
+      };
+
+      // reads the values through _Acc and the images directly
+      struct _Image_accessor
+      {
+        _Image_accessor(_Acc const& __acc) : _M_acc(__acc) { }
+
+        subvalue_type
+        operator()(const_reference __v, size_t const __i) const
+        { return _M_acc(__v, __i); }
+
+        subvalue_type
+        operator()(_Image const& __q, size_t const __i) const
+        { return __q._M_coords[__i]; }
+
+        _Acc _M_acc;
+      };
+
+      /*! Search every image of __image that may be nearer than __best_sum,
+	shifting it by a period either way on the periodic dimensions from
+	__dim on.  __lower is the distance from the image to the box on the
+	dimensions before __dim.
+       */
+      void
+      _M_find_nearest_images(_Image& __image, periodic_box_type const& __box,
+                             size_t const __dim, distance_type const __lower,
+                             _Link_const_type& __best,
+                             distance_type& __best_sum) const
+      {
+        if (__dim == __K)
+          {
+            _M_find_nearest_image(__image, __best, __best_sum);
+            return;
+          }
+        _M_find_nearest_images(__image, __box, __dim + 1, __lower,
+                               __best, __best_sum);
+        if (!__box.is_periodic(__dim))
+          return;
+
+        subvalue_type const __x = __image._M_coords[__dim];
+        subvalue_type const __p = __box.period(__dim);
+        __image._M_coords[__dim] = __x - __p;
+        distance_type __d = __lower + _M_dist(__x - __p, __box.low(__dim));
+        if (__d <= __best_sum)
+          _M_find_nearest_images(__image, __box, __dim + 1, __d,
+                                 __best, __best_sum);
+        __image._M_coords[__dim] = __x + __p;
+        __d = __lower + _M_dist(__x + __p, __box.high(__dim));
+        if (__d <= __best_sum)
+          _M_find_nearest_images(__image, __box, __dim + 1, __d,
+                                 __best, __best_sum);
+        __image._M_coords[__dim] = __x;
+      }
+
+      // as find_nearest(__image, __best_sum), updating __best if found
+      void
+      _M_find_nearest_image(_Image const& __image, _Link_const_type& __best,
+                            distance_type& __best_sum) const
+      {
+        _Link_const_type const __root = _M_get_root();
+        _Image_accessor const __acc(_M_acc);
+        bool __root_is_candidate = false;
+        distance_type __max_sum = __best_sum;
+        if (!__root->_M_dead)
+          {
+            distance_type const __root_dist = _S_accumulate_node_distance
+              (__K, _M_dist, __acc, __root->_M_value, __image);
+            if (__root_dist <= __max_sum)
+              {
+                __root_is_candidate = true;
+                __max_sum = __root_dist;
+              }
+          }
+        std::pair<_Link_const_type, std::pair<size_type, distance_type> >
+          __found = _S_node_nearest(__K, 0, __image, __root, &_M_header,
+                                    __root, __max_sum, _M_cmp, __acc, _M_dist,
+                                    always_true<value_type>());
+        if (__root_is_candidate || __found.first != __root)
+          {
+            __best = __found.first;
+            __best_sum = __found.second.second;
+          }
+      }
+
+      /*! The regions searched for the values within __range of __val in
+	__box: one region, cut in two along each periodic dimension where it
+	crosses a boundary, or stretched over the whole box where it is at
+	least a period wide.
+       */
+      template <typename SearchVal>
+        void
+        _M_periodic_regions(SearchVal const& __val,
+                            subvalue_type const __range,
+                            periodic_box_type const& __box,
+                            std::vector<_Region_>& __pieces) const
+        {
+          __pieces.assign(1, _Region_(__val, __range, _M_acc, _M_cmp));
+          for (size_t __i = 0; __i != __K; ++__i)
+            {
+              subvalue_type const __x = __box.wrap(__i, _M_acc(__val, __i));
+              subvalue_type __low = __x - __range;
+              subvalue_type __high = __x + __range;
+              // the part beyond a boundary, moved to the other side
+              subvalue_type __wrap_low = __low, __wrap_high = __high;
+              bool __cut = false;
+              if (__box.is_periodic(__i))
+                {
+                  subvalue_type const __p = __box.period(__i);
+                  if (!_M_cmp(__range + __range, __p))
+                    {
+                      __low = __box.low(__i);
+                      __high = __box.high(__i);
+                    }
+                  else if (_M_cmp(__low, __box.low(__i)))
+                    {
+                      __cut = true;
+                      __wrap_low = __low + __p;
+                      __wrap_high = __box.high(__i);
+                      __low = __box.low(__i);
+                    }
+                  else if (!_M_cmp(__high, __box.high(__i)))
+                    {
+                      __cut = true;
+                      __wrap_low = __box.low(__i);
+                      __wrap_high = __high - __p;
+                      __high = __box.high(__i);
+                    }
+                }
+              size_type const __n = __pieces.size();
+              for (size_type __j = 0; __j != __n; ++__j)
+                {
+                  if (__cut)
+                    {
+                      __pieces.push_back(__pieces[__j]);
+                      __pieces.back()._M_low_bounds[__i] = __wrap_low;
+                      __pieces.back()._M_high_bounds[__i] = __wrap_high;
+                    }
+                  __pieces[__j]._M_low_bounds[__i] = __low;
+                  __pieces[__j]._M_high_bounds[__i] = __high;
+                }
+            }
+        }
+
+      typedef std::pair<distance_type, _Link_const_type> _Candidate;
+
+      struct _Candidate_compare
+      {
+        bool
+        operator()(_Candidate const& __a, _Candidate const& __b) const
+        { return __a.first < __b.first; }
+      };
+
+      // Adds to __heap, a max-heap of at most __k candidates, the values
+      // below __N nearer than __max and than the candidates it holds.
+      template <class SearchVal, class _Predicate>
+        void
+        _M_find_k_nearest(_Link_const_type const __N, SearchVal const& __val,
+                          size_type const __k, distance_type const __max,
+                          _Predicate& __p, std::vector<_Candidate>& __heap) const
+        {
+          if (!__N->_M_dead && __p(_S_value(__N)))
+            {
+              distance_type const __d = _S_accumulate_node_distance
+                (__K, _M_dist, _M_acc, _S_value(__N), __val);
+              if (__heap.size() < __k)
+                {
+                  if (__d <= __max)
+                    {
+                      __heap.push_back(_Candidate(__d, __N));
+                      std::push_heap(__heap.begin(), __heap.end(),
+                                     _Candidate_compare());
+                    }
+                }
+              else if (__d < __heap.front().first)
+                {
+                  std::pop_heap(__heap.begin(), __heap.end(),
+                                _Candidate_compare());
+                  __heap.back() = _Candidate(__d, __N);
+                  std::push_heap(__heap.begin(), __heap.end(),
+                                 _Candidate_compare());
+                }
+            }
+          size_type const __dim = _S_dim(__N);
+          _Link_const_type __near = _S_right(__N);
+          _Link_const_type __far = _S_left(__N);
+          if (_S_node_compare(__dim, _M_cmp, _M_acc, __val, _S_value(__N)))
+            std::swap(__near, __far);
+          if (__near)
+            _M_find_k_nearest(__near, __val, __k, __max, __p, __heap);
+          // only visit the far side if its plane is nearer than the bound
+          if (__far)
+            {
+              distance_type const __plane = _S_node_distance
+                (__dim, _M_dist, _M_acc, __val, _S_value(__N));
+              if (__heap.size() < __k ? __plane <= __max
+                                      : __plane < __heap.front().first)
+                _M_find_k_nearest(__far, __val, __k, __max, __p, __heap);
+            }
+        }
+
+      // Rebuilds the highest subtrees below *__link whose root is dead or
+      // matches __match, without the nodes that are dead or match.
+      template <class _Match>
+        size_type
+        _M_erase_matching(_Base_ptr* const __link, _Match const& __match,
+                          _Region_ const& __bounds)
+        {
+          _Link_type const __N = static_cast<_Link_type>(*__link);
+          if (__N->_M_dead || __match(_S_value(__N)))
+            {
+              size_type const __erased
+                = _M_mark_matching(__N, __match, __bounds);
+              _M_rebuild_subtree(__N->_M_parent, __link, _S_dim(__N),
+                                 static_cast<value_type*>(NULL),
+                                 static_cast<value_type*>(NULL));
+              return __erased;
+            }
+          size_type __erased = 0;
+          if (_S_left(__N))
+            {
+              _Region_ __left(__bounds);
+              __left.set_high_bound(_S_value(__N), _S_dim(__N));
+              if (__match.visits(__left))
+                __erased += _M_erase_matching(&__N->_M_left, __match, __left);
+            }
+          if (_S_right(__N))
+            {
+              _Region_ __right(__bounds);
+              __right.set_low_bound(_S_value(__N), _S_dim(__N));
+              if (__match.visits(__right))
+                __erased += _M_erase_matching(&__N->_M_right, __match, __right);
+            }
+          return __erased;
+        }
+
+      // Marks dead the nodes below __N that match __match.
+      template <class _Match>
+        size_type
+        _M_mark_matching(_Link_type const __N, _Match const& __match,
+                         _Region_ const& __bounds)
+        {
+          size_type __marked = 0;
+          if (!__N->_M_dead && __match(_S_value(__N)))
+            {
+              _M_mark_dead(__N);
+              ++__marked;
+            }
+          if (_S_left(__N))
+            {
+              _Region_ __left(__bounds);
+              __left.set_high_bound(_S_value(__N), _S_dim(__N));
+              if (__match.visits(__left))
+                __marked += _M_mark_matching(_S_left(__N), __match, __left);
+            }
+          if (_S_right(__N))
+            {
+              _Region_ __right(__bounds);
+              __right.set_low_bound(_S_value(__N), _S_dim(__N));
+              if (__match.visits(__right))
+                __marked += _M_mark_matching(_S_right(__N), __match, __right);
+            }
+          return __marked;
+        }
+
+      // If __new went too deep, rebuilds the smallest subtree on its path
+      // that is out of balance.
+      void
+      _M_rebalance_after_insert(_Link_type const __new)
+      {
+        if (_M_count > _M_max_count)
+          _M_max_count = _M_count;
+        size_type __depth = 0;
+        for (_Base_const_ptr __p = __new; __p != _M_get_root(); __p = __p->_M_parent)
+          ++__depth;
+        if (__depth <= std::log(double(_M_count + _M_dead_count))
+                       / -std::log(_M_alpha))
+          return;
+        // The sizes count the live values, kept in the nodes or counted.
+        // If no subtree on the path is out of balance, the dead nodes made
+        // __new too deep, and the whole tree is rebuilt without them.
+        size_type __size = 1;
+        _Link_type __p = __new;
+        while (__p != _M_get_root())
+          {
+            _Link_type const __child = __p;
+            __p = _S_parent(__p);
+            _Link_const_type const __sibling
+              = (_S_left(__p) == __child) ? _S_right(__p) : _S_left(__p);
+            size_type const __p_size = __size + !__p->_M_dead
+              + (__sibling ? _Node_aggregate_::_S_size(__sibling) : 0);
+            if (__size > _M_alpha * __p_size)
+              break;
+            __size = __p_size;
+          }
+        _M_rebalance_subtree(__p->_M_parent, _M_link_to(__p), _S_dim(__p));
+      }
+
+      // Where __N hangs from its parent.
+      _Base_ptr*
+      _M_link_to(_Link_type const __N)
+      {
+        if (__N == _M_get_root())
+          return &_M_root;
+        _Base_ptr const __p = __N->_M_parent;
+        return (__p->_M_left == __N) ? &__p->_M_left : &__p->_M_right;
+      }
+
+#if __cplusplus >= 201103L
+      // takes the nodes of __x; this tree must be empty
+      void
+      _M_steal(KDTree& __x)
+      {
+        if (!__x._M_get_root()) return;
+        _M_set_root(__x._M_get_root());
+        _S_set_parent(_M_get_root(), &_M_header);
+        _M_set_leftmost(__x._M_header._M_left);
+        _M_set_rightmost(__x._M_header._M_right);
+        _M_count = __x._M_count;
+        _M_max_count = __x._M_max_count;
+        _M_dead_count = __x._M_dead_count;
+        __x._M_empty_initialise();
+        __x._M_count = 0;
+        __x._M_max_count = 0;
+        __x._M_dead_count = 0;
+      }
+#endif
+
+      _Link_type
+      _M_erase(_Link_type dead_dad)
+      {
+         // find a new step_dad, he will become a drop-in replacement.
+        _Link_type step_dad = _M_get_erase_replacement(dead_dad);
+
+         // tell dead_dad's parent that his new child is step_dad
+        if (dead_dad == _M_get_root())
+           _M_set_root(step_dad);
+        else if (_S_left(_S_parent(dead_dad)) == dead_dad)
+            _S_set_left(_S_parent(dead_dad), step_dad);
+        else
+            _S_set_right(_S_parent(dead_dad), step_dad);
+
+        // deal with the left and right edges of the tree...
+        // if the dead_dad was at the edge, then substitude...
+        // but if there IS no new dead, then left_most is the dead_dad's parent
+         if (dead_dad == _M_get_leftmost())
+           _M_set_leftmost( (step_dad ? step_dad : _S_parent(dead_dad)) );
+         if (dead_dad == _M_get_rightmost())
+           _M_set_rightmost( (step_dad ? step_dad : _S_parent(dead_dad)) );
+
+        if (step_dad)
+          {
+             // step_dad gets dead_dad's parent
+            _S_set_parent(step_dad, _S_parent(dead_dad));
+
+            // first tell the children that step_dad is their new dad
+            if (_S_left(dead_dad))
+               _S_set_parent(_S_left(dead_dad), step_dad);
+            if (_S_right(dead_dad))
+               _S_set_parent(_S_right(dead_dad), step_dad);
+
+            // step_dad gets dead_dad's children, and splits them the same way
+            _S_set_left(step_dad, _S_left(dead_dad));
+            _S_set_right(step_dad, _S_right(dead_dad));
+            _S_set_dim(step_dad, _S_dim(dead_dad));
+          }
+
+        _M_update_summaries(step_dad ? step_dad : dead_dad->_M_parent);
+        return step_dad;
+      }
+
+
+
+      _Link_type
+      _M_get_erase_replacement(_Link_type node)
+      {
+         // if 'node' is null, then we can't do any better
+        if (_S_is_leaf(node))
+           return NULL;
+
+        size_type const dim = _S_dim(node);
+        _Link_type candidate;
+        // if there is nothing to the left, find a candidate on the right tree
+        if (!_S_left(node))
+          candidate = _M_get_j_min(_S_right(node), dim);
+        // ditto for the right
+        else if ((!_S_right(node)))
+          candidate = _M_get_j_max(_S_left(node), dim);
         // we have both children ...
         else
          {
@@ -757,85 +2186,79 @@ namespace KDTree
             // staying balanced.
             // If this were a true binary tree, we would always hunt down the right branch.
             // See top for notes.
-	   _Node_compare_ compare(level % __K, _M_acc, _M_cmp);
-            // compare the children based on this level's criteria...
+	   _Node_compare_ compare(dim, _M_acc, _M_cmp);
+            // compare the children based on this node's criteria...
             // (this gives virtually random results)
             if (compare(_S_right(node)->_M_value, _S_left(node)->_M_value))
                // the right is smaller, get our replacement from the SMALLEST on the right
-               candidate = _M_get_j_min(std::pair<_Link_type,size_type>(_S_right(node),level), level+1);
+               candidate = _M_get_j_min(_S_right(node), dim);
             else
-               candidate = _M_get_j_max( std::pair<_Link_type,size_type>(_S_left(node),level), level+1);
+               candidate = _M_get_j_max(_S_left(node), dim);
          }
 
         // we have a candidate replacement by now.
         // remove it from the tree, but don't delete it.
         // it must be disconnected before it can be reconnected.
-        _Link_type parent = _S_parent(candidate.first);
-        if (_S_left(parent) == candidate.first)
-           _S_set_left(parent, _M_erase(candidate.first, candidate.second));
+        _Link_type parent = _S_parent(candidate);
+        if (_S_left(parent) == candidate)
+           _S_set_left(parent, _M_erase(candidate));
         else
-           _S_set_right(parent, _M_erase(candidate.first, candidate.second));
+           _S_set_right(parent, _M_erase(candidate));
 
-        return candidate.first;
+        return candidate;
       }
 
 
 
-      std::pair<_Link_type,size_type>
-      _M_get_j_min( std::pair<_Link_type,size_type> const node, size_type const level)
+      // the smallest node of the subtree in dimension 'dim'
+      _Link_type
+      _M_get_j_min(_Link_type const node, size_type const dim)
       {
-         typedef std::pair<_Link_type,size_type> Result;
-        if (_S_is_leaf(node.first))
-            return Result(node.first,level);
+        if (_S_is_leaf(node))
+            return node;
 
-        _Node_compare_ compare(node.second % __K, _M_acc, _M_cmp);
-        Result candidate = node;
-        if (_S_left(node.first))
+        _Node_compare_ compare(dim, _M_acc, _M_cmp);
+        _Link_type candidate = node;
+        if (_S_left(node))
           {
-            Result left = _M_get_j_min(Result(_S_left(node.first), node.second), level+1);
-            if (compare(left.first->_M_value, candidate.first->_M_value))
+            _Link_type left = _M_get_j_min(_S_left(node), dim);
+            if (compare(left->_M_value, candidate->_M_value))
                 candidate = left;
           }
-        if (_S_right(node.first))
+        // nothing on the right of a node split on 'dim' is smaller
+        if (_S_right(node) && _S_dim(node) != dim)
           {
-            Result right = _M_get_j_min( Result(_S_right(node.first),node.second), level+1);
-            if (compare(right.first->_M_value, candidate.first->_M_value))
+            _Link_type right = _M_get_j_min(_S_right(node), dim);
+            if (compare(right->_M_value, candidate->_M_value))
                 candidate = right;
           }
-        if (candidate.first == node.first)
-           return Result(candidate.first,level);
-
         return candidate;
       }
 
 
 
-      std::pair<_Link_type,size_type>
-      _M_get_j_max( std::pair<_Link_type,size_type> const node, size_type const level)
+      // the largest node of the subtree in dimension 'dim'
+      _Link_type
+      _M_get_j_max(_Link_type const node, size_type const dim)
       {
-         typedef std::pair<_Link_type,size_type> Result;
-
-        if (_S_is_leaf(node.first))
-            return Result(node.first,level);
+        if (_S_is_leaf(node))
+            return node;
 
-        _Node_compare_ compare(node.second % __K, _M_acc, _M_cmp);
-        Result candidate = node;
-        if (_S_left(node.first))
+        _Node_compare_ compare(dim, _M_acc, _M_cmp);
+        _Link_type candidate = node;
+        // nothing on the left of a node split on 'dim' is larger
+        if (_S_left(node) && _S_dim(node) != dim)
           {
-            Result left = _M_get_j_max( Result(_S_left(node.first),node.second), level+1);
-            if (compare(candidate.first->_M_value, left.first->_M_value))
+            _Link_type left = _M_get_j_max(_S_left(node), dim);
+            if (compare(candidate->_M_value, left->_M_value))
                 candidate = left;
           }
-        if (_S_right(node.first))
+        if (_S_right(node))
           {
-            Result right = _M_get_j_max(Result(_S_right(node.first),node.second), level+1);
-            if (compare(candidate.first->_M_value, right.first->_M_value))
+            _Link_type right = _M_get_j_max(_S_right(node), dim);
+            if (compare(candidate->_M_value, right->_M_value))
                 candidate = right;
           }
-
-        if (candidate.first == node.first)
-           return Result(candidate.first,level);
-
         return candidate;
       }
 
@@ -852,8 +2275,21 @@ namespace KDTree
           }
       }
 
+      // destroy the nodes, without giving back their memory
+      void
+      _M_destroy_subtree(_Link_type __n)
+      {
+        while (__n)
+          {
+            _M_destroy_subtree(_S_right(__n));
+            _Link_type __t = _S_left(__n);
+            _Base::_M_destroy_node(__n);
+            __n = __t;
+          }
+      }
+
       const_iterator
-      _M_find(_Link_const_type node, const_reference value, size_type const level) const
+      _M_find(_Link_const_type node, const_reference value) const
       {
          // be aware! This is very different to normal binary searches, because of the <=
          // relationship used. See top for notes.
@@ -861,22 +2297,22 @@ namespace KDTree
          // in different branches.
           const_iterator found = this->end();
 
-	  _Node_compare_ compare(level % __K, _M_acc, _M_cmp);
+	  _Node_compare_ compare(_S_dim(node), _M_acc, _M_cmp);
         if (!compare(node->_M_value,value))   // note, this is a <= test
           {
            // this line is the only difference between _M_find_exact() and _M_find()
-            if (_M_matches_node(node, value, level))
+            if (!node->_M_dead && _M_matches_node(node, value, _S_dim(node)))
               return const_iterator(node);   // return right away
             if (_S_left(node))
-               found = _M_find(_S_left(node), value, level+1);
+               found = _M_find(_S_left(node), value);
           }
         if ( _S_right(node) && found == this->end() && !compare(value,node->_M_value))   // note, this is a <= test
-            found = _M_find(_S_right(node), value, level+1);
+            found = _M_find(_S_right(node), value);
         return found;
       }
 
       const_iterator
-      _M_find_exact(_Link_const_type node, const_reference value, size_type const level) const
+      _M_find_exact(_Link_const_type node, const_reference value) const
       {
          // be aware! This is very different to normal binary searches, because of the <=
          // relationship used. See top for notes.
@@ -884,19 +2320,19 @@ namespace KDTree
          // in different branches.
           const_iterator found = this->end();
 
-	  _Node_compare_ compare(level % __K, _M_acc, _M_cmp);
+	  _Node_compare_ compare(_S_dim(node), _M_acc, _M_cmp);
         if (!compare(node->_M_value,value))  // note, this is a <= test
         {
            // this line is the only difference between _M_find_exact() and _M_find()
-            if (value == *const_iterator(node))
+            if (!node->_M_dead && value == *const_iterator(node))
               return const_iterator(node);   // return right away
            if (_S_left(node))
-            found = _M_find_exact(_S_left(node), value, level+1);
+            found = _M_find_exact(_S_left(node), value);
         }
 
         // note: no else!  items that are identical can be down both branches
         if ( _S_right(node) && found == this->end() && !compare(value,node->_M_value))   // note, this is a <= test
-            found = _M_find_exact(_S_right(node), value, level+1);
+            found = _M_find_exact(_S_right(node), value);
         return found;
       }
 
@@ -926,126 +2362,551 @@ namespace KDTree
           && _M_matches_node_in_other_ds(__N, __V, __L);
       }
 
-      size_type
-        _M_count_within_range(_Link_const_type __N, _Region_ const& __REGION,
-                             _Region_ const& __BOUNDS,
-                             size_type const __L) const
-        {
-           size_type count = 0;
-          if (__REGION.encloses(_S_value(__N)))
-            {
-               ++count;
-            }
-          if (_S_left(__N))
-            {
-              _Region_ __bounds(__BOUNDS);
-              __bounds.set_high_bound(_S_value(__N), __L);
-              if (__REGION.intersects_with(__bounds))
-                count += _M_count_within_range(_S_left(__N),
-                                     __REGION, __bounds, __L+1);
-            }
-          if (_S_right(__N))
-            {
-              _Region_ __bounds(__BOUNDS);
-              __bounds.set_low_bound(_S_value(__N), __L);
-              if (__REGION.intersects_with(__bounds))
-                count += _M_count_within_range(_S_right(__N),
-                                     __REGION, __bounds, __L+1);
-            }
-
-          return count;
-        }
-
-
       template <class Visitor>
         Visitor
-        _M_visit_within_range(Visitor visitor,
-                             _Link_const_type N, _Region_ const& REGION,
-                             _Region_ const& BOUNDS,
-                             size_type const L) const
+        _M_visit_within_range(Visitor __visitor,
+                              _Region_ const& __REGION) const
         {
-          if (REGION.encloses(_S_value(N)))
-            {
-              visitor(_S_value(N));
-            }
-          if (_S_left(N))
-            {
-              _Region_ bounds(BOUNDS);
-              bounds.set_high_bound(_S_value(N), L);
-              if (REGION.intersects_with(bounds))
-                visitor = _M_visit_within_range(visitor, _S_left(N),
-                                     REGION, bounds, L+1);
-            }
-          if (_S_right(N))
-            {
-              _Region_ bounds(BOUNDS);
-              bounds.set_low_bound(_S_value(N), L);
-              if (REGION.intersects_with(bounds))
-                visitor = _M_visit_within_range(visitor, _S_right(N),
-                                     REGION, bounds, L+1);
-            }
-
-          return visitor;
+          _M_walk_within_range(__visitor, __REGION, _Whole_tag<false>());
+          return __visitor;
         }
 
+      // whether the visitor of _M_walk_within_range() takes whole subtrees
+      template <bool __Whole>
+        struct _Whole_tag { };
 
+      template <class Visitor>
+        static void
+        _S_visit_whole(Visitor& __visitor, _Link_const_type __N,
+                       _Whole_tag<true>)
+        { __visitor(__N); }
 
-      template <typename _OutputIterator>
-        _OutputIterator
-        _M_find_within_range(_OutputIterator out,
-                             _Link_const_type __N, _Region_ const& __REGION,
-                             _Region_ const& __BOUNDS,
-                             size_type const __L) const
+      template <class Visitor>
+        static void
+        _S_visit_whole(Visitor&, _Link_const_type, _Whole_tag<false>)
+        { }
+
+      /*! Visit the values within __REGION, walking down the tree and back up
+	through the parent links, without recursion or copies of __REGION.
+	The cell of a node being visited intersects __REGION, so the cell of
+	a child does too unless the plane of the node leaves it beyond
+	__REGION; only that bound is tested.
+
+	With _Whole_tag<true>, the nodes keep their sizes and __visitor also
+	takes a node, for its whole subtree.  __inside[2 d] then tells
+	whether the low bound of the cell of __N on the dimension d is within
+	__REGION, and __inside[2 d + 1] the high bound.  A bound is only ever
+	set on the way down, where the cells shrink, so at most 2 __K are set
+	along the path; each is recorded in __set with the node below which it
+	holds, and cleared again when the walk leaves that node.  Once all
+	the bounds are within __REGION, the whole subtree is visited at once.
+       */
+      template <class Visitor, bool __Whole>
+        void
+        _M_walk_within_range(Visitor& __visitor, _Region_ const& __REGION,
+                             _Whole_tag<__Whole> const __whole) const
         {
-          if (__REGION.encloses(_S_value(__N)))
+          bool __inside[2 * __K];
+          std::fill(__inside, __inside + 2 * __K, false);
+          size_type __n_inside = 0;
+          std::pair<_Link_const_type, size_type> __set[2 * __K];
+          size_type __n_set = 0;
+
+          _Link_const_type const __root = _M_get_root();
+          _Link_const_type __N = __root;
+          for (;;)
             {
-              *out++ = _S_value(__N);
+              bool __descend = true;
+              if (__Whole && !_Node_aggregate_::_S_size(__N))
+                __descend = false;
+              else if (__Whole && __n_inside == 2 * __K)
+                {
+                  _S_visit_whole(__visitor, __N, __whole);
+                  __descend = false;
+                }
+              else if (!__N->_M_dead && __REGION.encloses(_S_value(__N)))
+                __visitor(_S_value(__N));
+              if (__descend)
+                {
+                  // the plane of __N is the high bound of the left cell, and
+                  // the low bound of the right one
+                  size_type const __dim = _S_dim(__N);
+                  bool const __above_low = _S_range_left(__N, __REGION);
+                  bool const __below_high = _S_range_right(__N, __REGION);
+                  if (_S_left(__N) && __above_low)
+                    {
+                      __N = _S_left(__N);
+                      if (__Whole && __below_high && !__inside[2 * __dim + 1])
+                        {
+                          __inside[2 * __dim + 1] = true;
+                          ++__n_inside;
+                          __set[__n_set++] = std::make_pair(__N, 2 * __dim + 1);
+                        }
+                      continue;
+                    }
+                  if (_S_right(__N) && __below_high)
+                    {
+                      __N = _S_right(__N);
+                      if (__Whole && __above_low && !__inside[2 * __dim])
+                        {
+                          __inside[2 * __dim] = true;
+                          ++__n_inside;
+                          __set[__n_set++] = std::make_pair(__N, 2 * __dim);
+                        }
+                      continue;
+                    }
+                }
+              // back up to the first right subtree still to visit
+              for (;;)
+                {
+                  if (__n_set && __set[__n_set - 1].first == __N)
+                    {
+                      __inside[__set[--__n_set].second] = false;
+                      --__n_inside;
+                    }
+                  if (__N == __root)
+                    return;
+                  _Link_const_type const __P = _S_parent(__N);
+                  if (__N == _S_left(__P) && _S_right(__P)
+                      && _S_range_right(__P, __REGION))
+                    {
+                      __N = _S_right(__P);
+                      size_type const __dim = _S_dim(__P);
+                      if (__Whole && _S_range_left(__P, __REGION)
+                          && !__inside[2 * __dim])
+                        {
+                          __inside[2 * __dim] = true;
+                          ++__n_inside;
+                          __set[__n_set++] = std::make_pair(__N, 2 * __dim);
+                        }
+                      break;
+                    }
+                  __N = __P;
+                }
             }
-          if (_S_left(__N))
-            {
-              _Region_ __bounds(__BOUNDS);
-              __bounds.set_high_bound(_S_value(__N), __L);
-              if (__REGION.intersects_with(__bounds))
-                out = _M_find_within_range(out, _S_left(__N),
-                                     __REGION, __bounds, __L+1);
-            }
-          if (_S_right(__N))
-            {
-              _Region_ __bounds(__BOUNDS);
-              __bounds.set_low_bound(_S_value(__N), __L);
-              if (__REGION.intersects_with(__bounds))
-                out = _M_find_within_range(out, _S_right(__N),
-                                     __REGION, __bounds, __L+1);
-            }
-
-          return out;
         }
 
+      // whether __REGION reaches the left or the right of the plane of __N
+      static bool
+      _S_range_left(_Link_const_type __N, _Region_ const& __REGION)
+      {
+        size_type const __dim = _S_dim(__N);
+        return !__REGION._M_cmp(__REGION._M_acc(_S_value(__N), __dim),
+                                __REGION._M_low_bounds[__dim]);
+      }
 
+      static bool
+      _S_range_right(_Link_const_type __N, _Region_ const& __REGION)
+      {
+        size_type const __dim = _S_dim(__N);
+        return !__REGION._M_cmp(__REGION._M_high_bounds[__dim],
+                                __REGION._M_acc(_S_value(__N), __dim));
+      }
+
+      // Builds the tree from [__A,__B), which it reorders; the tree must be
+      // empty.  The values are first partitioned into the pre-order of the
+      // tree, in parallel when compiled with OpenMP, then the nodes are
+      // created and linked in that order, without searching the tree.
       template <typename _Iter>
         void
         _M_optimise(_Iter const& __A, _Iter const& __B,
                     size_type const __L)
       {
+        _M_optimise(__A, __B, __L, __A);
+      }
+
+      // As above, when the values of [__A,__B) are not needed afterwards:
+      // they are moved into the nodes instead of copied.
+      template <typename _Iter>
+        void
+        _M_optimise_consume(_Iter const& __A, _Iter const& __B,
+                            size_type const __L)
+      {
+        _M_optimise(__A, __B, __L, _S_consume(__A));
+      }
+
+#if __cplusplus >= 201103L
+      template <typename _Iter>
+        static std::move_iterator<_Iter>
+        _S_consume(_Iter const& __i)
+        { return std::make_move_iterator(__i); }
+#else
+      template <typename _Iter>
+        static _Iter const&
+        _S_consume(_Iter const& __i)
+        { return __i; }
+#endif
+
+      // The nodes take their values from __values, which refers to the
+      // same values as __A.
+      template <typename _Iter, typename _Source>
+        void
+        _M_optimise(_Iter const& __A, _Iter const& __B,
+                    size_type const __L, _Source const& __values)
+      {
+        assert(!_M_get_root());
         if (__A == __B) return;
-        _Node_compare_ compare(__L % __K, _M_acc, _M_cmp);
-        _Iter __m = __A + (__B - __A) / 2;
-        std::nth_element(__A, __m, __B, compare);
-        this->insert(*__m);
-        if (__m != __A) _M_optimise(__A, __m, __L+1);
-        if (++__m != __B) _M_optimise(__m, __B, __L+1);
+        try
+          {
+            _M_build(__A, __B, __L, __values, &_M_header, &_M_root);
+          }
+        catch (...)
+          {
+            this->clear();
+            throw;
+          }
+        _M_count = __B - __A;
+        _M_max_count = _M_count;
+        _M_set_leftmost(_Node_base::_S_minimum(_M_get_root()));
+        _M_set_rightmost(_Node_base::_S_maximum(_M_get_root()));
+      }
+
+      // Builds a subtree from [__A,__B), which it reorders, and hooks it in
+      // *__link under __parent.  __L is the depth given to the _Split
+      // policy for its root.  Neither _M_count nor the leftmost and
+      // rightmost nodes are updated.  If a copy throws, the nodes built so
+      // far are hooked in *__link.
+      template <typename _Iter, typename _Source>
+        void
+        _M_build(_Iter const& __A, _Iter const& __B, size_type const __L,
+                 _Source const& __values,
+                 _Base_ptr const __parent, _Base_ptr* const __link)
+      {
+        size_type const __n = __B - __A;
+        std::vector<_Build_node> __build(__n);
+        _M_partition(__A, __B, __L, &__build[0], _M_acc);
+
+        _Base::_M_reserve_nodes(__n);
+        _M_link(__values, &__build[0], __n, __parent, __link);
+        _S_aggregate_subtree(*__link);
       }
 
+      // Gives the split policies the values of the nodes.
+      struct _Node_accessor
+      {
+        typedef subvalue_type result_type;
+
+        _Node_accessor(_Acc const& __acc) : _M_acc(__acc) {}
+
+        result_type
+        operator()(_Link_const_type const __N, size_t const __dim) const
+        { return _M_acc(__N->_M_value, __dim); }
+
+        _Acc _M_acc;
+      };
+
+      // Rebuilds balanced the subtree hooked in *__link under __parent,
+      // which may be empty, together with new nodes for the values of
+      // [__A,__B), which are consumed.  __L is the depth given to the _Split
+      // policy for its root.  The nodes already in the subtree are relinked,
+      // not copied, so iterators on them stay valid, and nothing changes if
+      // an exception is thrown.  Neither _M_count nor the leftmost and
+      // rightmost nodes are updated.
+      template <typename _Iter>
+        void
+        _M_rebuild_subtree(_Base_ptr const __parent, _Base_ptr* const __link,
+                           size_type const __L, _Iter __A, _Iter const& __B)
+      {
+        std::vector<_Link_type> __nodes;
+        // the dead nodes, which the sizes leave out, may still grow it
+        __nodes.reserve((_Node_aggregate_::_S_sized && *__link
+                         ? _Node_aggregate_::_S_size(*__link) : 0)
+                        + (__B - __A));
+        _M_collect_nodes(static_cast<_Link_type>(*__link), __nodes);
+        if (__nodes.empty() && __A == __B)
+          return;
+        // the dead nodes are left out, and freed once nothing can throw
+        typename std::vector<_Link_type>::iterator const __live_end
+          = std::partition(__nodes.begin(), __nodes.end(), _S_is_live);
+        std::vector<_Link_type> const __dead(__live_end, __nodes.end());
+        __nodes.erase(__live_end, __nodes.end());
+        size_type const __live = __nodes.size();
+        std::vector<_Build_node> __build;
+        try
+          {
+            for (; __A != __B; ++__A)
+              __nodes.push_back(_M_new_node(*_S_consume(__A), 0));
+            __build.resize(__nodes.size());
+            if (!__nodes.empty())
+              _M_partition(__nodes.begin(), __nodes.end(), __L, &__build[0],
+                           _Node_accessor(_M_acc));
+          }
+        catch (...)
+          {
+            // only the new nodes have no parent
+            for (size_type __i = 0; __i != __nodes.size(); ++__i)
+              if (!__nodes[__i]->_M_parent)
+                _M_delete_node(__nodes[__i]);
+            throw;
+          }
+        *__link = NULL;
+        if (!__nodes.empty())
+          _M_relink(&__nodes[0], &__build[0], __nodes.size(), __parent, __link);
+        _S_aggregate_subtree(*__link);
+        // the new nodes count above __parent too
+        if (__nodes.size() != __live)
+          _M_update_summaries(__parent);
+        for (size_type __i = 0; __i != __dead.size(); ++__i)
+          _M_delete_node(__dead[__i]);
+        _M_dead_count -= __dead.size();
+      }
+
+      static bool
+      _S_is_live(_Link_const_type const __N)
+      {
+        return !__N->_M_dead;
+      }
+
+      // Rebuilds balanced the subtree hooked in *__link under __parent.
+      void
+      _M_rebalance_subtree(_Base_ptr const __parent, _Base_ptr* const __link,
+                           size_type const __L)
+      {
+        _M_rebuild_subtree(__parent, __link, __L,
+                           static_cast<value_type*>(NULL),
+                           static_cast<value_type*>(NULL));
+        _M_update_extremes();
+      }
+
+      static void
+      _M_collect_nodes(_Link_type __N, std::vector<_Link_type>& __nodes)
+      {
+        while (__N)
+          {
+            __nodes.push_back(__N);
+            _M_collect_nodes(_S_left(__N), __nodes);
+            __N = _S_right(__N);
+          }
+      }
+
+      // Inserts the values of [__A,__B), which it reorders and consumes.
+      // If an exception is thrown, some of the values may be inserted.
+      template <typename _Iter>
+        void
+        _M_insert_batch(_Iter const& __A, _Iter const& __B)
+      {
+        if (__A == __B) return;
+        if (!_M_get_root())
+          {
+            _M_optimise_consume(__A, __B, 0);
+            return;
+          }
+        try
+          {
+            _M_insert_batch(&_M_header, &_M_root, 0, __A, __B);
+          }
+        catch (...)
+          {
+            _M_update_extremes();
+            throw;
+          }
+        _M_update_extremes();
+        if (_M_count > _M_max_count)
+          _M_max_count = _M_count;
+      }
+
+      // Sends the values of [__A,__B) down the subtree hooked in *__link
+      // under __parent.
+      template <typename _Iter>
+        void
+        _M_insert_batch(_Base_ptr const __parent, _Base_ptr* const __link,
+                        size_type const __L, _Iter const& __A,
+                        _Iter const& __B)
+      {
+        _Link_type const __N = static_cast<_Link_type>(*__link);
+        // merging a batch as large as the subtree costs about as much as
+        // rebuilding the subtree, which also balances it
+        if (!__N || _S_size_at_most(__N, __B - __A))
+          {
+            _M_rebuild_subtree(__parent, __link, __N ? _S_dim(__N) : __L,
+                               __A, __B);
+            _M_count += __B - __A;
+            return;
+          }
+        _Node_compare_ compare(_S_dim(__N), _M_acc, _M_cmp);
+        _Iter __m = __A;
+        for (_Iter __v = __A; __v != __B; ++__v)
+          if (compare(*__v, _S_value(__N)))
+            std::iter_swap(__v, __m++);
+        size_type const __child_dim = (_S_dim(__N) + 1) % __K;
+        if (__A != __m)
+          _M_insert_batch(__N, &__N->_M_left, __child_dim, __A, __m);
+        if (__m != __B)
+          _M_insert_batch(__N, &__N->_M_right, __child_dim, __m, __B);
+      }
+
+      // Whether the subtree __N holds at most __n values.  Unless the nodes
+      // keep the sizes, the dead nodes count too, and no more than __n + 1
+      // nodes are counted, so that the answer costs no more than merging
+      // __n values.
+      static bool
+      _S_size_at_most(_Link_const_type const __N, size_type const __n)
+      {
+        if (_Node_aggregate_::_S_sized)
+          return _Node_aggregate_::_S_size(__N) <= __n;
+        size_type __budget = __n + 1;
+        _S_count_nodes(__N, __budget);
+        return __budget != 0;
+      }
+
+      // Takes one from __budget for each node of the subtree __N, until
+      // there is none left.
+      static void
+      _S_count_nodes(_Base_const_ptr __N, size_type& __budget)
+      {
+        for (; __N && __budget; __N = __N->_M_right)
+          {
+            --__budget;
+            _S_count_nodes(__N->_M_left, __budget);
+          }
+      }
+
+      // What the partition records about each node of a bulk build.
+      struct _Build_node
+      {
+        unsigned int _M_dim;
+        size_type _M_left_size;
+      };
+
+      // Partitions [__A,__B) into the pre-order of the subtree built from
+      // it, see _M_partition_subtree(), on several threads if it is large:
+      // the subtrees are partitioned by separate tasks, and the split
+      // policies partition each large range with several tasks, see
+      // _S_parallel_partition().  If _Split throws, the values are left in some order and the
+      // exception is thrown once all the threads are done.
+      template <typename _Iter, typename _Access>
+        void
+        _M_partition(_Iter const __A, _Iter const __B, size_type const __L,
+                     _Build_node* const __nodes, _Access const __acc) const
+      {
+        _Parallel_error __error;
+#ifdef KDTREE_PARALLEL
+#       pragma omp parallel if (size_type(__B - __A) >= _S_parallel_threshold)
+#       pragma omp single nowait
+        try
+          {
+#endif
+            _M_partition_subtree(__A, __B, __L, __nodes, __acc, &__error);
+#ifdef KDTREE_PARALLEL
+          }
+        catch (...)
+          {
+            __error._M_catch();
+          }
+#endif
+        __error._M_rethrow();
+      }
+
+      // Moves the value chosen by _Split as root of the subtree to the front
+      // of [__A,__B), followed by its left and right subtrees, and records
+      // its dimension and the size of its left subtree in __nodes[0].  The
+      // left subtree is partitioned by another task if it is large; what it
+      // throws is kept in *__error.
+      template <typename _Iter, typename _Access>
+        void
+        _M_partition_subtree(_Iter const __A, _Iter const __B,
+                             size_type const __L, _Build_node* const __nodes,
+                             _Access const __acc,
+                             _Parallel_error* const __error) const
+      {
+        size_type __dim;
+        _Iter const __m = _Split::template split<__K>(__A, __B, __L,
+                                                      __acc, _M_cmp, __dim);
+        std::iter_swap(__A, __m);
+        __nodes[0]._M_dim = static_cast<unsigned int>(__dim);
+        __nodes[0]._M_left_size = __m - __A;
+        // the left subtree is [__A+1,__m+1), the right one [__m+1,__B)
+        _Iter const __left = __A + 1;
+        _Iter const __right = __m + 1;
+        if (__left != __right)
+          {
+#ifdef KDTREE_PARALLEL
+#           pragma omp task if (__right - __left >= difference_type(_S_parallel_threshold))
+            try
+              {
+#endif
+                _M_partition_subtree(__left, __right, __L+1, __nodes + 1,
+                                     __acc, __error);
+#ifdef KDTREE_PARALLEL
+              }
+            catch (...)
+              {
+                __error->_M_catch();
+              }
+#endif
+          }
+        if (__right != __B)
+          _M_partition_subtree(__right, __B, __L+1, __nodes + (__right - __A),
+                               __acc, __error);
+#ifdef KDTREE_PARALLEL
+#       pragma omp taskwait
+#endif
+      }
+
+      // Creates the __n nodes of a partitioned subtree, under __parent.
+      // Every node is hooked in __link before its children are created, so
+      // that clear() finds all of them if a copy throws.
+      template <typename _Iter>
+        void
+        _M_link(_Iter __A, _Build_node const* __nodes, size_type __n,
+                _Base_ptr __parent, _Base_ptr* __link)
+      {
+        while (__n)
+          {
+            _Link_type const __node
+              = _M_new_node(*__A, __nodes->_M_dim, __parent);
+            *__link = __node;
+            size_type const __left = __nodes->_M_left_size;
+            if (__left)
+              _M_link(__A + 1, __nodes + 1, __left, __node, &__node->_M_left);
+            // continue with the right subtree
+            __A += __left + 1;
+            __nodes += __left + 1;
+            __n -= __left + 1;
+            __parent = __node;
+            __link = &__node->_M_right;
+          }
+      }
+
+      // Links again the __n nodes of a partitioned subtree, under __parent.
+      void
+      _M_relink(_Link_type* __nodes, _Build_node const* __build, size_type __n,
+                _Base_ptr __parent, _Base_ptr* __link)
+      {
+        while (__n)
+          {
+            _Link_type const __node = *__nodes;
+            _S_set_parent(__node, __parent);
+            _S_set_left(__node, NULL);
+            _S_set_right(__node, NULL);
+            _S_set_dim(__node, __build->_M_dim);
+            *__link = __node;
+            size_type const __left = __build->_M_left_size;
+            if (__left)
+              _M_relink(__nodes + 1, __build + 1, __left, __node, &__node->_M_left);
+            // continue with the right subtree
+            __nodes += __left + 1;
+            __build += __left + 1;
+            __n -= __left + 1;
+            __parent = __node;
+            __link = &__node->_M_right;
+          }
+      }
+
+      // Below this many values, subtrees are partitioned by a single thread.
+      static const size_type _S_parallel_threshold
+        = KDTREE_PARALLEL_THRESHOLD;
+
       _Link_const_type
       _M_get_root() const
       {
-         return const_cast<_Link_const_type>(_M_root);
+         return static_cast<_Link_const_type>(_M_root);
       }
 
       _Link_type
       _M_get_root()
       {
-         return _M_root;
+         return static_cast<_Link_type>(_M_root);
       }
 
       void _M_set_root(_Link_type n)
@@ -1131,6 +2992,18 @@ namespace KDTree
         return static_cast<_Link_const_type>( N->_M_right );
       }
 
+      static size_type
+      _S_dim(_Base_const_ptr N)
+      {
+        return N->_M_dim;
+      }
+
+      static void
+      _S_set_dim(_Base_ptr N, size_type const d)
+      {
+        N->_M_dim = static_cast<unsigned int>(d);
+      }
+
       static bool
       _S_is_leaf(_Base_const_ptr N)
       {
@@ -1164,17 +3037,34 @@ namespace KDTree
 
       _Link_type
       _M_new_node(const_reference __V, //  = value_type(),
+                  size_type const __DIM,
                   _Base_ptr const __PARENT = NULL,
                   _Base_ptr const __LEFT = NULL,
                   _Base_ptr const __RIGHT = NULL)
       {
          typename _Base::NoLeakAlloc noleak(this);
          _Link_type new_node = noleak.get();
-	 _Base::_M_construct_node(new_node, __V, __PARENT, __LEFT, __RIGHT);
+	 _Base::_M_construct_node(new_node, __V, __PARENT, __LEFT, __RIGHT, __DIM);
          noleak.disconnect();
          return new_node;
       }
 
+#if __cplusplus >= 201103L
+      _Link_type
+      _M_new_node(value_type&& __V,
+                  size_type const __DIM,
+                  _Base_ptr const __PARENT = NULL,
+                  _Base_ptr const __LEFT = NULL,
+                  _Base_ptr const __RIGHT = NULL)
+      {
+         typename _Base::NoLeakAlloc noleak(this);
+         _Link_type new_node = noleak.get();
+	 _Base::_M_construct_node(new_node, std::move(__V), __PARENT, __LEFT, __RIGHT, __DIM);
+         noleak.disconnect();
+         return new_node;
+      }
+#endif
+
       /* WHAT was this for?
       _Link_type
       _M_clone_node(_Link_const_type __X)
@@ -1192,17 +3082,24 @@ namespace KDTree
         _Base::_M_deallocate_node(__p);
       }
 
-      _Link_type _M_root;
+      _Base_ptr _M_root;
       _Node_base _M_header;
       size_type _M_count;
       _Acc _M_acc;
       _Cmp _M_cmp;
       _Dist _M_dist;
+      // see set_balance(); _M_max_count is the largest size since the
+      // last rebuild of the whole tree
+      double _M_alpha;
+      size_type _M_max_count;
+      // see set_lazy_erase(); _M_dead_count nodes are dead
+      double _M_max_dead;
+      size_type _M_dead_count;
 
 #ifdef KDTREE_DEFINE_OSTREAM_OPERATORS
       friend std::ostream&
       operator<<(std::ostream& o,
-		 KDTree<__K, _Val, _Acc, _Dist, _Cmp, _Alloc> const& tree)
+		 KDTree<__K, _Val, _Acc, _Dist, _Cmp, _Alloc, _Split, _Aggregate> const& tree)
     {
       o << "meta node:   " << tree._M_header << std::endl;
       o << "root node:   " << tree._M_root << std::endl;
@@ -1213,7 +3110,7 @@ namespace KDTree
       o << "nodes total: " << tree.size() << std::endl;
       o << "dimensions:  " << __K << std::endl;
 
-      typedef KDTree<__K, _Val, _Acc, _Dist, _Cmp, _Alloc> _Tree;
+      typedef KDTree<__K, _Val, _Acc, _Dist, _Cmp, _Alloc, _Split, _Aggregate> _Tree;
       typedef typename _Tree::_Link_type _Link_type;
 
       std::stack<_Link_const_type> s;
@@ -14,6 +14,10 @@
 #include <cstddef>
 #include <cmath>
 
+#if __cplusplus >= 201103L
+#  include <utility>
+#endif
+
 namespace KDTree
 {
   struct _Node_base
@@ -24,11 +28,18 @@ namespace KDTree
     _Base_ptr _M_parent;
     _Base_ptr _M_left;
     _Base_ptr _M_right;
+    // the dimension this node splits its subtree on
+    unsigned int _M_dim;
+    // erased, but kept in the tree until it is compacted, see
+    // KDTree::set_lazy_erase(); skipped by the iterators and searches
+    bool _M_dead;
 
     _Node_base(_Base_ptr const __PARENT = NULL,
                _Base_ptr const __LEFT = NULL,
-               _Base_ptr const __RIGHT = NULL)
-      : _M_parent(__PARENT), _M_left(__LEFT), _M_right(__RIGHT) {}
+               _Base_ptr const __RIGHT = NULL,
+               size_t const __DIM = 0)
+      : _M_parent(__PARENT), _M_left(__LEFT), _M_right(__RIGHT),
+        _M_dim(static_cast<unsigned int>(__DIM)), _M_dead(false) {}
 
     static _Base_ptr
     _S_minimum(_Base_ptr __x)
@@ -45,6 +56,26 @@ namespace KDTree
     }
   };
 
+#ifdef KDTREE_DEFINE_OSTREAM_OPERATORS
+
+  template <typename Char, typename Traits>
+    std::basic_ostream<Char, Traits>&
+    operator<<(typename std::basic_ostream<Char, Traits>& out,
+               _Node_base const& node)
+    {
+      out << &node;
+      out << " parent: " << node._M_parent;
+      out << "; left: " << node._M_left;
+      out << "; right: " << node._M_right;
+      return out;
+    }
+
+#endif
+
+#if __cplusplus >= 201103L
+  struct _Emplace_tag {};
+#endif
+
   template <typename _Val>
     struct _Node : public _Node_base
     {
@@ -56,23 +87,26 @@ namespace KDTree
       _Node(_Val const& __VALUE = _Val(),
             _Base_ptr const __PARENT = NULL,
             _Base_ptr const __LEFT = NULL,
-            _Base_ptr const __RIGHT = NULL)
-        : _Node_base(__PARENT, __LEFT, __RIGHT), _M_value(__VALUE) {}
+            _Base_ptr const __RIGHT = NULL,
+            size_t const __DIM = 0)
+        : _Node_base(__PARENT, __LEFT, __RIGHT, __DIM), _M_value(__VALUE) {}
 
-#ifdef KDTREE_DEFINE_OSTREAM_OPERATORS
+#if __cplusplus >= 201103L
+      _Node(_Val&& __VALUE,
+            _Base_ptr const __PARENT = NULL,
+            _Base_ptr const __LEFT = NULL,
+            _Base_ptr const __RIGHT = NULL,
+            size_t const __DIM = 0)
+        : _Node_base(__PARENT, __LEFT, __RIGHT, __DIM),
+          _M_value(std::move(__VALUE)) {}
+
+      // constructs the value in place from __args
+      template <typename... _Args>
+        _Node(_Emplace_tag, _Args&&... __args)
+        : _Node_base(), _M_value(std::forward<_Args>(__args)...) {}
+#endif
 
-     template <typename Char, typename Traits>
-       friend
-       std::basic_ostream<Char, Traits>&
-       operator<<(typename std::basic_ostream<Char, Traits>& out,
-                  _Node_base const& node)
-       {
-         out << &node;
-         out << " parent: " << node._M_parent;
-         out << "; left: " << node._M_left;
-         out << "; right: " << node._M_right;
-         return out;
-       }
+#ifdef KDTREE_DEFINE_OSTREAM_OPERATORS
 
      template <typename Char, typename Traits>
        friend
@@ -85,12 +119,191 @@ namespace KDTree
          out << "; parent: " << node._M_parent;
          out << "; left: " << node._M_left;
          out << "; right: " << node._M_right;
+         out << "; dim: " << node._M_dim;
+         if (node._M_dead) out << "; dead";
          return out;
        }
 
 #endif
     };
 
+  /*! The _Aggregate parameter of a KDTree whose nodes keep nothing about
+      their subtree, the default.
+   */
+  struct no_aggregate {};
+
+  /*! The _Aggregate parameter of a KDTree whose nodes keep the number of
+      live values of their subtree, see KDTree::count_within_range().
+   */
+  struct subtree_sizes {};
+
+  /*! A node which also keeps the number of live values of its subtree.
+   */
+  template <typename _Val>
+    struct _Sized_node : public _Node<_Val>
+    {
+      typedef _Node_base::_Base_ptr _Base_ptr;
+
+      size_t _M_size;
+
+      _Sized_node(_Val const& __VALUE = _Val(),
+                  _Base_ptr const __PARENT = NULL,
+                  _Base_ptr const __LEFT = NULL,
+                  _Base_ptr const __RIGHT = NULL,
+                  size_t const __DIM = 0)
+        : _Node<_Val>(__VALUE, __PARENT, __LEFT, __RIGHT, __DIM),
+          _M_size(1) {}
+
+#if __cplusplus >= 201103L
+      _Sized_node(_Val&& __VALUE,
+                  _Base_ptr const __PARENT = NULL,
+                  _Base_ptr const __LEFT = NULL,
+                  _Base_ptr const __RIGHT = NULL,
+                  size_t const __DIM = 0)
+        : _Node<_Val>(std::move(__VALUE), __PARENT, __LEFT, __RIGHT, __DIM),
+          _M_size(1) {}
+
+      template <typename... _Args>
+        _Sized_node(_Emplace_tag, _Args&&... __args)
+        : _Node<_Val>(_Emplace_tag(), std::forward<_Args>(__args)...),
+          _M_size(1) {}
+#endif
+    };
+
+  /*! A node which also keeps the number and the aggregate, under the policy
+      _Aggregate, of the live values of its subtree.
+   */
+  template <typename _Val, typename _Aggregate>
+    struct _Aggregate_node : public _Sized_node<_Val>
+    {
+      typedef _Node_base::_Base_ptr _Base_ptr;
+      typedef typename _Aggregate::aggregate_type aggregate_type;
+
+      aggregate_type _M_aggregate;
+
+      _Aggregate_node(_Val const& __VALUE = _Val(),
+                      _Base_ptr const __PARENT = NULL,
+                      _Base_ptr const __LEFT = NULL,
+                      _Base_ptr const __RIGHT = NULL,
+                      size_t const __DIM = 0)
+        : _Sized_node<_Val>(__VALUE, __PARENT, __LEFT, __RIGHT, __DIM),
+          _M_aggregate(_Aggregate::identity()) {}
+
+#if __cplusplus >= 201103L
+      _Aggregate_node(_Val&& __VALUE,
+                      _Base_ptr const __PARENT = NULL,
+                      _Base_ptr const __LEFT = NULL,
+                      _Base_ptr const __RIGHT = NULL,
+                      size_t const __DIM = 0)
+        : _Sized_node<_Val>(std::move(__VALUE), __PARENT, __LEFT, __RIGHT,
+                            __DIM),
+          _M_aggregate(_Aggregate::identity()) {}
+
+      template <typename... _Args>
+        _Aggregate_node(_Emplace_tag, _Args&&... __args)
+        : _Sized_node<_Val>(_Emplace_tag(), std::forward<_Args>(__args)...),
+          _M_aggregate(_Aggregate::identity()) {}
+#endif
+    };
+
+  /*! The node type of a KDTree under the aggregate policy _Aggregate, and
+      how to set what a node keeps about its subtree from its children.  The
+      left subtree, the value of the node and the right subtree are combined
+      in this order, the order of iteration.  _S_sized tells whether the
+      nodes keep the number of live values of their subtree; _S_size()
+      gives it, counting the nodes when they do not keep it.
+   */
+  template <typename _Val, typename _Aggregate>
+    struct _Node_aggregate
+    {
+      typedef _Aggregate_node<_Val, _Aggregate> _Node_type;
+      typedef typename _Aggregate::aggregate_type aggregate_type;
+
+      static const bool _S_sized = true;
+
+      static size_t
+      _S_size(_Node_base const* const __N)
+      { return static_cast<_Node_type const*>(__N)->_M_size; }
+
+      static void
+      _S_update(_Node_type* const __N)
+      {
+        aggregate_type __a = __N->_M_left ? _S_aggregate(__N->_M_left) : _Aggregate::identity();
+        if (!__N->_M_dead)
+          __a = _Aggregate::combine(__a, _Aggregate::lift(__N->_M_value));
+        if (__N->_M_right)
+          __a = _Aggregate::combine(__a, _S_aggregate(__N->_M_right));
+        __N->_M_aggregate = __a;
+        __N->_M_size = !__N->_M_dead
+          + (__N->_M_left ? _S_size(__N->_M_left) : 0)
+          + (__N->_M_right ? _S_size(__N->_M_right) : 0);
+      }
+
+    private:
+      static aggregate_type const&
+      _S_aggregate(_Node_base const* const __N)
+      { return static_cast<_Node_type const*>(__N)->_M_aggregate; }
+    };
+
+  template <typename _Val>
+    struct _Node_aggregate<_Val, subtree_sizes>
+    {
+      typedef _Sized_node<_Val> _Node_type;
+      typedef void aggregate_type;
+
+      static const bool _S_sized = true;
+
+      static size_t
+      _S_size(_Node_base const* const __N)
+      { return static_cast<_Node_type const*>(__N)->_M_size; }
+
+      static void
+      _S_update(_Node_type* const __N)
+      {
+        __N->_M_size = !__N->_M_dead
+          + (__N->_M_left ? _S_size(__N->_M_left) : 0)
+          + (__N->_M_right ? _S_size(__N->_M_right) : 0);
+      }
+    };
+
+  template <typename _Val>
+    struct _Node_aggregate<_Val, no_aggregate>
+    {
+      typedef _Node<_Val> _Node_type;
+      typedef void aggregate_type;
+
+      static const bool _S_sized = false;
+
+      static size_t
+      _S_size(_Node_base const* __N)
+      {
+        size_t __size = 0;
+        for (; __N; __N = __N->_M_right)
+          __size += !__N->_M_dead + _S_size(__N->_M_left);
+        return __size;
+      }
+
+      static void
+      _S_update(_Node_type* const)
+      { }
+    };
+
+  /*! A node of a CompactKDTree.  It has no parent link and no left link:
+      the nodes lie in one array in the pre-order of the tree, so that the
+      left child of a node, if any, comes right after it.  The right child
+      is found by its 32-bit index.
+   */
+  template <typename _Val>
+    struct _Compact_node
+    {
+      _Val _M_value;
+      // the index of the right child, which is also one past the end of the
+      // left subtree
+      unsigned int _M_right;
+      // the dimension this node splits its subtree on
+      unsigned int _M_dim;
+    };
+
   template <typename _Val, typename _Acc, typename _Cmp>
     class _Node_compare
     {
@@ -185,6 +398,12 @@ namespace KDTree
     If many nodes are equidistant to __val, the node with the lowest memory
     address is returned.
 
+    The nodes are compared on the dimension stored in each of them, __dim is
+    only returned as the dimension of the best node.
+
+    __max and the distance returned are sums of _Dist over the dimensions,
+    see distance_traits.
+
     \return the nearest node of __end node if no nearest node was found for the
     given arguments.
    */
@@ -203,17 +422,15 @@ namespace KDTree
   {
      typedef const NodeType* NodePtr;
     NodePtr pcur = __node;
-    NodePtr cur = _S_node_descend(__dim % __k, __cmp, __acc, __val, __node);
-    size_t cur_dim = __dim+1;
+    NodePtr cur = _S_node_descend(__node->_M_dim, __cmp, __acc, __val, __node);
     // find the smallest __max distance in direct descent
     while (cur)
       {
-	if (__p(cur->_M_value))
+	if (!cur->_M_dead && __p(cur->_M_value))
 	  {
 	    typename _Dist::distance_type d = 0;
 	    for (size_t i=0; i != __k; ++i)
 	      d += _S_node_distance(i, __dist, __acc, __val, cur->_M_value);
-       d = std::sqrt(d);
 	    if (d <= __max)
           // ("bad candidate notes")
           // Changed: removed this test: || ( d == __max && cur < __best ))
@@ -222,39 +439,35 @@ namespace KDTree
 	      {
 		__best = cur;
 		__max = d;
-		__dim = cur_dim;
+		__dim = cur->_M_dim;
 	      }
 	  }
 	pcur = cur;
-	cur = _S_node_descend(cur_dim % __k, __cmp, __acc, __val, cur);
-	++cur_dim;
+	cur = _S_node_descend(cur->_M_dim, __cmp, __acc, __val, cur);
       }
     // Swap cur to prev, only prev is a valid node.
     cur = pcur;
-    --cur_dim;
     pcur = NULL;
     // Probe all node's children not visited yet (siblings of the visited nodes).
     NodePtr probe = cur;
     NodePtr pprobe = probe;
     NodePtr near_node;
     NodePtr far_node;
-    size_t probe_dim = cur_dim;
-    if (_S_node_compare(probe_dim % __k, __cmp, __acc, __val, probe->_M_value))
+    if (_S_node_compare(probe->_M_dim, __cmp, __acc, __val, probe->_M_value))
       near_node = static_cast<NodePtr>(probe->_M_right);
     else
       near_node = static_cast<NodePtr>(probe->_M_left);
     if (near_node
 	// only visit node's children if node's plane intersect hypersphere
-	&& (std::sqrt(_S_node_distance(probe_dim % __k, __dist, __acc, __val, probe->_M_value)) <= __max))
+	&& (_S_node_distance(probe->_M_dim, __dist, __acc, __val, probe->_M_value) <= __max))
       {
 	probe = near_node;
-	++probe_dim;
       }
     while (cur != __end)
       {
 	while (probe != cur)
 	  {
-	    if (_S_node_compare(probe_dim % __k, __cmp, __acc, __val, probe->_M_value))
+	    if (_S_node_compare(probe->_M_dim, __cmp, __acc, __val, probe->_M_value))
 	      {
 		near_node = static_cast<NodePtr>(probe->_M_left);
 		far_node = static_cast<NodePtr>(probe->_M_right);
@@ -266,62 +479,54 @@ namespace KDTree
 	      }
 	    if (pprobe == probe->_M_parent) // going downward ...
 	      {
-		if (__p(probe->_M_value))
+		if (!probe->_M_dead && __p(probe->_M_value))
 		  {
 		    typename _Dist::distance_type d = 0;
 		    for (size_t i=0; i < __k; ++i)
 		      d += _S_node_distance(i, __dist, __acc, __val, probe->_M_value);
-          d = std::sqrt(d);
           if (d <= __max)  // CHANGED, see the above notes ("bad candidate notes")
 		      {
 			__best = probe;
 			__max = d;
-			__dim = probe_dim;
+			__dim = probe->_M_dim;
 		      }
 		  }
 		pprobe = probe;
 		if (near_node)
 		  {
 		    probe = near_node;
-		    ++probe_dim;
 		  }
 		else if (far_node &&
 			 // only visit node's children if node's plane intersect hypersphere
-			 std::sqrt(_S_node_distance(probe_dim % __k, __dist, __acc, __val, probe->_M_value)) <= __max)
+			 _S_node_distance(probe->_M_dim, __dist, __acc, __val, probe->_M_value) <= __max)
 		  {
 		    probe = far_node;
-		    ++probe_dim;
 		  }
 		else
 		  {
 		    probe = static_cast<NodePtr>(probe->_M_parent);
-		    --probe_dim;
 		  }
 	      }
 	    else // ... and going upward.
 	      {
 		if (pprobe == near_node && far_node
 		    // only visit node's children if node's plane intersect hypersphere
-		    && std::sqrt(_S_node_distance(probe_dim % __k, __dist, __acc, __val, probe->_M_value)) <= __max)
+		    && _S_node_distance(probe->_M_dim, __dist, __acc, __val, probe->_M_value) <= __max)
 		  {
 		    pprobe = probe;
 		    probe = far_node;
-		    ++probe_dim;
 		  }
 		else
 		  {
 		    pprobe = probe;
 		    probe = static_cast<NodePtr>(probe->_M_parent);
-		    --probe_dim;
 		  }
 	      }
 	  }
 	pcur = cur;
 	cur = static_cast<NodePtr>(cur->_M_parent);
-	--cur_dim;
 	pprobe = cur;
 	probe = cur;
-	probe_dim = cur_dim;
 	if (cur != __end)
 	  {
 	    if (pcur == cur->_M_left)
@@ -330,10 +535,9 @@ namespace KDTree
 	      near_node = static_cast<NodePtr>(cur->_M_left);
 	    if (near_node
 		// only visit node's children if node's plane intersect hypersphere
-		&& (std::sqrt(_S_node_distance(cur_dim % __k, __dist, __acc, __val, cur->_M_value)) <= __max))
+		&& (_S_node_distance(cur->_M_dim, __dist, __acc, __val, cur->_M_value) <= __max))
 	      {
 		probe = near_node;
-		++probe_dim;
 	      }
 	  }
       }
@@ -0,0 +1,291 @@
+/** \file
+ * Defines what the bulk builds of KDTree need to run on several threads
+ * with OpenMP: carrying exceptions out of the threads, and partitioning a
+ * large range with several tasks, which the split policies use at the top
+ * levels of the tree, where a single range holds most of the values.
+ */
+
+#ifndef INCLUDE_KDTREE_PARALLEL_HPP
+#define INCLUDE_KDTREE_PARALLEL_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+#if __cplusplus >= 201103L
+#  include <exception>
+#endif
+
+//  The bulk builds and build_neighbour_lists() run on several threads when
+//  compiled with OpenMP.  An exception cannot leave an OpenMP thread, so it
+//  is carried out as a std::exception_ptr, which needs C++11; before that,
+//  they run on a single thread.
+#if defined(_OPENMP) && __cplusplus >= 201103L
+#  define KDTREE_PARALLEL
+#endif
+
+//  Below this many values, a range is partitioned, and a subtree built, by
+//  a single thread.  It may be defined before including the library.
+#ifndef KDTREE_PARALLEL_THRESHOLD
+#  define KDTREE_PARALLEL_THRESHOLD (1 << 14)
+#endif
+
+namespace KDTree
+{
+
+  // Carries the first exception thrown on an OpenMP thread out of the
+  // parallel region, to be thrown again once every thread is done.
+  struct _Parallel_error
+  {
+#ifdef KDTREE_PARALLEL
+    void
+    _M_catch()
+    {
+#     pragma omp critical (kdtree_parallel_error)
+      if (!_M_ptr)
+        _M_ptr = std::current_exception();
+    }
+
+    void
+    _M_rethrow() const
+    {
+      if (_M_ptr)
+        std::rethrow_exception(_M_ptr);
+    }
+
+    std::exception_ptr _M_ptr;
+#else
+    void
+    _M_rethrow() const
+    { }
+#endif
+  };
+
+  //! Move the values of [__A,__B) for which __pred holds to the front, by
+  //! swaps, and return the end of them.
+  template <typename _Iter, typename _Predicate>
+    inline _Iter
+    _S_partition(_Iter const& __A, _Iter const& __B, _Predicate const& __pred)
+    {
+      _Iter __m = __A;
+      for (_Iter __v = __A; __v != __B; ++__v)
+        if (__pred(*__v))
+          std::iter_swap(__v, __m++);
+      return __m;
+    }
+
+  // Runs of positions, numbered one after the other: the __i-th run starts
+  // at _M_at[__i] and holds the positions numbered _M_rank[__i] to
+  // _M_rank[__i + 1].
+  struct _Parallel_runs
+  {
+    _Parallel_runs() : _M_rank(1, 0) { }
+
+    void
+    _M_add(std::size_t const __at, std::size_t const __length)
+    {
+      if (!__length) return;
+      _M_at.push_back(__at);
+      _M_rank.push_back(_M_rank.back() + __length);
+    }
+
+    std::vector<std::size_t> _M_at;
+    std::vector<std::size_t> _M_rank;
+  };
+
+  // Swaps the positions numbered __first to __last in __left with those
+  // numbered the same in __right.
+  template <typename _Iter>
+    void
+    _S_swap_runs(_Iter const __A, _Parallel_runs const* const __left,
+                 _Parallel_runs const* const __right, std::size_t __first,
+                 std::size_t const __last)
+    {
+      std::size_t __i = std::upper_bound(__left->_M_rank.begin(),
+                                         __left->_M_rank.end(), __first)
+        - __left->_M_rank.begin() - 1;
+      std::size_t __j = std::upper_bound(__right->_M_rank.begin(),
+                                         __right->_M_rank.end(), __first)
+        - __right->_M_rank.begin() - 1;
+      for (; __first != __last; ++__first)
+        {
+          while (__left->_M_rank[__i + 1] <= __first) ++__i;
+          while (__right->_M_rank[__j + 1] <= __first) ++__j;
+          std::iter_swap(__A + (__left->_M_at[__i]
+                                + (__first - __left->_M_rank[__i])),
+                         __A + (__right->_M_at[__j]
+                                + (__first - __right->_M_rank[__j])));
+        }
+    }
+
+  /*! Move the values of [__A,__B) for which __pred holds to the front, and
+      return the end of them, as _S_partition().
+
+      A range of KDTREE_PARALLEL_THRESHOLD values or more is cut into blocks
+      of a quarter of that size, each partitioned by its own OpenMP task.
+      The values left on the wrong side of the end are then swapped across,
+      again by one task per block.  The order reached depends only on the
+      size of the range, not on the number of threads.  If __pred throws,
+      the values are left in some order and the exception is thrown once
+      all the tasks are done.
+   */
+  template <typename _Iter, typename _Predicate>
+    _Iter
+    _S_parallel_partition(_Iter const __A, _Iter const __B,
+                          _Predicate const __pred)
+    {
+#ifndef KDTREE_PARALLEL
+      return _S_partition(__A, __B, __pred);
+#else
+      std::size_t const __n = __B - __A;
+      if (__n < std::size_t(KDTREE_PARALLEL_THRESHOLD))
+        return _S_partition(__A, __B, __pred);
+      std::size_t const __block = (KDTREE_PARALLEL_THRESHOLD + 3) / 4;
+      std::size_t const __blocks = (__n + __block - 1) / __block;
+      // how many values of each block __pred holds for
+      std::vector<std::size_t> __held(__blocks);
+      std::size_t* const __h = &__held[0];
+      _Parallel_error __error;
+      _Parallel_error* const __e = &__error;
+      for (std::size_t __b = 0; __b != __blocks; ++__b)
+        {
+#         pragma omp task
+          try
+            {
+              _Iter const __first = __A + __b * __block;
+              _Iter const __last
+                = __b + 1 == __blocks ? __B : __first + __block;
+              __h[__b] = _S_partition(__first, __last, __pred) - __first;
+            }
+          catch (...)
+            {
+              __e->_M_catch();
+            }
+        }
+#     pragma omp taskwait
+      __error._M_rethrow();
+
+      std::size_t __end = 0;
+      for (std::size_t __b = 0; __b != __blocks; ++__b)
+        __end += __held[__b];
+      // the values before __end __pred does not hold for, and those after
+      // it it holds for, as many of each
+      _Parallel_runs __left, __right;
+      for (std::size_t __b = 0; __b != __blocks; ++__b)
+        {
+          std::size_t const __first = __b * __block;
+          std::size_t const __last = std::min(__first + __block, __n);
+          std::size_t const __mid = __first + __held[__b];
+          if (__mid < __end)
+            __left._M_add(__mid, std::min(__last, __end) - __mid);
+          if (__end < __mid)
+            __right._M_add(std::max(__first, __end),
+                           __mid - std::max(__first, __end));
+        }
+      std::size_t const __wrong = __left._M_rank.back();
+      _Parallel_runs const* const __l = &__left;
+      _Parallel_runs const* const __r = &__right;
+      for (std::size_t __k = 0; __k < __wrong; __k += __block)
+        {
+#         pragma omp task
+          try
+            {
+              _S_swap_runs(__A, __l, __r, __k,
+                           std::min(__k + __block, __wrong));
+            }
+          catch (...)
+            {
+              __e->_M_catch();
+            }
+        }
+#     pragma omp taskwait
+      __error._M_rethrow();
+      return __A + __end;
+#endif
+    }
+
+  // Tells the values that compare below the one at _M_pivot.
+  template <typename _Iter, typename _Compare>
+    struct _Below_pivot
+    {
+      _Below_pivot(_Iter const& __pivot, _Compare const& __cmp)
+        : _M_pivot(__pivot), _M_cmp(__cmp) { }
+
+      template <typename _Val>
+        bool
+        operator()(_Val const& __v) const { return _M_cmp(__v, *_M_pivot); }
+
+      _Iter _M_pivot;
+      _Compare _M_cmp;
+    };
+
+  // Tells the values that do not compare above the one at _M_pivot.
+  template <typename _Iter, typename _Compare>
+    struct _Not_above_pivot
+    {
+      _Not_above_pivot(_Iter const& __pivot, _Compare const& __cmp)
+        : _M_pivot(__pivot), _M_cmp(__cmp) { }
+
+      template <typename _Val>
+        bool
+        operator()(_Val const& __v) const { return !_M_cmp(*_M_pivot, __v); }
+
+      _Iter _M_pivot;
+      _Compare _M_cmp;
+    };
+
+  /*! Reorder [__A,__B) around __nth as std::nth_element() does.
+
+      While the range holds KDTREE_PARALLEL_THRESHOLD values or more, the
+      median of 31 values spread over it is taken as pivot, and the range is
+      split by _S_parallel_partition() into the values below the pivot, those
+      equal to it and those above it; only the part holding __nth is kept.
+      std::nth_element() finishes the rest.
+   */
+  template <typename _Iter, typename _Compare>
+    void
+    _S_parallel_nth_element(_Iter __A, _Iter const __nth, _Iter __B,
+                            _Compare const& __cmp)
+    {
+#ifdef KDTREE_PARALLEL
+      std::size_t const __samples = 31;
+      while (std::size_t(__B - __A) >= std::size_t(KDTREE_PARALLEL_THRESHOLD)
+             && std::size_t(__B - __A) > __samples)
+        {
+          std::size_t const __step = (__B - __A) / __samples;
+          for (std::size_t __i = 1; __i != __samples; ++__i)
+            std::iter_swap(__A + __i, __A + __i * __step);
+          std::nth_element(__A, __A + __samples / 2, __A + __samples, __cmp);
+          // the pivot stays at __A, out of the partitions
+          std::iter_swap(__A, __A + __samples / 2);
+          _Iter const __equal = _S_parallel_partition
+            (__A + 1, __B, _Below_pivot<_Iter, _Compare>(__A, __cmp));
+          _Iter const __above = _S_parallel_partition
+            (__equal, __B, _Not_above_pivot<_Iter, _Compare>(__A, __cmp));
+          std::iter_swap(__A, __equal - 1);
+          if (__nth < __equal - 1)
+            __B = __equal - 1;
+          else if (__nth < __above)
+            return;
+          else
+            __A = __above;
+        }
+#endif
+      std::nth_element(__A, __nth, __B, __cmp);
+    }
+
+} // namespace KDTree
+
+#endif // include guard
+
+/* COPYRIGHT --
+ *
+ * This file is part of libkdtree++, a C++ template KD-Tree sorting container.
+ * libkdtree++ is (c) 2004-2007 Martin F. Krafft <libkdtree@pobox.madduck.net>
+ * and Sylvain Bougerel <sylvain.bougerel.devel@gmail.com> distributed under the
+ * terms of the Artistic License 2.0. See the ./COPYING file in the source tree
+ * root for more information.
+ *
+ * THIS PACKAGE IS PROVIDED "AS IS" AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES
+ * OF MERCHANTIBILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
@@ -0,0 +1,152 @@
+/** \file
+ * Defines periodic_box, the description of a space whose dimensions may wrap
+ * around, as in a simulation with periodic boundary conditions.
+ *
+ * On a periodic dimension, the values lie in [low, high) and a coordinate
+ * x is the same position as x + (high - low).  The distance between two
+ * values is then the distance between their nearest images.  The tree is
+ * built from the values as they are, without ghost copies near the
+ * boundaries; the searches taking a periodic_box move the query instead (see
+ * KDTree::find_nearest_periodic() and KDTree::find_within_range_periodic()).
+ */
+
+#ifndef INCLUDE_KDTREE_PERIODIC_HPP
+#define INCLUDE_KDTREE_PERIODIC_HPP
+
+#include <cmath>
+#include <cstddef>
+#include <limits>
+
+namespace KDTree
+{
+
+  //! __x modulo __p, in [0, __p).
+  template <bool _Integer>
+    struct _Modulo
+    {
+      template <typename _Tp>
+        static _Tp
+        _S_apply(_Tp const __x, _Tp const __p)
+        {
+          _Tp const __r = __x - __p * std::floor(__x / __p);
+          // the rounding can give __p itself for a tiny negative __x
+          return __r < __p ? __r : _Tp();
+        }
+    };
+
+  template <>
+    struct _Modulo<true>
+    {
+      template <typename _Tp>
+        static _Tp
+        _S_apply(_Tp const __x, _Tp const __p)
+        {
+          _Tp const __r = __x % __p;
+          return __r < 0 ? __r + __p : __r;
+        }
+    };
+
+  template <size_t const __K, typename _SubVal>
+    class periodic_box
+    {
+    public:
+      typedef _SubVal subvalue_type;
+
+      //! A box with no periodic dimension.
+      periodic_box()
+      {
+        for (size_t __i = 0; __i != __K; ++__i)
+          {
+            _M_periodic[__i] = false;
+            _M_low[__i] = _M_high[__i] = subvalue_type();
+          }
+      }
+
+      //! Make __dim wrap around from __high back to __low, __low < __high.
+      periodic_box&
+      set_periodic(size_t const __dim, subvalue_type const __low,
+                   subvalue_type const __high)
+      {
+        _M_periodic[__dim] = true;
+        _M_low[__dim] = __low;
+        _M_high[__dim] = __high;
+        return *this;
+      }
+
+      //! Make __dim unbounded again.
+      periodic_box&
+      set_open(size_t const __dim)
+      {
+        _M_periodic[__dim] = false;
+        return *this;
+      }
+
+      bool
+      is_periodic(size_t const __dim) const
+      { return _M_periodic[__dim]; }
+
+      subvalue_type
+      low(size_t const __dim) const
+      { return _M_low[__dim]; }
+
+      subvalue_type
+      high(size_t const __dim) const
+      { return _M_high[__dim]; }
+
+      subvalue_type
+      period(size_t const __dim) const
+      { return _M_high[__dim] - _M_low[__dim]; }
+
+      //! The image of __x in [low, high) on __dim, or __x if __dim is open.
+      subvalue_type
+      wrap(size_t const __dim, subvalue_type const __x) const
+      {
+        if (!_M_periodic[__dim]
+            || (!(__x < _M_low[__dim]) && __x < _M_high[__dim]))
+          return __x;
+        return _S_wrap(__x - _M_low[__dim], period(__dim))
+          + _M_low[__dim];
+      }
+
+      /*! The difference __a - __b between the nearest images of __a and __b
+	on __dim, which is at most half a period either way.
+       */
+      subvalue_type
+      difference(size_t const __dim, subvalue_type const __a,
+                 subvalue_type const __b) const
+      {
+        if (!_M_periodic[__dim])
+          return __a - __b;
+        subvalue_type const __p = period(__dim);
+        subvalue_type const __d = _S_wrap(__a - __b, __p);
+        return __p < __d + __d ? __d - __p : __d;
+      }
+
+    private:
+      static subvalue_type
+      _S_wrap(subvalue_type const __x, subvalue_type const __p)
+      {
+        return _Modulo<std::numeric_limits<subvalue_type>::is_integer>
+          ::_S_apply(__x, __p);
+      }
+
+      subvalue_type _M_low[__K], _M_high[__K];
+      bool _M_periodic[__K];
+    };
+
+} // namespace KDTree
+
+#endif // include guard
+
+/* COPYRIGHT --
+ *
+ * This file is part of libkdtree++, a C++ template KD-Tree sorting container.
+ * libkdtree++ is (c) 2004-2007 Martin F. Krafft <libkdtree@pobox.madduck.net>
+ * and Sylvain Bougerel <sylvain.bougerel.devel@gmail.com> distributed under the
+ * terms of the Artistic License 2.0. See the ./COPYING file in the source tree
+ * root for more information.
+ *
+ * THIS PACKAGE IS PROVIDED "AS IS" AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES
+ * OF MERCHANTIBILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
@@ -0,0 +1,327 @@
+/** \file
+ * Defines the split policies used by KDTree when it builds a balanced tree.
+ *
+ * A split policy chooses, for the values of a subtree, the dimension on which
+ * they are partitioned and the value that becomes the root of the subtree.
+ * The chosen dimension is stored in the node, and all the searches use the
+ * stored dimension, so any choice gives a valid tree; the policy only decides
+ * how well the cells fit the data.
+ *
+ * A policy provides
+ *
+ *   template <size_t const __K, typename _Iter, typename _Acc, typename _Cmp>
+ *     static _Iter
+ *     split(_Iter const& __A, _Iter const& __B, size_t const __L,
+ *           _Acc const& __acc, _Cmp const& __cmp, size_t& __dim);
+ *
+ * which sets __dim and reorders [__A,__B) around the returned element, so
+ * that no value before it compares greater and no value after it compares
+ * smaller on __dim.  __L is the depth of the subtree.
+ */
+
+#ifndef INCLUDE_KDTREE_SPLIT_HPP
+#define INCLUDE_KDTREE_SPLIT_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+
+#include "node.hpp"
+#include "parallel.hpp"
+
+namespace KDTree
+{
+
+  //! The smallest and largest value of [__A,__B) in each dimension.
+  template <size_t const __K, typename _Iter, typename _Acc, typename _Cmp>
+    inline void
+    _S_split_bounds(_Iter const& __A, _Iter const& __B,
+                    _Acc const& __acc, _Cmp const& __cmp,
+                    typename _Acc::result_type* __low,
+                    typename _Acc::result_type* __high)
+    {
+      typedef typename _Acc::result_type subvalue_type;
+      for (size_t __i = 0; __i != __K; ++__i)
+        __low[__i] = __high[__i] = __acc(*__A, __i);
+      for (_Iter __v = __A + 1; __v != __B; ++__v)
+        for (size_t __i = 0; __i != __K; ++__i)
+          {
+            subvalue_type const __x = __acc(*__v, __i);
+            if (__cmp(__x, __low[__i])) __low[__i] = __x;
+            else if (__cmp(__high[__i], __x)) __high[__i] = __x;
+          }
+    }
+
+  // Tells the values that compare below _M_value on _M_dim.
+  template <typename _Acc, typename _Cmp>
+    struct _Below_value
+    {
+      typedef typename _Acc::result_type subvalue_type;
+
+      _Below_value(size_t const __dim, subvalue_type const& __value,
+                   _Acc const& __acc, _Cmp const& __cmp)
+        : _M_dim(__dim), _M_value(__value), _M_acc(__acc), _M_cmp(__cmp) { }
+
+      template <typename _Val>
+        bool
+        operator()(_Val const& __v) const
+        { return _M_cmp(_M_acc(__v, _M_dim), _M_value); }
+
+      size_t _M_dim;
+      subvalue_type _M_value;
+      _Acc _M_acc;
+      _Cmp _M_cmp;
+    };
+
+  /*! Split [__A,__B) on __dim at the smallest value that is not below
+      __value, and return where that value ends up.
+
+      There must be such a value.  The values before the returned element all
+      compare smaller on __dim.  A large range is partitioned by several
+      threads, see _S_parallel_partition().
+   */
+  template <typename _Iter, typename _Acc, typename _Cmp>
+    _Iter
+    _S_split_at(_Iter const& __A, _Iter const& __B, size_t const __dim,
+                typename _Acc::result_type const& __value,
+                _Acc const& __acc, _Cmp const& __cmp)
+    {
+      _Iter const __m = _S_parallel_partition
+        (__A, __B, _Below_value<_Acc, _Cmp>(__dim, __value, __acc, __cmp));
+      _Iter __pivot = __m;
+      for (_Iter __v = __m + 1; __v < __B; ++__v)
+        if (__cmp(__acc(*__v, __dim), __acc(*__pivot, __dim)))
+          __pivot = __v;
+      std::iter_swap(__m, __pivot);
+      return __m;
+    }
+
+  //! Split at the median of [__A,__B) on __dim, on several threads if the
+  //! range is large, see _S_parallel_nth_element().
+  template <typename _Iter, typename _Acc, typename _Cmp>
+    inline _Iter
+    _S_split_at_median(_Iter const& __A, _Iter const& __B, size_t const __dim,
+                       _Acc const& __acc, _Cmp const& __cmp)
+    {
+      typedef typename std::iterator_traits<_Iter>::value_type _Val;
+      _Iter __m = __A + (__B - __A) / 2;
+      _S_parallel_nth_element
+        (__A, __m, __B, _Node_compare<_Val, _Acc, _Cmp>(__dim, __acc, __cmp));
+      return __m;
+    }
+
+  /*! Split at the median, on the dimension chosen by _Dimension.
+
+      The tree is perfectly balanced.  _Dimension provides
+
+        template <size_t const __K, typename _Iter, typename _Acc, typename _Cmp>
+          static size_t
+          dimension(_Iter const& __A, _Iter const& __B, size_t const __L,
+                    _Acc const& __acc, _Cmp const& __cmp);
+   */
+  template <typename _Dimension>
+    struct median_split
+    {
+      template <size_t const __K, typename _Iter, typename _Acc, typename _Cmp>
+        static _Iter
+        split(_Iter const& __A, _Iter const& __B, size_t const __L,
+              _Acc const& __acc, _Cmp const& __cmp, size_t& __dim)
+        {
+          __dim = _Dimension::template dimension<__K>(__A, __B, __L,
+                                                      __acc, __cmp);
+          return _S_split_at_median(__A, __B, __dim, __acc, __cmp);
+        }
+    };
+
+  /*! Split the nodes at depth L on dimension L % __K, at the median.
+
+      This is the classical kd-tree and the default policy.
+   */
+  struct cyclic_split : median_split<cyclic_split>
+  {
+    template <size_t const __K, typename _Iter, typename _Acc, typename _Cmp>
+      static size_t
+      dimension(_Iter const&, _Iter const&, size_t const __L,
+                _Acc const&, _Cmp const&)
+      {
+        return __L % __K;
+      }
+  };
+
+  /*! Split on the dimension in which the values spread the most, at the
+      median.
+
+      The cells then stay close to cubes even when the data is not, eg. thin
+      slabs or elongated clusters, which saves visiting nodes in the
+      searches.  It costs one pass over the values of each subtree to find
+      their bounding box.
+   */
+  struct max_spread_split : median_split<max_spread_split>
+  {
+    template <size_t const __K, typename _Iter, typename _Acc, typename _Cmp>
+      static size_t
+      dimension(_Iter const& __A, _Iter const& __B, size_t const __L,
+                _Acc const& __acc, _Cmp const& __cmp)
+      {
+        typedef typename _Acc::result_type subvalue_type;
+        if (__B - __A < 2) return __L % __K;
+        subvalue_type __low[__K], __high[__K];
+        _S_split_bounds<__K>(__A, __B, __acc, __cmp, __low, __high);
+        size_t __best = __L % __K;
+        subvalue_type __best_spread = __high[__best] - __low[__best];
+        for (size_t __i = 0; __i != __K; ++__i)
+          if (__cmp(__best_spread, __high[__i] - __low[__i]))
+            {
+              __best = __i;
+              __best_spread = __high[__i] - __low[__i];
+            }
+        return __best;
+      }
+  };
+
+  /*! Split the bounding box of the values in its middle, on its longest
+      side, and slide the split onto the nearest value above the middle.
+
+      Unlike the median, the cells do not follow the density of the values:
+      clusters get small cells of their own and large empty regions are cut
+      off early, so nearest neighbour searches in clustered data visit far
+      fewer nodes.  The tree is not balanced any more, its depth depends on
+      the data.  The coordinates must support + and / 2.
+   */
+  struct sliding_midpoint_split
+  {
+    template <size_t const __K, typename _Iter, typename _Acc, typename _Cmp>
+      static _Iter
+      split(_Iter const& __A, _Iter const& __B, size_t const __L,
+            _Acc const& __acc, _Cmp const& __cmp, size_t& __dim)
+      {
+        typedef typename _Acc::result_type subvalue_type;
+        __dim = __L % __K;
+        if (__B - __A < 3)
+          return _S_split_at_median(__A, __B, __dim, __acc, __cmp);
+        subvalue_type __low[__K], __high[__K];
+        _S_split_bounds<__K>(__A, __B, __acc, __cmp, __low, __high);
+        for (size_t __i = 0; __i != __K; ++__i)
+          if (__cmp(__high[__dim] - __low[__dim], __high[__i] - __low[__i]))
+            __dim = __i;
+        // all the values are the same
+        if (!__cmp(__low[__dim], __high[__dim]))
+          return _S_split_at_median(__A, __B, __dim, __acc, __cmp);
+        subvalue_type const __middle = (__low[__dim] + __high[__dim]) / 2;
+        return _S_split_at(__A, __B, __dim, __middle, __acc, __cmp);
+      }
+  };
+
+  /*! Choose the split that minimises the expected cost of a search.
+
+      The cost of a split is the number of values on each side weighted by
+      the surface area of that side's bounding box, the probability that a
+      search visits it.  __Bins evenly spaced positions are tried on every
+      dimension, and the value just above the best one becomes the root of
+      the subtree.  Subtrees with fewer than 2 * __Bins values are split at
+      the median.  The coordinates must convert to double.
+   */
+  template <size_t const __Bins = 16>
+    struct cost_model_split
+    {
+      template <size_t const __K, typename _Iter, typename _Acc, typename _Cmp>
+        static _Iter
+        split(_Iter const& __A, _Iter const& __B, size_t const __L,
+              _Acc const& __acc, _Cmp const& __cmp, size_t& __dim)
+        {
+          typedef typename _Acc::result_type subvalue_type;
+          __dim = __L % __K;
+          if (size_t(__B - __A) < 2 * __Bins)
+            return _S_split_at_median(__A, __B, __dim, __acc, __cmp);
+
+          subvalue_type __low[__K], __high[__K];
+          _S_split_bounds<__K>(__A, __B, __acc, __cmp, __low, __high);
+          double __extent[__K];
+          for (size_t __i = 0; __i != __K; ++__i)
+            __extent[__i] = double(__high[__i]) - double(__low[__i]);
+
+          double __best_cost = 0;
+          double __best_position = 0;
+          bool __found = false;
+          for (size_t __d = 0; __d != __K; ++__d)
+            {
+              if (!(__extent[__d] > 0)) continue;
+              double const __width = __extent[__d] / __Bins;
+              size_t __counts[__Bins] = { 0 };
+              for (_Iter __v = __A; __v != __B; ++__v)
+                {
+                  size_t __bin = size_t((double(__acc(*__v, __d))
+                                         - double(__low[__d])) / __width);
+                  __counts[__bin < __Bins ? __bin : __Bins - 1] += 1;
+                }
+              size_t __below = 0;
+              for (size_t __b = 1; __b != __Bins; ++__b)
+                {
+                  __below += __counts[__b - 1];
+                  if (__below == 0 || __below == size_t(__B - __A)) continue;
+                  double const __cut = __b * __width;
+                  double const __cost
+                    = __below * _S_area<__K>(__extent, __d, __cut)
+                    + (__B - __A - __below)
+                      * _S_area<__K>(__extent, __d, __extent[__d] - __cut);
+                  if (!__found || __cost < __best_cost)
+                    {
+                      __found = true;
+                      __best_cost = __cost;
+                      __best_position = double(__low[__d]) + __cut;
+                      __dim = __d;
+                    }
+                }
+            }
+          if (!__found)
+            return _S_split_at_median(__A, __B, __dim, __acc, __cmp);
+          // the values below the cut all compare below the first value
+          // above it, which has to be found with the coordinate type
+          _Iter __above = __B;
+          for (_Iter __v = __A; __v != __B; ++__v)
+            if (double(__acc(*__v, __dim)) >= __best_position
+                && (__above == __B
+                    || __cmp(__acc(*__v, __dim), __acc(*__above, __dim))))
+              __above = __v;
+          if (__above == __B)
+            return _S_split_at_median(__A, __B, __dim, __acc, __cmp);
+          subvalue_type const __value = __acc(*__above, __dim);
+          return _S_split_at(__A, __B, __dim, __value, __acc, __cmp);
+        }
+
+    private:
+      // the surface area of a box whose side __d is replaced by __side
+      template <size_t const __K>
+        static double
+        _S_area(double const* __extent, size_t const __d, double const __side)
+        {
+          if (__K == 1) return 1;
+          double __area = 0;
+          for (size_t __i = 0; __i != __K; ++__i)
+            {
+              double __face = 1;
+              for (size_t __j = 0; __j != __K; ++__j)
+                if (__j != __i)
+                  __face *= (__j == __d) ? __side : __extent[__j];
+              __area += __face;
+            }
+          return __area;
+        }
+    };
+
+} // namespace KDTree
+
+#endif // include guard
+
+/* COPYRIGHT --
+ *
+ * This file is part of libkdtree++, a C++ template KD-Tree sorting container.
+ * libkdtree++ is (c) 2004-2007 Martin F. Krafft <libkdtree@pobox.madduck.net>
+ * and Sylvain Bougerel <sylvain.bougerel.devel@gmail.com> distributed under the
+ * terms of the Artistic License 2.0. See the ./COPYING file in the source tree
+ * root for more information.
+ *
+ * THIS PACKAGE IS PROVIDED "AS IS" AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES
+ * OF MERCHANTIBILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
@@ -0,0 +1,1054 @@
+/** \file
+ * Defines the interface for the StaticKDTree class.
+ *
+ * A StaticKDTree is a read-only kd-tree that is built once from a sequence
+ * of values and then queried many times.  It uses the same median
+ * partitioning as KDTree::_M_optimise(), but instead of inserting every
+ * median into a linked tree, it keeps the partitioned values in a single
+ * contiguous array:
+ *
+ *  * The node covering the index range [lo, hi) is the value stored at
+ *    lo + (hi - lo) / 2 and it splits on the dimension (depth % __K).
+ *  * Its left subtree covers [lo, mid), its right subtree [mid + 1, hi).
+ *  * A range holding no more than __Bucket values, at least 1, is not
+ *    partitioned any further.  It is a leaf bucket, which the searches scan
+ *    linearly.
+ *
+ * The layout is implicit, so nodes carry no parent or child pointers and a
+ * traversal step is an index computation in a single allocation rather than a
+ * dependent pointer load.  As for KDTree, the left subtree holds values <= the
+ * node on its splitting dimension and the right subtree holds values >= it.
+ *
+ * Where the searches read the coordinates from is decided by a storage
+ * policy, see inline_coordinates and packed_coordinates below.
+ */
+
+#ifndef INCLUDE_KDTREE_STATIC_KDTREE_HPP
+#define INCLUDE_KDTREE_STATIC_KDTREE_HPP
+
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <iterator>
+#include <limits>
+
+#include <cmath>
+#include <cstddef>
+
+#include "function.hpp"
+#include "node.hpp"
+#include "region.hpp"
+
+namespace KDTree
+{
+
+  /*! Storage policy for StaticKDTree: the coordinates are read from the
+      values through the accessor.  This needs no memory beyond the values.
+   */
+  struct inline_coordinates
+  {
+    template <size_t const __K, typename _Val, typename _Acc>
+      class _Store
+      {
+      public:
+        typedef typename _Acc::result_type subvalue_type;
+
+        template <typename _Vector>
+          void
+          assign(_Vector const&, _Acc const&) { }
+
+        void clear() { }
+
+        void swap(_Store&) { }
+
+        template <typename _Vector>
+          subvalue_type
+          operator()(_Vector const& __values, size_t const __i,
+                     size_t const __dim, _Acc const& __acc) const
+          {
+            return __acc(__values[__i], __dim);
+          }
+      };
+  };
+
+  /*! Storage policy for StaticKDTree: a copy of the coordinates is kept in
+      one array per dimension, next to the values.
+
+      The searches only read these arrays, the values themselves are touched
+      when a value is reported (or handed to a predicate).  This pays off
+      when the values are much larger than their __K coordinates.
+   */
+  struct packed_coordinates
+  {
+    template <size_t const __K, typename _Val, typename _Acc>
+      class _Store
+      {
+      public:
+        typedef typename _Acc::result_type subvalue_type;
+
+        _Store() : _M_size(0) { }
+
+        template <typename _Vector>
+          void
+          assign(_Vector const& __values, _Acc const& __acc)
+          {
+            _M_size = __values.size();
+            _M_coords.resize(__K * _M_size);
+            for (size_t __dim = 0; __dim != __K; ++__dim)
+              {
+                subvalue_type* __c = _M_size ? &_M_coords[__dim * _M_size] : 0;
+                for (size_t __i = 0; __i != _M_size; ++__i)
+                  __c[__i] = __acc(__values[__i], __dim);
+              }
+          }
+
+        void
+        clear()
+        {
+          _M_coords.clear();
+          _M_size = 0;
+        }
+
+        void
+        swap(_Store& __x)
+        {
+          _M_coords.swap(__x._M_coords);
+          std::swap(_M_size, __x._M_size);
+        }
+
+        template <typename _Vector>
+          subvalue_type
+          operator()(_Vector const&, size_t const __i,
+                     size_t const __dim, _Acc const&) const
+          {
+            return _M_coords[__dim * _M_size + __i];
+          }
+
+      private:
+        std::vector<subvalue_type> _M_coords;
+        size_t _M_size;
+      };
+  };
+
+  template <size_t const __K, typename _Val,
+            typename _Acc = _Bracket_accessor<_Val>,
+	    typename _Dist = squared_difference<typename _Acc::result_type,
+						typename _Acc::result_type>,
+            typename _Cmp = std::less<typename _Acc::result_type>,
+            typename _Alloc = std::allocator<_Val>,
+            typename _Coords = inline_coordinates,
+            // the most values a leaf bucket holds, at least 1
+            size_t const __Bucket = 8>
+    class StaticKDTree
+    {
+#if __cplusplus >= 201103L
+      static_assert(__Bucket >= 1, "the leaf buckets must hold a value");
+#else
+      // a bucket size of 0 gives an array of negative size here
+      typedef char _Bucket_must_hold_a_value[__Bucket >= 1 ? 1 : -1];
+#endif
+
+    protected:
+      typedef std::vector<_Val, _Alloc> _Storage;
+      typedef typename _Coords::template _Store<__K, _Val, _Acc> _Coord_store;
+      typedef _Node_compare<_Val, _Acc, _Cmp> _Node_compare_;
+      typedef distance_traits<_Dist> _Dist_traits;
+
+    public:
+      typedef _Region<__K, _Val, typename _Acc::result_type, _Acc, _Cmp>
+        _Region_;
+      typedef _Val value_type;
+      typedef value_type* pointer;
+      typedef value_type const* const_pointer;
+      typedef value_type& reference;
+      typedef value_type const& const_reference;
+      typedef typename _Acc::result_type subvalue_type;
+      typedef typename _Dist::distance_type distance_type;
+      typedef size_t size_type;
+      typedef ptrdiff_t difference_type;
+      typedef _Alloc allocator_type;
+
+      // The values cannot be modified in place, it would invalidate the tree.
+      typedef typename _Storage::const_iterator const_iterator;
+      typedef const_iterator iterator;
+      typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+      typedef const_reverse_iterator reverse_iterator;
+
+      StaticKDTree(_Acc const& __acc = _Acc(), _Dist const& __dist = _Dist(),
+		   _Cmp const& __cmp = _Cmp(),
+		   const allocator_type& __a = allocator_type())
+        : _M_values(__a), _M_acc(__acc), _M_cmp(__cmp), _M_dist(__dist)
+      { }
+
+      template<typename _InputIterator>
+        StaticKDTree(_InputIterator __first, _InputIterator __last,
+		     _Acc const& __acc = _Acc(), _Dist const& __dist = _Dist(),
+		     _Cmp const& __cmp = _Cmp(),
+		     const allocator_type& __a = allocator_type())
+        : _M_values(__first, __last, __a),
+	  _M_acc(__acc), _M_cmp(__cmp), _M_dist(__dist)
+      {
+        _M_build(0, _M_values.size(), 0);
+        _M_coords.assign(_M_values, _M_acc);
+      }
+
+      // this will CLEAR the tree and take over the contents of
+      // 'writable_vector', which is left empty.  No value is copied.
+      void efficient_replace_and_optimise(_Storage& writable_vector)
+      {
+        _M_values.clear();
+        _M_values.swap(writable_vector);
+        _M_build(0, _M_values.size(), 0);
+        _M_coords.assign(_M_values, _M_acc);
+      }
+
+      void
+      swap(StaticKDTree& __x)
+      {
+        _M_values.swap(__x._M_values);
+        _M_coords.swap(__x._M_coords);
+        std::swap(_M_acc, __x._M_acc);
+        std::swap(_M_cmp, __x._M_cmp);
+        std::swap(_M_dist, __x._M_dist);
+      }
+
+      allocator_type
+      get_allocator() const
+      {
+        return _M_values.get_allocator();
+      }
+
+      size_type
+      size() const
+      {
+        return _M_values.size();
+      }
+
+      size_type
+      max_size() const
+      {
+        return _M_values.max_size();
+      }
+
+      bool
+      empty() const
+      {
+        return _M_values.empty();
+      }
+
+      void
+      clear()
+      {
+        _M_values.clear();
+        _M_coords.clear();
+      }
+
+      _Cmp
+      value_comp() const
+      { return _M_cmp; }
+
+      _Acc
+      value_acc() const
+      { return _M_acc; }
+
+      const _Dist&
+      value_distance() const
+      { return _M_dist; }
+
+      _Dist&
+      value_distance()
+      { return _M_dist; }
+
+      const_iterator begin() const { return _M_values.begin(); }
+      const_iterator end() const { return _M_values.end(); }
+      const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+      const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
+
+      // compares via equivalence, see KDTree::find()
+      template <class SearchVal>
+      const_iterator
+      find(SearchVal const& __V) const
+      {
+        subvalue_type __q[__K];
+        _M_get_coords(__V, __q);
+        return begin() + _M_find(0, size(), 0, __q, __V, false);
+      }
+
+      // compares via equality, see KDTree::find_exact()
+      template <class SearchVal>
+      const_iterator
+      find_exact(SearchVal const& __V) const
+      {
+        subvalue_type __q[__K];
+        _M_get_coords(__V, __q);
+        return begin() + _M_find(0, size(), 0, __q, __V, true);
+      }
+
+      // NOTE: see notes on KDTree::find_within_range().
+      size_type
+      count_within_range(const_reference __V, subvalue_type const __R) const
+      {
+        if (empty()) return 0;
+        _Region_ __region(__V, __R, _M_acc, _M_cmp);
+        return this->count_within_range(__region);
+      }
+
+      size_type
+      count_within_range(_Region_ const& __REGION) const
+      {
+        if (empty()) return 0;
+        return _M_visit_within_range(_Count_visitor(), __REGION)._M_count;
+      }
+
+      template <typename SearchVal, class Visitor>
+        Visitor
+        visit_within_range(SearchVal const& V, subvalue_type const R,
+                           Visitor visitor) const
+        {
+          if (empty()) return visitor;
+          _Region_ region(V, R, _M_acc, _M_cmp);
+          return this->visit_within_range(region, visitor);
+        }
+
+      template <class Visitor>
+        Visitor
+        visit_within_range(_Region_ const& REGION, Visitor visitor) const
+        {
+          if (empty()) return visitor;
+          return _M_visit_within_range(visitor, REGION);
+        }
+
+      // NOTE: see notes on KDTree::find_within_range(), this returns the
+      // values within a box, not within a sphere.
+      template <typename SearchVal, typename _OutputIterator>
+        _OutputIterator
+        find_within_range(SearchVal const& val, subvalue_type const range,
+                          _OutputIterator out) const
+        {
+          if (empty()) return out;
+          _Region_ region(val, range, _M_acc, _M_cmp);
+          return this->find_within_range(region, out);
+        }
+
+      template <typename _OutputIterator>
+        _OutputIterator
+        find_within_range(_Region_ const& region,
+                          _OutputIterator out) const
+        {
+          if (empty()) return out;
+          return _M_visit_within_range(_Output_visitor<_OutputIterator>(out),
+                                       region)._M_out;
+        }
+
+      template <class SearchVal>
+      std::pair<const_iterator, distance_type>
+      find_nearest(SearchVal const& __val) const
+      {
+        if (empty())
+          return std::pair<const_iterator, distance_type>(end(), 0);
+        subvalue_type __q[__K];
+        _M_get_coords(__val, __q);
+        size_type __best = size() / 2;
+        distance_type __max_sum = _M_distance(__best, __q);
+        _M_find_nearest(0, size(), 0, __q, always_true<value_type>(),
+                        __best, __max_sum);
+        return std::pair<const_iterator, distance_type>
+          (begin() + __best, _Dist_traits::to_distance(__max_sum));
+      }
+
+      template <class SearchVal>
+      std::pair<const_iterator, distance_type>
+      find_nearest(SearchVal const& __val, distance_type __max) const
+      {
+        return find_nearest_if(__val, __max, always_true<value_type>());
+      }
+
+      template <class SearchVal, class _Predicate>
+      std::pair<const_iterator, distance_type>
+      find_nearest_if(SearchVal const& __val, distance_type __max,
+                      _Predicate __p) const
+      {
+        size_type __best = size();
+        if (!empty())
+          {
+            subvalue_type __q[__K];
+            _M_get_coords(__val, __q);
+            distance_type __max_sum = _Dist_traits::from_distance(__max);
+            _M_find_nearest(0, size(), 0, __q, __p, __best, __max_sum);
+            if (__best != size())
+              __max = _Dist_traits::to_distance(__max_sum);
+          }
+        return std::pair<const_iterator, distance_type>
+          (begin() + __best, __max);
+      }
+
+      /*! Find the __k values nearest to __val, see KDTree::find_k_nearest().
+
+	Writes to __out a std::pair<const_iterator, distance_type> for each of
+	them, nearest first.  Fewer are written if the tree holds fewer than
+	__k values.
+       */
+      template <class SearchVal, typename _OutputIterator>
+      _OutputIterator
+      find_k_nearest(SearchVal const& __val, size_type const __k,
+                     _OutputIterator __out) const
+      {
+        subvalue_type __q[__K];
+        _M_get_coords(__val, __q);
+        std::vector<_Candidate> __heap;
+        return _M_find_k_nearest(__q, __k, __heap, __out);
+      }
+
+      /*! Find the nearest value to each of the values in [__first, __last),
+	and store in __out[i] what find_nearest() returns for the i-th one.
+
+	The queries walk down the tree together rather than one by one: each
+	node is read once for all the queries that reach it, see
+	_M_search_batch(), and each leaf bucket is compared with all of them
+	while it is in the cache.  Ties may be broken differently than by
+	find_nearest().
+
+	\return __out advanced past the last answer.
+       */
+      template <typename _InputIterator, typename _RandomAccessIterator>
+      _RandomAccessIterator
+      find_nearest_batch(_InputIterator __first, _InputIterator __last,
+                         _RandomAccessIterator __out) const
+      {
+        std::vector<subvalue_type> __q;
+        std::vector<size_type> __order;
+        _M_order_queries(__first, __last, __q, __order);
+        size_type const __n = __order.size();
+        if (empty())
+          {
+            for (size_type __i = 0; __i != __n; ++__i)
+              __out[__i] = std::pair<const_iterator, distance_type>(end(), 0);
+            return __out + __n;
+          }
+        // every query starts bounded by the middle value
+        _Nearest_batch __search;
+        __search._M_best.assign(__n, size() / 2);
+        __search._M_max_sum.resize(__n);
+        for (size_type __i = 0; __i != __n; ++__i)
+          __search._M_max_sum[__i] = _M_distance(size() / 2, &__q[__i * __K]);
+        // the queries are numbered in the order of __q from here on
+        std::vector<size_type> __active(__n);
+        for (size_type __i = 0; __i != __n; ++__i)
+          __active[__i] = __i;
+        if (__n)
+          _M_search_batch(0, size(), 0, &__q[0], &__active[0],
+                          &__active[0] + __n, __search);
+        for (size_type __i = 0; __i != __n; ++__i)
+          __out[__order[__i]] = std::pair<const_iterator, distance_type>
+            (begin() + __search._M_best[__i],
+             _Dist_traits::to_distance(__search._M_max_sum[__i]));
+        return __out + __n;
+      }
+
+      /*! Find the __k values nearest to each of the values in [__first,
+	__last), in the order described for find_nearest_batch().
+
+	The answers for the i-th query are stored nearest first in
+	__out[i * __n] to __out[i * __n + __n - 1], where __n is the smaller
+	of __k and size().  Each query keeps its own heap of __n candidates.
+
+	\return __out advanced past the last answer.
+       */
+      template <typename _InputIterator, typename _RandomAccessIterator>
+      _RandomAccessIterator
+      find_k_nearest_batch(_InputIterator __first, _InputIterator __last,
+                           size_type const __k,
+                           _RandomAccessIterator __out) const
+      {
+        std::vector<subvalue_type> __q;
+        std::vector<size_type> __order;
+        _M_order_queries(__first, __last, __q, __order);
+        size_type const __n = __k < size() ? __k : size();
+        if (!__n || __order.empty())
+          return __out;
+        _K_nearest_batch __search(__order.size(), __n);
+        // the queries are numbered in the order of __q from here on
+        std::vector<size_type> __active(__order.size());
+        for (size_type __i = 0; __i != __active.size(); ++__i)
+          __active[__i] = __i;
+        _M_search_batch(0, size(), 0, &__q[0], &__active[0],
+                        &__active[0] + __active.size(), __search);
+        for (size_type __i = 0; __i != __order.size(); ++__i)
+          {
+            _Candidate* const __heap = &__search._M_heaps[__i * __n];
+            std::sort_heap(__heap, __heap + __n);
+            for (size_type __j = 0; __j != __n; ++__j)
+              __out[__order[__i] * __n + __j]
+                = std::pair<const_iterator, distance_type>
+                  (begin() + __heap[__j].second,
+                   _Dist_traits::to_distance(__heap[__j].first));
+          }
+        return __out + __order.size() * __n;
+      }
+
+    protected:
+      // a distance, as a sum of _Dist, and the index of the value; the
+      // farthest candidate, then the last in the array, is on top of the heap
+      typedef std::pair<distance_type, size_type> _Candidate;
+
+      void
+      _M_build(size_type const __lo, size_type const __hi,
+               size_type const __L)
+      {
+        if (__hi - __lo <= __Bucket) return;
+        size_type const __mid = __lo + (__hi - __lo) / 2;
+        typename _Storage::iterator const __first = _M_values.begin();
+        std::nth_element(__first + __lo, __first + __mid, __first + __hi,
+                         _Node_compare_(__L % __K, _M_acc, _M_cmp));
+        _M_build(__lo, __mid, __L+1);
+        _M_build(__mid+1, __hi, __L+1);
+      }
+
+      subvalue_type
+      _M_coord(size_type const __i, size_type const __dim) const
+      {
+        return _M_coords(_M_values, __i, __dim, _M_acc);
+      }
+
+      template <class SearchVal>
+      void
+      _M_get_coords(SearchVal const& __V, subvalue_type* __q) const
+      {
+        for (size_type __i = 0; __i != __K; ++__i)
+          __q[__i] = _M_acc(__V, __i);
+      }
+
+      distance_type
+      _M_distance(size_type const __i, subvalue_type const* __q) const
+      {
+        distance_type d = 0;
+        for (size_type __dim = 0; __dim != __K; ++__dim)
+          d += _M_dist(_M_coord(__i, __dim), __q[__dim]);
+        return d;
+      }
+
+      bool
+      _M_encloses(_Region_ const& __REGION, size_type const __i) const
+      {
+        for (size_type __dim = 0; __dim != __K; ++__dim)
+          {
+            subvalue_type const __c = _M_coord(__i, __dim);
+            if (_M_cmp(__c, __REGION._M_low_bounds[__dim])
+             || _M_cmp(__REGION._M_high_bounds[__dim], __c))
+              return false;
+          }
+        return true;
+      }
+
+      /*! Tell which values of the leaf bucket [__lo, __hi) lie within
+          __REGION.
+
+          The tests are done one dimension at a time over the whole bucket,
+          without branching, so that the compiler can vectorise the loops
+          when the coordinates are packed.
+       */
+      void
+      _M_leaf_encloses(_Region_ const& __REGION, size_type const __lo,
+                       size_type const __hi, unsigned char* __in) const
+      {
+        size_type const __n = __hi - __lo;
+        for (size_type __i = 0; __i != __n; ++__i)
+          __in[__i] = true;
+        for (size_type __dim = 0; __dim != __K; ++__dim)
+          {
+            subvalue_type const __low = __REGION._M_low_bounds[__dim];
+            subvalue_type const __high = __REGION._M_high_bounds[__dim];
+            for (size_type __i = 0; __i != __n; ++__i)
+              {
+                subvalue_type const __c = _M_coord(__lo + __i, __dim);
+                __in[__i] = __in[__i]
+                  & !(_M_cmp(__c, __low) | _M_cmp(__high, __c));
+              }
+          }
+      }
+
+      /*! Compute the distances between __q and all the values of the leaf
+          bucket [__lo, __hi), see _M_leaf_encloses().
+       */
+      void
+      _M_leaf_distances(size_type const __lo, size_type const __hi,
+                        subvalue_type const* __q, distance_type* __d) const
+      {
+        size_type const __n = __hi - __lo;
+        for (size_type __i = 0; __i != __n; ++__i)
+          __d[__i] = 0;
+        for (size_type __dim = 0; __dim != __K; ++__dim)
+          {
+            subvalue_type const __c = __q[__dim];
+            for (size_type __i = 0; __i != __n; ++__i)
+              __d[__i] += _M_dist(_M_coord(__lo + __i, __dim), __c);
+          }
+      }
+
+      // returns size() when nothing is found
+      template <class SearchVal>
+      size_type
+      _M_find(size_type const __lo, size_type const __hi, size_type const __L,
+              subvalue_type const* __q, SearchVal const& __V,
+              bool const __exact) const
+      {
+        // be aware! identical values can be found down both branches, see
+        // the notes on top of kdtree.hpp
+        if (__hi - __lo <= __Bucket)
+          {
+            for (size_type __i = __lo; __i != __hi; ++__i)
+              if (__exact ? __V == _M_values[__i] : _M_matches(__i, __q))
+                return __i;
+            return size();
+          }
+        size_type const __mid = __lo + (__hi - __lo) / 2;
+        size_type const __dim = __L % __K;
+        size_type __found = size();
+        if (!_M_cmp(_M_coord(__mid, __dim), __q[__dim]))   // note, this is a <= test
+          {
+            if (__exact ? __V == _M_values[__mid] : _M_matches(__mid, __q))
+              return __mid;
+            __found = _M_find(__lo, __mid, __L+1, __q, __V, __exact);
+          }
+        if (__found == size()
+            && !_M_cmp(__q[__dim], _M_coord(__mid, __dim)))   // note, this is a <= test
+          __found = _M_find(__mid+1, __hi, __L+1, __q, __V, __exact);
+        return __found;
+      }
+
+      bool
+      _M_matches(size_type const __i, subvalue_type const* __q) const
+      {
+        for (size_type __dim = 0; __dim != __K; ++__dim)
+          {
+            subvalue_type const __c = _M_coord(__i, __dim);
+            if (_M_cmp(__c, __q[__dim]) || _M_cmp(__q[__dim], __c))
+              return false;
+          }
+        return true;
+      }
+
+      template <typename _OutputIterator>
+        struct _Output_visitor
+        {
+          _Output_visitor(_OutputIterator const& __out) : _M_out(__out) { }
+
+          void
+          operator()(const_reference __V)
+          { *_M_out++ = __V; }
+
+          _OutputIterator _M_out;
+        };
+
+      struct _Count_visitor
+      {
+        _Count_visitor() : _M_count(0) { }
+
+        void
+        operator()(const_reference)
+        { ++_M_count; }
+
+        size_type _M_count;
+      };
+
+      // the subtree [_M_lo, _M_hi) at depth _M_L
+      struct _Range_frame
+      {
+        size_type _M_lo, _M_hi, _M_L;
+      };
+
+      /*! Visit the values within __REGION, with the subtrees still to visit
+	on a stack of fixed size rather than by recursion.  Each level halves
+	the subtrees, so the stack holds at most one subtree per bit of
+	size_type, and one more.  The cell of a subtree being visited
+	intersects __REGION, so the cell of a child does too unless the plane
+	of the middle value leaves it beyond __REGION; only that bound is
+	tested, and __REGION is never copied.
+       */
+      template <class Visitor>
+        Visitor
+        _M_visit_within_range(Visitor __visitor,
+                              _Region_ const& __REGION) const
+        {
+          _Range_frame __stack[std::numeric_limits<size_type>::digits + 1];
+          size_type __top = 0;
+          __stack[0]._M_lo = 0;
+          __stack[0]._M_hi = size();
+          __stack[0]._M_L = 0;
+          ++__top;
+          while (__top)
+            {
+              _Range_frame const __f = __stack[--__top];
+              if (__f._M_hi - __f._M_lo <= __Bucket)
+                {
+                  unsigned char __in[__Bucket];
+                  _M_leaf_encloses(__REGION, __f._M_lo, __f._M_hi, __in);
+                  for (size_type __i = 0; __i != __f._M_hi - __f._M_lo; ++__i)
+                    if (__in[__i]) __visitor(_M_values[__f._M_lo + __i]);
+                  continue;
+                }
+              size_type const __mid = __f._M_lo + (__f._M_hi - __f._M_lo) / 2;
+              size_type const __dim = __f._M_L % __K;
+              if (_M_encloses(__REGION, __mid))
+                __visitor(_M_values[__mid]);
+              subvalue_type const __c = _M_coord(__mid, __dim);
+              // the right subtree is pushed first, to be visited last
+              if (__mid+1 != __f._M_hi
+                  && !_M_cmp(__REGION._M_high_bounds[__dim], __c))
+                {
+                  __stack[__top]._M_lo = __mid+1;
+                  __stack[__top]._M_hi = __f._M_hi;
+                  __stack[__top]._M_L = __f._M_L+1;
+                  ++__top;
+                }
+              if (__f._M_lo != __mid
+                  && !_M_cmp(__c, __REGION._M_low_bounds[__dim]))
+                {
+                  __stack[__top]._M_lo = __f._M_lo;
+                  __stack[__top]._M_hi = __mid;
+                  __stack[__top]._M_L = __f._M_L+1;
+                  ++__top;
+                }
+            }
+          return __visitor;
+        }
+
+      /*! Find the nearest value to the point __q in [__lo, __hi) that
+          satisfies __p and is no further than __max_sum, a sum of _Dist as
+          described in distance_traits.
+
+          On return, __best and __max_sum hold the index and the distance of
+          the best candidate found so far; __best is left untouched if no
+          better candidate was found.
+       */
+      template <class _Predicate>
+      void
+      _M_find_nearest(size_type const __lo, size_type const __hi,
+                      size_type const __L, subvalue_type const* __q,
+                      _Predicate __p, size_type& __best,
+                      distance_type& __max_sum) const
+      {
+        if (__hi - __lo <= __Bucket)
+          {
+            distance_type __d[__Bucket];
+            _M_leaf_distances(__lo, __hi, __q, __d);
+            for (size_type __i = 0; __i != __hi - __lo; ++__i)
+              {
+                if (__d[__i] <= __max_sum && __p(_M_values[__lo + __i]))
+                  {
+                    __best = __lo + __i;
+                    __max_sum = __d[__i];
+                  }
+              }
+            return;
+          }
+        size_type const __mid = __lo + (__hi - __lo) / 2;
+        if (__p(_M_values[__mid]))
+          {
+            distance_type d = _M_distance(__mid, __q);
+            if (d <= __max_sum)
+              {
+                __best = __mid;
+                __max_sum = d;
+              }
+          }
+        size_type const __dim = __L % __K;
+        subvalue_type const __split = _M_coord(__mid, __dim);
+        bool const __left_is_near = _M_cmp(__q[__dim], __split);
+        size_type const __near_lo = __left_is_near ? __lo : __mid+1;
+        size_type const __near_hi = __left_is_near ? __mid : __hi;
+        size_type const __far_lo = __left_is_near ? __mid+1 : __lo;
+        size_type const __far_hi = __left_is_near ? __hi : __mid;
+        if (__near_lo != __near_hi)
+          _M_find_nearest(__near_lo, __near_hi, __L+1, __q, __p,
+                          __best, __max_sum);
+        // only visit the far side if its plane intersects the hypersphere
+        if (__far_lo != __far_hi
+            && _M_dist(__split, __q[__dim]) <= __max_sum)
+          _M_find_nearest(__far_lo, __far_hi, __L+1, __q, __p,
+                          __best, __max_sum);
+      }
+
+      /*! Copy the coordinates of the queries [__first, __last) to __q in
+          the order of the leaf buckets they fall in, see _M_sort_queries(),
+          so that the queries searching the same subtree, and what
+          _M_search_batch() keeps about them, lie next to each other.  The
+          i-th query of __q is the __order[i]-th one given.
+       */
+      template <typename _InputIterator>
+      void
+      _M_order_queries(_InputIterator __first, _InputIterator __last,
+                       std::vector<subvalue_type>& __q,
+                       std::vector<size_type>& __order) const
+      {
+        std::vector<subvalue_type> __given;
+        for (; __first != __last; ++__first)
+          {
+            size_type const __n = __given.size();
+            __given.resize(__n + __K);
+            _M_get_coords(*__first, &__given[__n]);
+          }
+        __order.resize(__given.size() / __K);
+        for (size_type __i = 0; __i != __order.size(); ++__i)
+          __order[__i] = __i;
+        if (__order.empty())
+          return;
+        _M_sort_queries(0, size(), 0, &__given[0],
+                        &__order[0], &__order[0] + __order.size());
+        __q.resize(__given.size());
+        for (size_type __i = 0; __i != __order.size(); ++__i)
+          std::copy(&__given[__order[__i] * __K],
+                    &__given[__order[__i] * __K] + __K, &__q[__i * __K]);
+      }
+
+      /*! Partition the queries [__first, __last) down the subtree [__lo,
+          __hi) the way _M_find_nearest() descends it, until each group holds
+          the queries that fall in the same leaf bucket.
+       */
+      void
+      _M_sort_queries(size_type const __lo, size_type const __hi,
+                      size_type const __L, subvalue_type const* __q,
+                      size_type* const __first, size_type* const __last) const
+      {
+        if (__hi - __lo <= __Bucket || __last - __first < 2) return;
+        size_type const __mid = __lo + (__hi - __lo) / 2;
+        size_type const __dim = __L % __K;
+        subvalue_type const __split = _M_coord(__mid, __dim);
+        size_type* __middle = __first;
+        for (size_type* __i = __first; __i != __last; ++__i)
+          if (_M_cmp(__q[*__i * __K + __dim], __split))
+            std::iter_swap(__i, __middle++);
+        _M_sort_queries(__lo, __mid, __L+1, __q, __first, __middle);
+        _M_sort_queries(__mid+1, __hi, __L+1, __q, __middle, __last);
+      }
+
+      // The answers and the bounds of the queries of find_nearest_batch().
+      struct _Nearest_batch
+      {
+        // whether the query __i still looks for values at __d
+        bool
+        _M_reaches(size_type const __i, distance_type const __d) const
+        { return __d <= _M_max_sum[__i]; }
+
+        void
+        _M_offer(size_type const __i, size_type const __v,
+                 distance_type const __d)
+        {
+          if (__d <= _M_max_sum[__i])
+            {
+              _M_best[__i] = __v;
+              _M_max_sum[__i] = __d;
+            }
+        }
+
+        std::vector<size_type> _M_best;
+        std::vector<distance_type> _M_max_sum;
+      };
+
+      // The heaps of the queries of find_k_nearest_batch(), __k candidates
+      // each, one after the other, see _S_offer().
+      struct _K_nearest_batch
+      {
+        _K_nearest_batch(size_type const __queries, size_type const __k)
+          : _M_k(__k), _M_heaps(__queries * __k), _M_sizes(__queries, 0) { }
+
+        bool
+        _M_reaches(size_type const __i, distance_type const __d) const
+        { return _M_sizes[__i] < _M_k || __d <= _M_heaps[__i * _M_k].first; }
+
+        void
+        _M_offer(size_type const __i, size_type const __v,
+                 distance_type const __d)
+        {
+          _Candidate* const __heap = &_M_heaps[__i * _M_k];
+          size_type& __size = _M_sizes[__i];
+          _Candidate const __c(__d, __v);
+          if (__size < _M_k)
+            {
+              __heap[__size++] = __c;
+              std::push_heap(__heap, __heap + __size);
+            }
+          else if (__c < __heap[0])
+            {
+              std::pop_heap(__heap, __heap + _M_k);
+              __heap[_M_k - 1] = __c;
+              std::push_heap(__heap, __heap + _M_k);
+            }
+        }
+
+        size_type _M_k;
+        std::vector<_Candidate> _M_heaps;
+        std::vector<size_type> _M_sizes;
+      };
+
+      /*! Search the subtree [__lo, __hi) for the queries [__first, __last)
+          at once.  Every query is offered the middle value, and the queries
+          are split by the side of its plane they lie on.  Each group first
+          searches its own side, as _M_find_nearest() does, then those of
+          its queries whose bound still reaches the plane search the other
+          side.  __search keeps the answers and bounds of the queries, see
+          _Nearest_batch; [__first, __last) is reordered.
+       */
+      template <class _Search>
+      void
+      _M_search_batch(size_type const __lo, size_type const __hi,
+                      size_type const __L, subvalue_type const* __q,
+                      size_type* const __first, size_type* const __last,
+                      _Search& __search) const
+      {
+        if (__hi - __lo <= __Bucket)
+          {
+            distance_type __d[__Bucket];
+            for (size_type* __i = __first; __i != __last; ++__i)
+              {
+                _M_leaf_distances(__lo, __hi, &__q[*__i * __K], __d);
+                for (size_type __j = 0; __j != __hi - __lo; ++__j)
+                  __search._M_offer(*__i, __lo + __j, __d[__j]);
+              }
+            return;
+          }
+        size_type const __mid = __lo + (__hi - __lo) / 2;
+        size_type const __dim = __L % __K;
+        subvalue_type const __split = _M_coord(__mid, __dim);
+        size_type* __middle = __first;
+        for (size_type* __i = __first; __i != __last; ++__i)
+          {
+            subvalue_type const* const __qi = &__q[*__i * __K];
+            __search._M_offer(*__i, __mid, _M_distance(__mid, __qi));
+            if (_M_cmp(__qi[__dim], __split))
+              std::iter_swap(__i, __middle++);
+          }
+        // [__first, __middle) are nearer the left side
+        if (__lo != __mid && __first != __middle)
+          _M_search_batch(__lo, __mid, __L+1, __q, __first, __middle,
+                          __search);
+        if (__mid+1 != __hi && __middle != __last)
+          _M_search_batch(__mid+1, __hi, __L+1, __q, __middle, __last,
+                          __search);
+        // only visit the far side if its plane is within the bound
+        if (__mid+1 != __hi)
+          {
+            size_type* const __reach = _M_reaching(__first, __middle, __q,
+                                                   __dim, __split, __search);
+            if (__first != __reach)
+              _M_search_batch(__mid+1, __hi, __L+1, __q, __first, __reach,
+                              __search);
+          }
+        if (__lo != __mid)
+          {
+            size_type* const __reach = _M_reaching(__middle, __last, __q,
+                                                   __dim, __split, __search);
+            if (__middle != __reach)
+              _M_search_batch(__lo, __mid, __L+1, __q, __middle, __reach,
+                              __search);
+          }
+      }
+
+      // Moves to the front the queries of [__first, __last) whose bound
+      // reaches the plane __split on __dim, and returns the end of them.
+      template <class _Search>
+      size_type*
+      _M_reaching(size_type* const __first, size_type* const __last,
+                  subvalue_type const* __q, size_type const __dim,
+                  subvalue_type const __split, _Search const& __search) const
+      {
+        size_type* __reach = __first;
+        for (size_type* __i = __first; __i != __last; ++__i)
+          if (__search._M_reaches(*__i, _M_dist(__split,
+                                                __q[*__i * __K + __dim])))
+            std::iter_swap(__i, __reach++);
+        return __reach;
+      }
+
+      template <typename _OutputIterator>
+      _OutputIterator
+      _M_find_k_nearest(subvalue_type const* __q, size_type const __k,
+                        std::vector<_Candidate>& __heap,
+                        _OutputIterator __out) const
+      {
+        __heap.clear();
+        if (!__k || empty()) return __out;
+        _M_find_k_nearest(0, size(), 0, __q, __k, __heap);
+        std::sort_heap(__heap.begin(), __heap.end());
+        for (size_type __i = 0; __i != __heap.size(); ++__i)
+          *__out++ = std::pair<const_iterator, distance_type>
+            (begin() + __heap[__i].second,
+             _Dist_traits::to_distance(__heap[__i].first));
+        return __out;
+      }
+
+      static void
+      _S_offer(_Candidate const& __c, size_type const __k,
+               std::vector<_Candidate>& __heap)
+      {
+        if (__heap.size() < __k)
+          {
+            __heap.push_back(__c);
+            std::push_heap(__heap.begin(), __heap.end());
+          }
+        else if (__c < __heap.front())
+          {
+            std::pop_heap(__heap.begin(), __heap.end());
+            __heap.back() = __c;
+            std::push_heap(__heap.begin(), __heap.end());
+          }
+      }
+
+      // Adds to __heap, a max-heap of at most __k candidates, the values of
+      // [__lo, __hi) nearer than the candidates it holds.
+      void
+      _M_find_k_nearest(size_type const __lo, size_type const __hi,
+                        size_type const __L, subvalue_type const* __q,
+                        size_type const __k,
+                        std::vector<_Candidate>& __heap) const
+      {
+        if (__hi - __lo <= __Bucket)
+          {
+            distance_type __d[__Bucket];
+            _M_leaf_distances(__lo, __hi, __q, __d);
+            for (size_type __i = 0; __i != __hi - __lo; ++__i)
+              _S_offer(_Candidate(__d[__i], __lo + __i), __k, __heap);
+            return;
+          }
+        size_type const __mid = __lo + (__hi - __lo) / 2;
+        _S_offer(_Candidate(_M_distance(__mid, __q), __mid), __k, __heap);
+        size_type const __dim = __L % __K;
+        subvalue_type const __split = _M_coord(__mid, __dim);
+        bool const __left_is_near = _M_cmp(__q[__dim], __split);
+        size_type const __near_lo = __left_is_near ? __lo : __mid+1;
+        size_type const __near_hi = __left_is_near ? __mid : __hi;
+        size_type const __far_lo = __left_is_near ? __mid+1 : __lo;
+        size_type const __far_hi = __left_is_near ? __hi : __mid;
+        if (__near_lo != __near_hi)
+          _M_find_k_nearest(__near_lo, __near_hi, __L+1, __q, __k, __heap);
+        // only visit the far side if its plane is nearer than the k-th
+        if (__far_lo != __far_hi
+            && (__heap.size() < __k
+                || _M_dist(__split, __q[__dim]) <= __heap.front().first))
+          _M_find_k_nearest(__far_lo, __far_hi, __L+1, __q, __k, __heap);
+      }
+
+      _Storage _M_values;
+      _Coord_store _M_coords;
+      _Acc _M_acc;
+      _Cmp _M_cmp;
+      _Dist _M_dist;
+    };
+
+} // namespace KDTree
+
+#endif // include guard
+
+/* COPYRIGHT --
+ *
+ * This file is part of libkdtree++, a C++ template KD-Tree sorting container.
+ * libkdtree++ is (c) 2004-2007 Martin F. Krafft <libkdtree@pobox.madduck.net>
+ * and Sylvain Bougerel <sylvain.bougerel.devel@gmail.com> distributed under the
+ * terms of the Artistic License 2.0. See the ./COPYING file in the source tree
+ * root for more information.
+ *
+ * THIS PACKAGE IS PROVIDED "AS IS" AND WITHOUT ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED WARRANTIES
+ * OF MERCHANTIBILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */